@@ -472,18 +472,12 @@ int sort_huffbits(unsigned char *bits)
 {
    int i, j;
    int l1, l2, l3;
-   short *tbits;
+   short tbits[MAX_HUFFBITS<<1];
 
    l3 = MAX_HUFFBITS<<1;       /* 32 */
    l1 = l3 - 1;                /* 31 */
    l2 = MAX_HUFFBITS - 1;      /* 15 */
 
-   tbits = (short *)malloc(l3*sizeof(short));
-   if(tbits == (short *)NULL){
-      fprintf(stderr, "ERROR : sort_huffbits : malloc : tbits\n");
-      return(-2);
-   }
-
 
    for(i = 0; i < MAX_HUFFBITS<<1; i++)
       tbits[i] = bits[i];
@@ -508,7 +502,6 @@ int sort_huffbits(unsigned char *bits)
 
    for(i = 0; i < MAX_HUFFBITS<<1; i++)
       bits[i] = tbits[i];
-   free(tbits);
 
    for(i = MAX_HUFFBITS; i < l3; i++){
       if(bits[i] > 0){
@@ -0,0 +1,337 @@
+/***********************************************************************
+      LIBRARY: WSQ - Grayscale Image Compression
+
+      FILE:    BATCH.C
+
+      Contains routines responsible for encoding and decoding arrays
+      of images in one call.  The items are ordered by image size and
+      run as a pipeline on worker threads, see sched.c: decodes in an
+      entropy stage and a transform stage, encodes in one.  Each item
+      in progress holds a context of its own, preferably one that
+      last held an image of the same size, so that images of one size
+      reuse the trees, plan and scratch memory built for the first of
+      them.  Every item gets a status of its own; a failed item does
+      not stop the others.
+
+***********************************************************************
+               ROUTINES:
+#cat: decode_batch_wsq - Decodes an array of WSQ images.
+#cat:
+#cat: encode_batch_wsq - Encodes an array of images.
+
+***********************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "batch.h"
+#include "decoder.h"
+#include "encoder.h"
+#include "plan.h"
+#include "scratch.h"
+#include "sched.h"
+#include "thread.h"
+#include "util.h"
+
+/* An item of the batch and the size of its image, for ordering. */
+typedef struct batch_key {
+   int index;           /* item of the batch */
+   int width;
+   int height;
+} BATCH_KEY;
+
+/* What the stages of a batch work on. */
+typedef struct batch_work {
+   WSQBatchItem *items;
+   WSQ_DECODE_STATE *states;   /* decode of each slot between stages */
+} BATCH_WORK;
+
+static int compare_batch_keys(const void *a, const void *b)
+{
+   const BATCH_KEY *ka, *kb;
+
+   ka = (const BATCH_KEY *)a;
+   kb = (const BATCH_KEY *)b;
+   if(ka->width != kb->width)
+      return(ka->width < kb->width ? -1 : 1);
+   if(ka->height != kb->height)
+      return(ka->height < kb->height ? -1 : 1);
+   return(ka->index < kb->index ? -1 : ka->index > kb->index);
+}
+
+/*****************************************************************/
+/* Routine to check the output buffer of an item can hold its    */
+/* image.                                                        */
+/*****************************************************************/
+static int check_batch_output(WSQBatchItem *item)
+{
+   if((double)item->width * item->height > item->output_size) {
+      fprintf(stderr,
+              "ERROR : check_batch_output : output buffer too small\n");
+      return(-1);
+   }
+   return(0);
+}
+
+/*****************************************************************/
+/* Stages of the batches: the entropy and transform stages of a  */
+/* decode, and the single stage of an encode.                    */
+/*****************************************************************/
+static int batch_entropy_stage(void *arg, const int index, const int slot,
+                               WSQContext *context)
+{
+   BATCH_WORK *work;
+   WSQBatchItem *item;
+
+   work = (BATCH_WORK *)arg;
+   item = work->items + index;
+   item->status = check_batch_output(item);
+   if(item->status == 0)
+      item->status = decode_entropy_wsq(work->states + slot, item->input,
+                                        item->input_len, 1, context);
+   return(item->status);
+}
+
+static int batch_transform_stage(void *arg, const int index, const int slot,
+                                 WSQContext *context)
+{
+   BATCH_WORK *work;
+   WSQBatchItem *item;
+   WSQ_DECODE_STATE *state;
+
+   work = (BATCH_WORK *)arg;
+   item = work->items + index;
+   state = work->states + slot;
+   item->status = decode_transform_wsq(item->output, state, context);
+   if(item->status == 0) {
+      item->width = state->width;
+      item->height = state->height;
+      item->ppi = state->ppi;
+      item->output_len = state->width * state->height;
+   }
+   return(item->status);
+}
+
+static int batch_encode_stage(void *arg, const int index, const int slot,
+                              WSQContext *context)
+{
+   BATCH_WORK *work;
+   WSQBatchItem *item;
+
+   (void)slot;
+   work = (BATCH_WORK *)arg;
+   item = work->items + index;
+   item->status = check_batch_output(item);
+   if(item->status == 0)
+      item->status = wsq_encode_mem(item->output, &item->output_len,
+                                    item->input, item->width, item->height,
+                                    8, item->ppi, context);
+   return(item->status);
+}
+
+/*****************************************************************/
+/* Routine to set up the context of a slot: the options and plan */
+/* of the caller's context, and threads of its own.              */
+/*****************************************************************/
+static WSQContext *new_batch_context(WSQContext *context, const int threads)
+{
+   WSQContext *slot;
+
+   slot = (WSQContext *)calloc(1, sizeof(WSQContext));
+   if(slot == (WSQContext *)NULL)
+      return((WSQContext *)NULL);
+   slot->threads = threads;
+   slot->precision = context->precision;
+   slot->plan = context->plan;
+
+   return(slot);
+}
+
+static void free_batch_context(WSQContext *slot)
+{
+   free_wsq_decoder_resources(slot);
+   free_wsq_plan(slot->own_plan);
+   free_scratch_wsq(&slot->scratch);
+   free_pool_wsq(slot->pool);
+   free(slot);
+}
+
+/*****************************************************************/
+/* Routine to read the image size of each item, order the items  */
+/* by size, and run their stages on up to context->threads       */
+/* threads, see sched.c.  The first slot is the caller's context */
+/* so that a batch keeps reusing its memory.  Returns the number */
+/* of items that failed, or -1 for an invalid batch.             */
+/*****************************************************************/
+static int run_batch_wsq(WSQBatchItem *items, const int count,
+                         WSQContext *context, const int encode)
+{
+   BATCH_KEY *keys;
+   BATCH_WORK work;
+   WSQ_PIPELINE pipe;
+   WSQContext *slots[2*MAX_THREADS_WSQ];
+   WSQ_DECODE_STATE states[2*MAX_THREADS_WSQ];
+   int *order, *groups;
+   double *costs;
+   int i, nkeys, nworkers, threads, saved_threads, saved_priority;
+   int ret, failed;
+   WSQBatchItem *item;
+   WSQ_POOL *prev;        /* pool bound before the batch */
+
+   if(items == (WSQBatchItem *)NULL || count < 0 ||
+      context == (WSQContext *)NULL) {
+      fprintf(stderr, "ERROR : run_batch_wsq : invalid batch\n");
+      return(-1);
+   }
+   if(count == 0)
+      return(0);
+
+   keys = (BATCH_KEY *)malloc(count * sizeof(BATCH_KEY));
+   order = (int *)malloc(2 * count * sizeof(int));
+   costs = (double *)malloc(count * sizeof(double));
+   if(keys == (BATCH_KEY *)NULL || order == (int *)NULL ||
+      costs == (double *)NULL) {
+      fprintf(stderr, "ERROR : run_batch_wsq : malloc : keys\n");
+      free(keys);
+      free(order);
+      free(costs);
+      return(-1);
+   }
+   groups = order + count;
+
+   /* Sizes of the items, those already failing left out. */
+   nkeys = 0;
+   for(i = 0; i < count; i++) {
+      item = items + i;
+      item->output_len = 0;
+      if(item->input == (unsigned char *)NULL ||
+         item->output == (unsigned char *)NULL ||
+         (!encode && item->input_len <= 0)) {
+         item->status = -1;
+         continue;
+      }
+      if(!encode)
+         item->status = wsq_get_dimensions(item->input, item->input_len,
+                                           &item->width, &item->height,
+                                           context);
+      else if(item->width <= 0 || item->height <= 0)
+         item->status = -1;
+      else
+         item->status = 0;
+      if(item->status)
+         continue;
+      keys[nkeys].index = i;
+      keys[nkeys].width = item->width;
+      keys[nkeys].height = item->height;
+      nkeys++;
+   }
+   qsort(keys, nkeys, sizeof(BATCH_KEY), compare_batch_keys);
+   for(i = 0; i < nkeys; i++) {
+      order[i] = keys[i].index;
+      costs[i] = (double)keys[i].width * keys[i].height;
+      groups[i] = i > 0 && keys[i].width == keys[i-1].width &&
+                  keys[i].height == keys[i-1].height ? groups[i-1] : i;
+   }
+
+   /* A worker for each thread, up to one for each item; threads */
+   /* left over go to the transforms of the items.  Decodes have */
+   /* two slots for each worker, for their stages to overlap.    */
+   nworkers = context->threads < nkeys ? context->threads : nkeys;
+   if(nworkers > MAX_THREADS_WSQ)
+      nworkers = MAX_THREADS_WSQ;
+   if(nworkers < 1)
+      nworkers = 1;
+   threads = context->threads / nworkers;
+
+   memset(&pipe, 0, sizeof(WSQ_PIPELINE));
+   work.items = items;
+   work.states = states;
+   if(encode) {
+      pipe.nstages = 1;
+      pipe.stages[0] = batch_encode_stage;
+      pipe.nslots = nworkers;
+   }
+   else {
+      pipe.nstages = 2;
+      pipe.stages[0] = batch_entropy_stage;
+      pipe.stages[1] = batch_transform_stage;
+      pipe.nslots = 2 * nworkers < nkeys ? 2 * nworkers : nkeys;
+      if(pipe.nslots < nworkers)
+         pipe.nslots = nworkers;
+   }
+   pipe.arg = &work;
+   pipe.items = order;
+   pipe.groups = groups;
+   pipe.costs = costs;
+   pipe.nitems = nkeys;
+   pipe.slots = slots;
+   pipe.nworkers = nworkers;
+   pipe.bulk = context->priority == WSQ_PRIORITY_NORMAL;
+
+   /* Contexts of the slots, the first being the caller's, which */
+   /* takes the lane once for the whole of a high priority batch. */
+   saved_threads = context->threads;
+   saved_priority = context->priority;
+   if(saved_priority)
+      enter_lane_wsq(saved_threads);
+   context->threads = threads;
+   context->priority = WSQ_PRIORITY_NORMAL;
+   slots[0] = context;
+   for(i = 1; i < pipe.nslots; i++) {
+      slots[i] = new_batch_context(context, threads);
+      if(slots[i] == (WSQContext *)NULL)
+         break;
+   }
+   if(i < pipe.nslots) {
+      /* Fewer slots, and workers. */
+      pipe.nslots = i;
+      if(pipe.nworkers > i)
+         pipe.nworkers = i;
+   }
+
+   /* the workers run on the threads of the caller's context */
+   prev = enter_pool_wsq(&context->pool, saved_threads);
+   ret = run_pipeline_wsq(&pipe);
+   leave_pool_wsq(prev);
+
+   context->threads = saved_threads;
+   context->priority = saved_priority;
+   if(saved_priority)
+      leave_lane_wsq(saved_threads);
+   for(i = 1; i < pipe.nslots; i++)
+      free_batch_context(slots[i]);
+   free(keys);
+   free(order);
+   free(costs);
+   if(ret)
+      return(-1);
+
+   failed = 0;
+   for(i = 0; i < count; i++)
+      if(items[i].status)
+         failed++;
+
+   return(failed);
+}
+
+/*****************************************************************/
+/* Routine to decode count WSQ images, each into the output      */
+/* buffer of its item.  Returns the number of items that failed, */
+/* or -1 for an invalid batch.                                   */
+/*****************************************************************/
+int decode_batch_wsq(WSQBatchItem *items, const int count,
+                     WSQContext *context)
+{
+   return(run_batch_wsq(items, count, context, 0));
+}
+
+/*****************************************************************/
+/* Routine to encode count 8 bit images, each into the output    */
+/* buffer of its item.  Returns the number of items that failed, */
+/* or -1 for an invalid batch.                                   */
+/*****************************************************************/
+int encode_batch_wsq(WSQBatchItem *items, const int count,
+                     WSQContext *context)
+{
+   return(run_batch_wsq(items, count, context, 1));
+}
@@ -0,0 +1,16 @@
+/*
+ * batch.h
+ *
+ *  Encoding and decoding arrays of images in one call.
+ */
+
+#ifndef BATCH_H_
+#define BATCH_H_
+
+#include "wsqInternal.h"
+
+/* batch.c */
+int decode_batch_wsq(WSQBatchItem *, const int, WSQContext *);
+int encode_batch_wsq(WSQBatchItem *, const int, WSQContext *);
+
+#endif /* BATCH_H_ */
@@ -0,0 +1,331 @@
+/*
+ * convert.c
+ *
+ *  Vector kernels of the pixel conversions of conv_img_2_flt and
+ *  conv_img_2_uchar, generated for SSE2 and AVX2 and picked when
+ *  run, by cpu_features_wsq.  Every pixel goes through the same
+ *  float operations as in the scalar routines, none of them fused,
+ *  so results are bit identical to them.
+ *
+ *      ROUTINES:
+#cat: pixel_stats_wsq - Sums the pixels of an image and finds the lowest
+#cat:                   and highest.
+#cat: pixels_2_flt_wsq - Shifts and scales the pixels of an image into
+#cat:                   floats.
+#cat: flt_2_pixels_wsq - Scales and shifts floats back into pixels,
+#cat:                   rounded and clipped.
+ */
+
+#include "Config.h"
+#include "cpu.h"
+#include "convert.h"
+
+#if defined(CPU_WSQ_KERNELS_AVX2)
+#include <immintrin.h>
+#elif defined(CPU_SSE2)
+#include <emmintrin.h>
+#endif
+
+/* Stats of pixels cnt to num_pix, onto those of the earlier ones. */
+static void pixel_stats_rest(unsigned int *sum, int *low, int *high,
+                             unsigned char *data, int cnt, const int num_pix)
+{
+   for(; cnt < num_pix; cnt++) {
+      if(data[cnt] > *high)
+         *high = data[cnt];
+      if(data[cnt] < *low)
+         *low = data[cnt];
+      *sum += data[cnt];
+   }
+}
+
+/* Floats of pixels cnt to num_pix. */
+static void pixels_2_flt_rest(float *fip, unsigned char *data, int cnt,
+                              const int num_pix, const float m_shift,
+                              const float r_scale)
+{
+   for(; cnt < num_pix; cnt++)
+      fip[cnt] = ((float)data[cnt] - m_shift) / r_scale;
+}
+
+/* Pixels of floats cnt to num_pix. */
+static void flt_2_pixels_rest(unsigned char *data, float *img, int cnt,
+                              const int num_pix, const float m_shift,
+                              const float r_scale)
+{
+   float img_tmp;
+
+   for(; cnt < num_pix; cnt++) {
+      img_tmp = (img[cnt] * r_scale) + m_shift;
+      img_tmp += 0.5;
+      if (img_tmp < 0.0)
+         data[cnt] = 0; /* neg pix poss after quantization */
+      else if (img_tmp > 255.0)
+         data[cnt] = 255;
+      else
+         data[cnt] = (unsigned char)img_tmp;
+   }
+}
+
+#if defined(CPU_SSE2)
+static void pixel_stats_sse2(unsigned int *sum, int *low, int *high,
+                             unsigned char *data, const int num_pix)
+{
+   int cnt;
+   __m128i v, vsum, vlow, vhigh, zero;
+   unsigned char bytes[16];
+   int i;
+
+   zero = _mm_setzero_si128();
+   vsum = zero;
+   vlow = _mm_set1_epi8((char)0xff);
+   vhigh = zero;
+   for(cnt = 0; cnt + 16 <= num_pix; cnt += 16) {
+      v = _mm_loadu_si128((const __m128i *)(data + cnt));
+      vsum = _mm_add_epi64(vsum, _mm_sad_epu8(v, zero));
+      vlow = _mm_min_epu8(vlow, v);
+      vhigh = _mm_max_epu8(vhigh, v);
+   }
+   vsum = _mm_add_epi64(vsum, _mm_srli_si128(vsum, 8));
+   *sum = (unsigned int)_mm_cvtsi128_si32(vsum);
+   _mm_storeu_si128((__m128i *)bytes, vlow);
+   for(i = 0; i < 16; i++)
+      if(bytes[i] < *low)
+         *low = bytes[i];
+   _mm_storeu_si128((__m128i *)bytes, vhigh);
+   for(i = 0; i < 16; i++)
+      if(bytes[i] > *high)
+         *high = bytes[i];
+   pixel_stats_rest(sum, low, high, data, cnt, num_pix);
+}
+
+static void pixels_2_flt_sse2(float *fip, unsigned char *data,
+                              const int num_pix, const float m_shift,
+                              const float r_scale)
+{
+   int cnt;
+   __m128i v, zero, lo, hi;
+   __m128 vm, vr;
+
+   zero = _mm_setzero_si128();
+   vm = _mm_set1_ps(m_shift);
+   vr = _mm_set1_ps(r_scale);
+   for(cnt = 0; cnt + 16 <= num_pix; cnt += 16) {
+      v = _mm_loadu_si128((const __m128i *)(data + cnt));
+      lo = _mm_unpacklo_epi8(v, zero);
+      hi = _mm_unpackhi_epi8(v, zero);
+      _mm_storeu_ps(fip + cnt, _mm_div_ps(_mm_sub_ps(
+         _mm_cvtepi32_ps(_mm_unpacklo_epi16(lo, zero)), vm), vr));
+      _mm_storeu_ps(fip + cnt + 4, _mm_div_ps(_mm_sub_ps(
+         _mm_cvtepi32_ps(_mm_unpackhi_epi16(lo, zero)), vm), vr));
+      _mm_storeu_ps(fip + cnt + 8, _mm_div_ps(_mm_sub_ps(
+         _mm_cvtepi32_ps(_mm_unpacklo_epi16(hi, zero)), vm), vr));
+      _mm_storeu_ps(fip + cnt + 12, _mm_div_ps(_mm_sub_ps(
+         _mm_cvtepi32_ps(_mm_unpackhi_epi16(hi, zero)), vm), vr));
+   }
+   pixels_2_flt_rest(fip, data, cnt, num_pix, m_shift, r_scale);
+}
+
+/* Rounds and clips 4 floats as conv_img_2_uchar does, into ints. */
+static INLINE __m128i flt_2_ints_sse2(const float *img, const __m128 vr,
+                                      const __m128 vm)
+{
+   __m128 t;
+
+   t = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_loadu_ps(img), vr), vm),
+                  _mm_set1_ps(0.5f));
+   /* a NaN, like a negative value, gives 0 */
+   t = _mm_min_ps(_mm_max_ps(t, _mm_setzero_ps()), _mm_set1_ps(255.0f));
+   return(_mm_cvttps_epi32(t));
+}
+
+static void flt_2_pixels_sse2(unsigned char *data, float *img,
+                              const int num_pix, const float m_shift,
+                              const float r_scale)
+{
+   int cnt;
+   __m128 vm, vr;
+   __m128i a, b, c, d;
+
+   vm = _mm_set1_ps(m_shift);
+   vr = _mm_set1_ps(r_scale);
+   for(cnt = 0; cnt + 16 <= num_pix; cnt += 16) {
+      a = flt_2_ints_sse2(img + cnt, vr, vm);
+      b = flt_2_ints_sse2(img + cnt + 4, vr, vm);
+      c = flt_2_ints_sse2(img + cnt + 8, vr, vm);
+      d = flt_2_ints_sse2(img + cnt + 12, vr, vm);
+      _mm_storeu_si128((__m128i *)(data + cnt),
+                       _mm_packus_epi16(_mm_packs_epi32(a, b),
+                                        _mm_packs_epi32(c, d)));
+   }
+   flt_2_pixels_rest(data, img, cnt, num_pix, m_shift, r_scale);
+}
+#endif
+
+#if defined(CPU_WSQ_KERNELS_AVX2)
+static TARGET_AVX2 void pixel_stats_avx2(unsigned int *sum, int *low,
+                                         int *high, unsigned char *data,
+                                         const int num_pix)
+{
+   int cnt;
+   __m256i v, vsum, vlow, vhigh, zero;
+   unsigned char bytes[32];
+   unsigned long long sums[4];
+   int i;
+
+   zero = _mm256_setzero_si256();
+   vsum = zero;
+   vlow = _mm256_set1_epi8((char)0xff);
+   vhigh = zero;
+   for(cnt = 0; cnt + 32 <= num_pix; cnt += 32) {
+      v = _mm256_loadu_si256((const __m256i *)(data + cnt));
+      vsum = _mm256_add_epi64(vsum, _mm256_sad_epu8(v, zero));
+      vlow = _mm256_min_epu8(vlow, v);
+      vhigh = _mm256_max_epu8(vhigh, v);
+   }
+   _mm256_storeu_si256((__m256i *)sums, vsum);
+   *sum = (unsigned int)(sums[0] + sums[1] + sums[2] + sums[3]);
+   _mm256_storeu_si256((__m256i *)bytes, vlow);
+   for(i = 0; i < 32; i++)
+      if(bytes[i] < *low)
+         *low = bytes[i];
+   _mm256_storeu_si256((__m256i *)bytes, vhigh);
+   for(i = 0; i < 32; i++)
+      if(bytes[i] > *high)
+         *high = bytes[i];
+   pixel_stats_rest(sum, low, high, data, cnt, num_pix);
+}
+
+static TARGET_AVX2 void pixels_2_flt_avx2(float *fip, unsigned char *data,
+                                          const int num_pix,
+                                          const float m_shift,
+                                          const float r_scale)
+{
+   int cnt;
+   __m256 vm, vr, x;
+
+   vm = _mm256_set1_ps(m_shift);
+   vr = _mm256_set1_ps(r_scale);
+   for(cnt = 0; cnt + 8 <= num_pix; cnt += 8) {
+      x = _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(
+             _mm_loadl_epi64((const __m128i *)(data + cnt))));
+      _mm256_storeu_ps(fip + cnt, _mm256_div_ps(_mm256_sub_ps(x, vm), vr));
+   }
+   pixels_2_flt_rest(fip, data, cnt, num_pix, m_shift, r_scale);
+}
+
+/* Rounds and clips 8 floats as conv_img_2_uchar does, into ints. */
+static INLINE TARGET_AVX2 __m256i flt_2_ints_avx2(const float *img,
+                                                  const __m256 vr,
+                                                  const __m256 vm)
+{
+   __m256 t;
+
+   t = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(_mm256_loadu_ps(img), vr),
+                                   vm), _mm256_set1_ps(0.5f));
+   /* a NaN, like a negative value, gives 0 */
+   t = _mm256_min_ps(_mm256_max_ps(t, _mm256_setzero_ps()),
+                     _mm256_set1_ps(255.0f));
+   return(_mm256_cvttps_epi32(t));
+}
+
+static TARGET_AVX2 void flt_2_pixels_avx2(unsigned char *data, float *img,
+                                          const int num_pix,
+                                          const float m_shift,
+                                          const float r_scale)
+{
+   int cnt;
+   __m256 vm, vr;
+   __m256i w;
+
+   vm = _mm256_set1_ps(m_shift);
+   vr = _mm256_set1_ps(r_scale);
+   for(cnt = 0; cnt + 16 <= num_pix; cnt += 16) {
+      /* packs works within 128 bit lanes: put the halves in order */
+      w = _mm256_permute4x64_epi64(
+             _mm256_packs_epi32(flt_2_ints_avx2(img + cnt, vr, vm),
+                                flt_2_ints_avx2(img + cnt + 8, vr, vm)),
+             0xd8);
+      _mm_storeu_si128((__m128i *)(data + cnt),
+                       _mm_packus_epi16(_mm256_castsi256_si128(w),
+                                        _mm256_extracti128_si256(w, 1)));
+   }
+   flt_2_pixels_rest(data, img, cnt, num_pix, m_shift, r_scale);
+}
+#endif
+
+/*****************************************************************/
+/* Routine to sum the num_pix pixels of data, wrapping around as */
+/* an unsigned int, and find the lowest and highest of them.     */
+/*****************************************************************/
+void pixel_stats_wsq(
+   unsigned int *osum,  /* returned sum of the pixels */
+   int *olow,           /* returned lowest pixel */
+   int *ohigh,          /* returned highest pixel */
+   unsigned char *data, /* input unsigned char data */
+   const int num_pix)   /* num pixels in image */
+{
+   *osum = 0;
+   *olow = 255;
+   *ohigh = 0;
+
+#if defined(CPU_WSQ_KERNELS_AVX2)
+   if(cpu_features_wsq() & CPU_WSQ_AVX2) {
+      pixel_stats_avx2(osum, olow, ohigh, data, num_pix);
+      return;
+   }
+#endif
+#if defined(CPU_SSE2)
+   pixel_stats_sse2(osum, olow, ohigh, data, num_pix);
+#else
+   pixel_stats_rest(osum, olow, ohigh, data, 0, num_pix);
+#endif
+}
+
+/*****************************************************************/
+/* Routine to convert num_pix pixels to floats, shifted by       */
+/* m_shift and scaled down by r_scale.                           */
+/*****************************************************************/
+void pixels_2_flt_wsq(
+   float *fip,          /* output float image data */
+   unsigned char *data, /* input unsigned char data */
+   const int num_pix,   /* num pixels in image */
+   const float m_shift, /* shifting parameter */
+   const float r_scale) /* scaling parameter */
+{
+#if defined(CPU_WSQ_KERNELS_AVX2)
+   if(cpu_features_wsq() & CPU_WSQ_AVX2) {
+      pixels_2_flt_avx2(fip, data, num_pix, m_shift, r_scale);
+      return;
+   }
+#endif
+#if defined(CPU_SSE2)
+   pixels_2_flt_sse2(fip, data, num_pix, m_shift, r_scale);
+#else
+   pixels_2_flt_rest(fip, data, 0, num_pix, m_shift, r_scale);
+#endif
+}
+
+/*****************************************************************/
+/* Routine to convert num_pix floats back to pixels, scaled up   */
+/* by r_scale, shifted by m_shift, rounded and clipped.          */
+/*****************************************************************/
+void flt_2_pixels_wsq(
+   unsigned char *data, /* uchar image pointer */
+   float *img,          /* image pointer */
+   const int num_pix,   /* num pixels in image */
+   const float m_shift, /* shifting parameter */
+   const float r_scale) /* scaling parameter */
+{
+#if defined(CPU_WSQ_KERNELS_AVX2)
+   if(cpu_features_wsq() & CPU_WSQ_AVX2) {
+      flt_2_pixels_avx2(data, img, num_pix, m_shift, r_scale);
+      return;
+   }
+#endif
+#if defined(CPU_SSE2)
+   flt_2_pixels_sse2(data, img, num_pix, m_shift, r_scale);
+#else
+   flt_2_pixels_rest(data, img, 0, num_pix, m_shift, r_scale);
+#endif
+}
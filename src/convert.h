@@ -0,0 +1,19 @@
+/*
+ * convert.h
+ *
+ *  Vector kernels of the pixel conversions of conv_img_2_flt and
+ *  conv_img_2_uchar.
+ */
+
+#ifndef CONVERT_H_
+#define CONVERT_H_
+
+/* convert.c */
+void pixel_stats_wsq(unsigned int *, int *, int *, unsigned char *,
+                 const int);
+void pixels_2_flt_wsq(float *, unsigned char *, const int, const float,
+                 const float);
+void flt_2_pixels_wsq(unsigned char *, float *, const int, const float,
+                 const float);
+
+#endif /* CONVERT_H_ */
@@ -0,0 +1,121 @@
+/*
+ * cpu.c
+ *
+ *  Detection of the instruction sets of the processor running the
+ *  library.  Features are read once, with cpuid, and kept; an AVX2
+ *  feature is reported only if the operating system also saves the
+ *  256 bit registers.
+ *
+ *      ROUTINES:
+#cat: cpu_features_wsq - Returns the CPU_WSQ_* features of the processor.
+#cat:
+ */
+
+#include "cpu.h"
+
+#if defined(CPU_X86) && defined(COMPILER_GCC)
+#include <cpuid.h>
+#elif defined(CPU_X86) && defined(COMPILER_MSC)
+#include <intrin.h>
+#endif
+
+/* Features read by the first call, -1 before. */
+static volatile int cpu_features = -1;
+
+#if defined(CPU_X86) && (defined(COMPILER_GCC) || defined(COMPILER_MSC))
+/*****************************************************************/
+/* Routine to run cpuid for a leaf and subleaf, returning eax,   */
+/* ebx, ecx and edx, all zero for leaves the processor lacks.    */
+/*****************************************************************/
+static void cpuid_wsq(unsigned int regs[4], const unsigned int leaf,
+                      const unsigned int subleaf)
+{
+#if defined(COMPILER_GCC)
+   regs[0] = regs[1] = regs[2] = regs[3] = 0;
+   if(__get_cpuid_max(leaf & 0x80000000, 0) < leaf)
+      return;
+   __cpuid_count(leaf, subleaf, regs[0], regs[1], regs[2], regs[3]);
+#else
+   int r[4];
+
+   regs[0] = regs[1] = regs[2] = regs[3] = 0;
+   __cpuid(r, leaf & 0x80000000);
+   if((unsigned int)r[0] < leaf)
+      return;
+   __cpuidex(r, leaf, subleaf);
+   regs[0] = r[0];
+   regs[1] = r[1];
+   regs[2] = r[2];
+   regs[3] = r[3];
+#endif
+}
+
+/*****************************************************************/
+/* Routine to read the register state the operating system saves */
+/* (XCR0); only called once cpuid reports OSXSAVE.               */
+/*****************************************************************/
+static unsigned int xcr0_wsq(void)
+{
+#if defined(COMPILER_GCC)
+   unsigned int eax, edx;
+
+   /* xgetbv, spelled out for assemblers that lack it */
+   __asm__ volatile(".byte 0x0f, 0x01, 0xd0"
+                    : "=a"(eax), "=d"(edx) : "c"(0));
+   return(eax);
+#else
+   return((unsigned int)_xgetbv(0));
+#endif
+}
+
+/*****************************************************************/
+/* Routine to detect the features with cpuid.                    */
+/*****************************************************************/
+static int detect_cpu_features(void)
+{
+   int features;
+   unsigned int regs[4];
+
+   features = 0;
+
+   cpuid_wsq(regs, 1, 0);
+   if(regs[3] & (1u << 26))
+      features |= CPU_WSQ_SSE2;
+
+   /* AVX state (XMM and YMM) saved by the operating system */
+   if((regs[2] & (1u << 27)) && (regs[2] & (1u << 28)) &&
+      (xcr0_wsq() & 0x6) == 0x6) {
+      if(regs[2] & (1u << 12))
+         features |= CPU_WSQ_FMA;
+      cpuid_wsq(regs, 7, 0);
+      if(regs[1] & (1u << 5))
+         features |= CPU_WSQ_AVX2;
+   }
+   if(!(features & CPU_WSQ_AVX2))
+      features &= ~CPU_WSQ_FMA;
+
+   return(features);
+}
+#else
+static int detect_cpu_features(void)
+{
+   return(0);
+}
+#endif
+
+/*****************************************************************/
+/* Routine to return the CPU_WSQ_* features of the processor.    */
+/* Threads racing on the first call all store the same value.    */
+/*****************************************************************/
+int cpu_features_wsq(void)
+{
+   int features;
+
+   features = cpu_features;
+   if(features < 0) {
+      features = detect_cpu_features();
+      cpu_features = features;
+   }
+
+   return(features);
+}
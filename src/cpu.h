@@ -0,0 +1,37 @@
+/*
+ * cpu.h
+ *
+ *  Instruction sets of the processor running the library, for the
+ *  kernels that are generated for several and picked at run time.
+ */
+
+#ifndef CPU_H_
+#define CPU_H_
+
+#include "Config.h"
+
+/* Features reported by cpu_features_wsq. */
+#define CPU_WSQ_SSE2     0x01
+#define CPU_WSQ_AVX2     0x02
+#define CPU_WSQ_FMA      0x04   /* with AVX2 */
+
+/* With SSE2 the baseline, AVX2 kernels are generated as well, for */
+/* the compiler to emit whatever the build targets; those using    */
+/* FMA only ever compute results that need not be exact.  Builds   */
+/* with flagNOAVX2 leave them out.                                 */
+#if defined(CPU_SSE2) && !defined(flagNOAVX2) && \
+    (defined(COMPILER_GCC) || defined(COMPILER_MSC))
+#define CPU_WSQ_KERNELS_AVX2 1
+#if defined(COMPILER_GCC)
+#define TARGET_AVX2      __attribute__((target("avx2")))
+#define TARGET_FMA       __attribute__((target("avx2,fma")))
+#else
+#define TARGET_AVX2
+#define TARGET_FMA
+#endif
+#endif
+
+/* cpu.c */
+int cpu_features_wsq(void);
+
+#endif /* CPU_H_ */
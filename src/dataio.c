@@ -62,10 +62,6 @@ identified are necessarily the best available for the purpose.
 #cat:
 #cat: putc_uint - Writes an unsigned integer to a memory buffer.
 #cat:
-#cat: write_bits - Writes a sequence of bits to a memory buffer.
-#cat:
-#cat: flush_bits - Writes remaining bits to a memory buffer.
-#cat:
 #cat: read_ascii_file - Reads the contents of an ASCII text file
 #cat:              into a single null-terminated string.
 
@@ -380,72 +376,3 @@ int putc_uint(
 
    return(0);
 }
-
-/*******************************************************/
-/*Routine to write "compressed" bits to output buffer. */
-/*******************************************************/
-void write_bits(
-   unsigned char **outbuf,    /* output data buffer                          */
-   const unsigned short code, /* info to write into buffer                   */
-   const short size,          /* numbers bits of code to write into buffer   */
-   int *outbit,               /* current bit location in out buffer byte     */
-   unsigned char *bits,       /* byte to write to output buffer              */
-   int *bytes)                /* count of number bytes written to the buffer */
-{
-   short num;
-
-   num = size;
-
-   for(--num; num >= 0; num--) {
-      *bits <<= 1;
-      *bits |= ((unsigned char)((code >> num) & 0x0001));
-
-      if(--(*outbit) < 0) {
-         **outbuf = *bits;
-         (*outbuf)++;
-         if(*bits == 0xFF) {
-            **outbuf = 0;
-            (*outbuf)++;
-            (*bytes)++;
-         }
-         (*bytes)++;
-         *outbit = 7;
-         *bits = 0;
-      }
-   }
-   return;
-}
-
-
-/*********************************************/
-/* Routine to "flush" left over bits in last */
-/* byte after compressing a block.           */
-/*********************************************/
-void flush_bits(
-   unsigned char **outbuf, /* output data buffer */
-   int *outbit,            /* current bit location in out buffer byte */
-   unsigned char *bits,    /* byte to write to output buffer */
-   int *bytes)             /* count of number bytes written to the buffer */
-{
-   int cnt;              /* temp counter */
-
-   if(*outbit != 7) {
-      for(cnt = *outbit; cnt >= 0; cnt--) {
-         *bits <<= 1;
-         *bits |= 0x01;
-      }
-
-      **outbuf = *bits;
-      (*outbuf)++;
-      if(*bits == 0xFF) {
-         *bits = 0;
-         **outbuf = 0;
-         (*outbuf)++;
-         (*bytes)++;
-      }
-      (*bytes)++;
-      *outbit = 7;
-      *bits = 0;
-   }
-   return;
-}
@@ -41,8 +41,5 @@ int read_uint(unsigned int *, FILE *);
 int getc_uint(unsigned int *, unsigned char **, unsigned char *);
 int write_uint(unsigned int, FILE *);
 int putc_uint(unsigned int, unsigned char *, const int, int *);
-void write_bits(unsigned char **, const unsigned short, const short,
-                 int *, unsigned char *, int *);
-void flush_bits(unsigned char **, int *, unsigned char *, int *);
 
 #endif /* !_DATA_IO_H */
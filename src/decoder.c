@@ -37,25 +37,52 @@ identified are necessarily the best available for the purpose.
 #cat: wsq_decode_mem - Decodes a datastream of WSQ compressed bytes
 #cat:                  from a memory buffer, returning a lossy
 #cat:                  reconstructed pixmap.
+#cat: wsq_decode_scaled_mem - Decodes a datastream of WSQ compressed
+#cat:                  bytes from a memory buffer at a reduced resolution,
+#cat:                  from its low frequency subbands only.
+#cat: wsq_decode_region_mem - Decodes a window of the pixmap of a
+#cat:                  datastream of WSQ compressed bytes from a memory
+#cat:                  buffer.
+#cat: decode_entropy_wsq - Runs the table and huffman stage of a decode,
+#cat:                  which dequantizes the subbands as it decodes them.
+#cat: decode_transform_wsq - Runs the wavelet reconstruction stage of a
+#cat:                  decode.
 #cat: huffman_decode_data_mem - Decodes a block of huffman encoded
 #cat:                  data from a memory buffer.
+#cat: scan_block_data_mem - Locates the end of a block of huffman encoded
+#cat:                  data in a memory buffer.
+#cat: huffman_decode_blocks_wsq - Decodes the blocks of huffman encoded
+#cat:                  data from a memory buffer on separate threads.
 #cat: huffman_decode_data_file - Decodes a block of huffman encoded
 #cat:                  data from an open file.
-#cat: decode_data_mem - Decodes huffman encoded data from a memory buffer.
-#cat:
+#cat: build_huff_decoder_wsq - Builds the tables used to decode a block
+#cat:                  of huffman encoded data.
+#cat: gen_decode_lookup - Builds the lookup table decoding short huffman
+#cat:                  codes in a single probe.
+#cat: unstuff_block_data_mem - Copies a block of huffman encoded data
+#cat:                  from a memory buffer, dropping stuffed zeros.
+#cat: init_bit_reader_wsq - Starts reading unstuffed huffman encoded
+#cat:                  data.
+#cat: decode_block_data_mem - Decodes a block of huffman encoded data from
+#cat:                  a memory buffer using the lookup table, straight
+#cat:                  into its floating point subbands.
 #cat: decode_data_file - Decodes huffman encoded data from an open file.
 #cat:
 #cat: nextbits_wsq - Gets next sequence of bits for data decoding from
 #cat:                    an open file.
-#cat: getc_nextbits_wsq - Gets next sequence of bits for data decoding
-#cat:                    from a memory buffer.
 
 ***********************************************************************/
 
+#include <string.h>
+#include "Config.h"
 #include "decoder.h"
 #include "tree.h"
 #include "huff.h"
 #include "dataio.h"
+#include "thread.h"
+#include "plan.h"
+#include "scratch.h"
+#include "sched.h"
 
 int wsq_get_dimensions(unsigned char *idata, const int ilen, int *ow, int *oh, WSQContext *context)
 {
@@ -77,35 +104,29 @@ int wsq_get_dimensions(unsigned char *idata, const int ilen, int *ow, int *oh, W
 
    /* Read the SOI marker. */
    if((ret = getc_marker_wsq(&marker, SOI_WSQ, &cbufptr, ebufptr))){
-      free_wsq_decoder_resources(context);
       return(ret);
    }
 
    /* Read in supporting tables up to the SOF marker. */
    if((ret = getc_marker_wsq(&marker, TBLS_N_SOF, &cbufptr, ebufptr))){
-      free_wsq_decoder_resources(context);
       return(ret);
    }
    while(marker != SOF_WSQ) {
       if((ret = getc_table_wsq(marker, &context->dtt_table, &context->dqt_table, context->dht_table,
                           &cbufptr, ebufptr, context))){
-         free_wsq_decoder_resources(context);
          return(ret);
       }
       if((ret = getc_marker_wsq(&marker, TBLS_N_SOF, &cbufptr, ebufptr))){
-         free_wsq_decoder_resources(context);
          return(ret);
       }
    }
 
    /* Read in the Frame Header. */
    if((ret = getc_frame_header_wsq(&context->frm_header_wsq, &cbufptr, ebufptr))){
-      free_wsq_decoder_resources(context);
       return(ret);
    }
    *ow = context->frm_header_wsq.width;
    *oh = context->frm_header_wsq.height;
-   free_wsq_decoder_resources(context);
    return 0;
 }
 /************************************************************************/
@@ -119,15 +140,209 @@ int wsq_get_dimensions(unsigned char *idata, const int ilen, int *ow, int *oh, W
 /***************************************************************************/
 int wsq_decode_mem(unsigned char *odata, int *ow, int *oh, int *od, int *oppi,
                    int *lossyflag, unsigned char *idata, const int ilen, WSQContext * context)
+{
+   return(wsq_decode_scaled_mem(odata, ow, oh, od, oppi, lossyflag,
+                                idata, ilen, 1, context));
+}
+
+/***************************************************************************/
+/* Routine running both stages of a decode, on the worker threads of the  */
+/* context and in the priority lane for a high priority context, and      */
+/* writing the w by h window at x, y of the image at its scale to odata,  */
+/* the whole image if w is 0.                                             */
+/***************************************************************************/
+static int decode_mem_wsq(unsigned char *odata, WSQ_DECODE_STATE *state,
+                          unsigned char *idata, const int ilen,
+                          const int scale, const int x, const int y,
+                          const int w, const int h, WSQContext *context)
+{
+   int ret;
+   WSQ_POOL *prev;        /* pool bound before the call */
+
+   if(context->priority)
+      enter_lane_wsq(context->threads);
+   prev = enter_pool_wsq(&context->pool, context->threads);
+   ret = decode_entropy_wsq(state, idata, ilen, scale, context);
+   if(ret == 0 && w != 0) {
+      if(x < 0 || y < 0 || w < 1 || h < 1 ||
+         w > state->width - x || h > state->height - y) {
+         fprintf(stderr, "ERROR : decode_mem_wsq : ");
+         fprintf(stderr, "window %d x %d at %d, %d outside %d x %d image\n",
+                 w, h, x, y, state->width, state->height);
+         end_scratch_wsq(&context->scratch);
+         ret = -56;
+      }
+      else {
+         state->roi_x = x;
+         state->roi_y = y;
+         state->roi_width = w;
+         state->roi_height = h;
+      }
+   }
+   if(ret == 0)
+      ret = decode_transform_wsq(odata, state, context);
+   leave_pool_wsq(prev);
+   if(context->priority)
+      leave_lane_wsq(context->threads);
+
+   return(ret);
+}
+
+/***************************************************************************/
+/* WSQ Decoder routine returning the pixmap at 1/scale of its resolution, */
+/* for a scale of 1, 2, 4 or 8.  Only the huffman coded blocks holding    */
+/* the subbands of the low pass region of that scale are decoded, and     */
+/* only the W_TREE nodes within it reconstructed.  The pixmap is about    */
+/* width/scale by height/scale, rounded up, pixels.                       */
+/***************************************************************************/
+int wsq_decode_scaled_mem(unsigned char *odata, int *ow, int *oh, int *od,
+                   int *oppi, int *lossyflag, unsigned char *idata,
+                   const int ilen, const int scale, WSQContext *context)
+{
+   int ret;
+   WSQ_DECODE_STATE state;        /* decode between its two stages */
+
+   if((ret = decode_mem_wsq(odata, &state, idata, ilen, scale, 0, 0, 0, 0,
+                            context)))
+      return(ret);
+
+   /* Assign reconstructed pixmap and attributes to output pointers. */
+   *ow = state.width;
+   *oh = state.height;
+   *od = 8;
+   *oppi = state.ppi;
+   *lossyflag = 1;
+
+   /* Return normally. */
+   return(0);
+}
+
+/***************************************************************************/
+/* WSQ Decoder routine returning the w by h window at x, y of the pixmap  */
+/* only.  The whole datastream is huffman decoded and unquantized, but    */
+/* the wavelet reconstruction runs over the support of the window at each */
+/* W_TREE node only, see wsq_reconstruct_window, and only the window is   */
+/* converted to pixels.                                                   */
+/***************************************************************************/
+int wsq_decode_region_mem(unsigned char *odata, const int x, const int y,
+                   const int w, const int h, int *od, int *oppi,
+                   int *lossyflag, unsigned char *idata, const int ilen,
+                   WSQContext *context)
+{
+   int ret;
+   WSQ_DECODE_STATE state;        /* decode between its two stages */
+
+   if(w < 1 || h < 1) {
+      fprintf(stderr, "ERROR : wsq_decode_region_mem : ");
+      fprintf(stderr, "empty window %d x %d\n", w, h);
+      return(-56);
+   }
+   if((ret = decode_mem_wsq(odata, &state, idata, ilen, 1, x, y, w, h,
+                            context)))
+      return(ret);
+
+   *od = 8;
+   *oppi = state.ppi;
+   *lossyflag = 1;
+
+   return(0);
+}
+
+/***************************************************************************/
+/* Routine to find, for a scale, the W_TREE node whose region holds the   */
+/* image at that scale once the nodes within it are reconstructed, and    */
+/* the number of huffman coded blocks holding the subbands of the region: */
+/* the first block covers node 14, the first two node 1.                  */
+/***************************************************************************/
+static int scale_root_node(int *oroot, int *onblocks, int *olevels,
+                           const int scale)
+{
+   switch(scale) {
+   case 1:
+      *oroot = 0;
+      *onblocks = 3;
+      *olevels = 0;
+      return(0);
+   case 2:
+      *oroot = 1;
+      *onblocks = 2;
+      *olevels = 1;
+      return(0);
+   case 4:
+      *oroot = 14;
+      *onblocks = 1;
+      *olevels = 2;
+      return(0);
+   case 8:
+      *oroot = 15;
+      *onblocks = 1;
+      *olevels = 3;
+      return(0);
+   }
+
+   fprintf(stderr, "ERROR : scale_root_node : ");
+   fprintf(stderr, "unsupported scale %d\n", scale);
+   return(-55);
+}
+
+/***************************************************************************/
+/* Routine to take the W_TREE nodes within the region of a root node, in  */
+/* order, with their planned synthesis passes when a plan is given.       */
+/* Their locations are unchanged: the region starts at the image origin.  */
+/* Returns the number of nodes taken.                                     */
+/***************************************************************************/
+static int scaled_w_tree(W_TREE *tree, WAVELET_PLAN *oplan,
+                         W_TREE w_tree[], const int root,
+                         const WAVELET_PLAN *plan)
+{
+   int node, n;
+
+   n = 0;
+   for(node = root; node < W_TREELEN; node++) {
+      if(w_tree[node].x + w_tree[node].lenx > w_tree[root].lenx ||
+         w_tree[node].y + w_tree[node].leny > w_tree[root].leny)
+         continue;
+      tree[n] = w_tree[node];
+      if(plan != (WAVELET_PLAN *)NULL) {
+         oplan->rows[n] = plan->rows[node];
+         oplan->cols[n] = plan->cols[node];
+      }
+      n++;
+   }
+   if(plan != (WAVELET_PLAN *)NULL) {
+      /* The passes stay owned by the plan. */
+      oplan->lift = plan->lift;
+      oplan->nplans = 0;
+   }
+
+   return(n);
+}
+
+/***************************************************************************/
+/* Routine running the first stage of a decode: reads the tables and the  */
+/* frame header, decodes the Huffman encoded blocks and unquantizes them.  */
+/* On success the floating point subbands are left in the scratch of the  */
+/* context, and decode_transform_wsq must follow on the same context.     */
+/* Below a scale of 1, only the blocks and subbands of the low pass       */
+/* region of the scale are decoded, into an image the size of the region. */
+/***************************************************************************/
+int decode_entropy_wsq(WSQ_DECODE_STATE *state, unsigned char *idata,
+                       const int ilen, const int scale, WSQContext *context)
 {
    int ret, i;
+   int root, nblocks, levels;     /* low pass region of the scale */
    unsigned short marker;         /* WSQ marker */
    int num_pix;                   /* image size and counter */
    int width, height, ppi;        /* image parameters */
    float *fdata;                  /* image pointers */
-   short *qdata;                  /* image pointers */
+   unsigned long long *bands;     /* non-zero subbands of each row */
    unsigned char *cbufptr;        /* points to current byte in buffer */
    unsigned char *ebufptr;        /* points to end of buffer */
+   WSQPlan *plan;                 /* plan of the image size */
+   WSQ_SCRATCH *scratch;          /* working memory of the call */
+
+   if((ret = scale_root_node(&root, &nblocks, &levels, scale)))
+      return(ret);
 
    /* Added by MDG on 02-24-05 */
    init_wsq_decoder_resources(context);
@@ -141,351 +356,893 @@ int wsq_decode_mem(unsigned char *odata, int *ow, int *oh, int *od, int *oppi,
       (context->dht_table + i)->tabdef = 0;
 
    /* Read the SOI marker. */
-   if((ret = getc_marker_wsq(&marker, SOI_WSQ, &cbufptr, ebufptr))){
-      free_wsq_decoder_resources(context);
+   if((ret = getc_marker_wsq(&marker, SOI_WSQ, &cbufptr, ebufptr)))
       return(ret);
-   }
 
    /* Read in supporting tables up to the SOF marker. */
-   if((ret = getc_marker_wsq(&marker, TBLS_N_SOF, &cbufptr, ebufptr))){
-      free_wsq_decoder_resources(context);
+   if((ret = getc_marker_wsq(&marker, TBLS_N_SOF, &cbufptr, ebufptr)))
       return(ret);
-   }
    while(marker != SOF_WSQ) {
       if((ret = getc_table_wsq(marker, &context->dtt_table, &context->dqt_table, context->dht_table,
-                          &cbufptr, ebufptr, context))){
-         free_wsq_decoder_resources(context);
+                          &cbufptr, ebufptr, context)))
          return(ret);
-      }
-      if((ret = getc_marker_wsq(&marker, TBLS_N_SOF, &cbufptr, ebufptr))){
-         free_wsq_decoder_resources(context);
+      if((ret = getc_marker_wsq(&marker, TBLS_N_SOF, &cbufptr, ebufptr)))
          return(ret);
-      }
    }
 
    /* Read in the Frame Header. */
-   if((ret = getc_frame_header_wsq(&context->frm_header_wsq, &cbufptr, ebufptr))){
-      free_wsq_decoder_resources(context);
+   if((ret = getc_frame_header_wsq(&context->frm_header_wsq, &cbufptr, ebufptr)))
       return(ret);
-   }
    width = context->frm_header_wsq.width;
    height = context->frm_header_wsq.height;
-   num_pix = width * height;
 
-   if((ret = getc_ppi_wsq(&ppi, idata, ilen))){
-      free_wsq_decoder_resources(context);
+   if((ret = getc_ppi_wsq(&ppi, idata, ilen)))
       return(ret);
-   }
 
 
-   /* Build WSQ decomposition trees. */
-   build_wsq_trees(context->w_tree, W_TREELEN, context->q_tree, Q_TREELEN, width, height);
+   /* Take the WSQ decomposition trees of the plan of the size. */
+   if((ret = context_plan_wsq(&plan, context, width, height)))
+      return(ret);
+   memcpy(context->w_tree, plan->w_tree, sizeof(plan->w_tree));
+   memcpy(context->q_tree, plan->q_tree, sizeof(plan->q_tree));
+
+   /* The image decoded is the low pass region of the scale. */
+   width = context->w_tree[root].lenx;
+   height = context->w_tree[root].leny;
 
 
-   /* Allocate working memory. */
-   qdata = (short *) malloc(num_pix * sizeof(short));
-   if(qdata == (short *)NULL) {
-      fprintf(stderr,"ERROR: wsq_decode_mem : malloc : qdata1\n");
-      free_wsq_decoder_resources(context);
+   /* Reserve working memory: the floating point image, which */
+   /* the huffman decoders write dequantized subbands to, and   */
+   /* the non-zero subbands of its rows for each block.  The    */
+   /* memory of the full image decode covers a reduced one.     */
+   scratch = &context->scratch;
+   if((ret = begin_scratch_wsq(scratch,
+                     decode_scratch_size(context->frm_header_wsq.width,
+                                         context->frm_header_wsq.height,
+                                         ilen, context->threads))))
+      return(ret);
+   fdata = (float *)alloc_scratch_wsq(scratch,
+                                      width * height * sizeof(float));
+   bands = (unsigned long long *)alloc_scratch_wsq(scratch,
+                                 3 * height * sizeof(unsigned long long));
+   if(fdata == (float *)NULL || bands == (unsigned long long *)NULL) {
+      end_scratch_wsq(scratch);
       return(-20);
    }
-   /* Decode the Huffman encoded data blocks. */
-   if((ret = huffman_decode_data_mem(qdata, &context->dtt_table, &context->dqt_table, context->dht_table,
-                                    &cbufptr, ebufptr, context))){
-      free(qdata);
-      free_wsq_decoder_resources(context);
+   /* Subbands left out of the file are zero, and so are the */
+   /* coefficients of zero runs, which the decoders skip.     */
+   num_pix = width * height;
+   memset(fdata, 0, num_pix * sizeof(float));
+   memset(bands, 0, 3 * height * sizeof(unsigned long long));
+
+   /* Decode the Huffman encoded data blocks into the subbands, */
+   /* dequantized, on separate threads if enabled.              */
+   if(context->threads > 1)
+      ret = huffman_decode_blocks_wsq(fdata, bands, width, height,
+                                      &context->dtt_table,
+                                      &context->dqt_table, context->dht_table,
+                                      &cbufptr, ebufptr, nblocks, context);
+   else
+      ret = huffman_decode_data_mem(fdata, bands, width, height,
+                                    &context->dtt_table,
+                                    &context->dqt_table, context->dht_table,
+                                    &cbufptr, ebufptr, nblocks, context);
+   if(ret){
+      end_scratch_wsq(scratch);
       return(ret);
    }
 
-   /* Decode the quantize wavelet subband data. */
-   if((ret = unquantize(&fdata, &context->dqt_table, context->q_tree, Q_TREELEN,
-                         qdata, width, height))){
-      free(qdata);
-      free_wsq_decoder_resources(context);
-      return(ret);
+   state->width = width;
+   state->height = height;
+   state->ppi = ppi;
+   state->scale = scale;
+   state->roi_x = 0;
+   state->roi_y = 0;
+   state->roi_width = width;
+   state->roi_height = height;
+   state->fdata = fdata;
+   state->bands = bands;
+   state->plan = plan;
+
+   return(0);
+}
+
+/***************************************************************************/
+/* Routine running the second stage of a decode: reconstructs the image   */
+/* from the subbands decode_entropy_wsq left, into odata.  Below a scale  */
+/* of 1 only the nodes within the low pass region are reconstructed, and  */
+/* the region, the low pass image of the scale, is rescaled by the gain   */
+/* of the low pass filter over its levels as it is converted to pixels.   */
+/* A window set in the state is all that is reconstructed and written.    */
+/***************************************************************************/
+int decode_transform_wsq(unsigned char *odata, WSQ_DECODE_STATE *state,
+                         WSQContext *context)
+{
+   int ret, i, window;
+   int root, nblocks, levels;     /* low pass region of the scale */
+   int w_treelen;                 /* nodes within the region */
+   W_TREE w_tree[W_TREELEN];      /* nodes within the region */
+   WAVELET_PLAN rplan;            /* planned passes of those nodes */
+   WAVELET_PLAN *wplan;
+   float r_scale;                 /* scaling parameter of the region */
+   double gain;                   /* low pass filter gain of a pass */
+   WSQ_SCRATCH *scratch;          /* working memory of the call */
+
+   scratch = &context->scratch;
+
+   /* The planned synthesis passes apply to the standard filters only; */
+   /* windows are cut from the exact passes, planned apart in a plan   */
+   /* of another precision.                                            */
+   window = state->roi_width < state->width ||
+            state->roi_height < state->height;
+   wplan = (WAVELET_PLAN *)NULL;
+   if(same_dtt_table(&context->dtt_table, &state->plan->dtt_table))
+      wplan = window && state->plan->precision != WSQ_PRECISION_STRICT ?
+              &state->plan->window : &state->plan->synthesis;
+   r_scale = context->frm_header_wsq.r_scale;
+   if(state->scale == 1) {
+      memcpy(w_tree, context->w_tree, sizeof(w_tree));
+      w_treelen = W_TREELEN;
+   }
+   else {
+      if((ret = scale_root_node(&root, &nblocks, &levels, state->scale))) {
+         end_scratch_wsq(scratch);
+         return(ret);
+      }
+      w_treelen = scaled_w_tree(w_tree, &rplan, context->w_tree, root,
+                                wplan);
+      if(wplan != (WAVELET_PLAN *)NULL)
+         wplan = &rplan;
+      gain = 0.0;
+      for(i = 0; i < context->dtt_table.losz; i++)
+         gain += context->dtt_table.lofilt[i];
+      for(i = 0; i < 2 * levels; i++)
+         r_scale /= gain;
    }
 
-   /* Done with quantized wavelet subband data. */
-   free(qdata);
+   if(window) {
+      /* Reconstruct and convert the window only. */
+      if((ret = wsq_reconstruct_window(state->fdata, state->width,
+                              state->height, w_tree, w_treelen,
+                              &context->dtt_table,
+                              wplan, state->roi_x, state->roi_y,
+                              state->roi_width, state->roi_height,
+                              context->threads, scratch))){
+         end_scratch_wsq(scratch);
+         return(ret);
+      }
+      for(i = 0; i < state->roi_height; i++)
+         conv_img_2_uchar(odata + i * state->roi_width,
+                          state->fdata + (state->roi_y + i) * state->width +
+                          state->roi_x, state->roi_width, 1,
+                          context->frm_header_wsq.m_shift, r_scale);
+      end_scratch_wsq(scratch);
+      return(0);
+   }
 
-   if((ret = wsq_reconstruct(fdata, width, height, context->w_tree, W_TREELEN,
-                              &context->dtt_table))){
-      free(fdata);
-      free_wsq_decoder_resources(context);
+   /* Reconstruct into unsigned char pixels. */
+   if((ret = wsq_reconstruct(state->fdata, state->width, state->height,
+                              odata, context->frm_header_wsq.m_shift,
+                              r_scale, w_tree, w_treelen,
+                              &context->dtt_table, context->precision,
+                              wplan, state->bands, context->q_tree,
+                              context->threads, scratch))){
+      end_scratch_wsq(scratch);
       return(ret);
    }
 
-   /* Convert floating point pixels to unsigned char pixels. */
-   conv_img_2_uchar(odata, fdata, width, height,
-                      context->frm_header_wsq.m_shift, context->frm_header_wsq.r_scale);
-
    /* Done with floating point pixels. */
-   free(fdata);
+   end_scratch_wsq(scratch);
 
-   /* Added by MDG on 02-24-05 */
-   free_wsq_decoder_resources(context);
+   return(0);
+}
 
-   /* Assign reconstructed pixmap and attributes to output pointers. */
-   *ow = width;
-   *oh = height;
-   *od = 8;
-   *oppi = ppi;
-   *lossyflag = 1;
+/***************************************************************************/
+/* Routine to build the decoding tables of a block from the huffman table  */
+/* its header names, which has to be one defined.                          */
+/***************************************************************************/
+static int block_decoder_wsq(
+   HUFF_DECODER *decoder,   /* returned decoding tables */
+   DHT_TABLE *dht_table,    /* huffman tables */
+   const unsigned char hufftable_id)  /* table of the block header */
+{
+   int ret;
+
+   if(hufftable_id >= MAX_DHT_TABLES ||
+      (dht_table+hufftable_id)->tabdef != 1) {
+      fprintf(stderr, "ERROR : block_decoder_wsq : ");
+      fprintf(stderr, "huffman table {%d} undefined.\n", hufftable_id);
+      return(-51);
+   }
+
+   if((ret = build_huff_decoder_wsq(decoder, dht_table+hufftable_id))){
+      fprintf(stderr, "         hufftable_id = %d\n", hufftable_id);
+      return(ret);
+   }
 
-   /* Return normally. */
    return(0);
 }
 
 /***************************************************************************/
-/* Routine to decode an entire "block" of encoded data from memory buffer. */
+/* Routine to locate the huffman encoded blocks of a datastream, up to     */
+/* nblocks of them, reading the tables before each.  Each block is given   */
+/* the decoding tables of its huffman table, a copy of the quantization    */
+/* table as it stands at its start, and memory to unstuff into, so that it */
+/* decodes alike in order or on its own.  The blocks located are returned  */
+/* in *onblk, also when an error is returned: one found past them would    */
+/* only have been met once they had decoded.                               */
 /***************************************************************************/
-int huffman_decode_data_mem(
-   short *ip,               /* image pointer */
+static int locate_blocks_wsq(
+   HUFF_DBLOCK_WSQ *blocks, /* returned blocks, 3 of them */
+   int *onblk,              /* returned number of blocks located */
    DTT_TABLE *dtt_table,    /*transform table pointer */
    DQT_TABLE *dqt_table,    /* quantization table */
    DHT_TABLE *dht_table,    /* huffman table */
    unsigned char **cbufptr, /* points to current byte in input buffer */
    unsigned char *ebufptr,  /* points to end of input buffer */
+   const int nblocks,       /* blocks to locate, the first of them */
    WSQContext *context)
 {
    int ret;
    int blk = 0;           /* block number */
    unsigned short marker; /* WSQ markers */
-   int bit_count;         /* bit count for getc_nextbits_wsq routine */
-   int n;                 /* zero run count */
-   int nodeptr;           /* pointers for decoding */
-   int last_size;         /* last huffvalue */
    unsigned char hufftable_id;    /* huffman table number */
-   HUFFCODE *hufftable;   /* huffman code structure */
-   int maxcode[MAX_HUFFBITS+1]; /* used in decoding data */
-   int mincode[MAX_HUFFBITS+1]; /* used in decoding data */
-   int valptr[MAX_HUFFBITS+1];     /* used in decoding data */
-   unsigned short tbits;
-
 
+   *onblk = 0;
    if((ret = getc_marker_wsq(&marker, TBLS_N_SOB, cbufptr, ebufptr)))
       return(ret);
 
-   bit_count = 0;
-
    while(marker != EOI_WSQ) {
 
-      if(marker != 0) {
-         blk++;
-         while(marker != SOB_WSQ) {
-            if((ret = getc_table_wsq(marker, dtt_table, dqt_table,
-                                dht_table, cbufptr, ebufptr, context)))
-               return(ret);
-            if((ret = getc_marker_wsq(&marker, TBLS_N_SOB, cbufptr, ebufptr)))
-               return(ret);
-         }
-         if((ret = getc_block_header(&hufftable_id, cbufptr, ebufptr)))
-            return(ret);
+      if(marker == 0) {
+         fprintf(stderr, "ERROR : locate_blocks_wsq : ");
+         fprintf(stderr, "premature End Of Buffer\n");
+         return(-39);
+      }
 
-         if((dht_table+hufftable_id)->tabdef != 1) {
-            fprintf(stderr, "ERROR : huffman_decode_data_mem : ");
-            fprintf(stderr, "huffman table {%d} undefined.\n", hufftable_id);
-            return(-51);
-         }
+      /* the blocks after those needed are left undecoded */
+      if(blk == nblocks)
+         break;
 
-         /* the next two routines reconstruct the huffman tables */
-         if((ret = build_huffsizes(&hufftable, &last_size,
-                                  (dht_table+hufftable_id)->huffbits,
-                                  MAX_HUFFCOUNTS_WSQ)))
+      while(marker != SOB_WSQ) {
+         if((ret = getc_table_wsq(marker, dtt_table, dqt_table,
+                             dht_table, cbufptr, ebufptr, context)))
+            return(ret);
+         if((ret = getc_marker_wsq(&marker, TBLS_N_SOB, cbufptr, ebufptr)))
             return(ret);
-
-         build_huffcodes(hufftable);
-         if((ret = check_huffcodes_wsq(hufftable, last_size)))
-            fprintf(stderr, "         hufftable_id = %d\n", hufftable_id);
-
-         /* this routine builds a set of three tables used in decoding */
-         /* the compressed data*/
-         gen_decode_table(hufftable, maxcode, mincode, valptr,
-                          (dht_table+hufftable_id)->huffbits);
-         free(hufftable);
-         bit_count = 0;
-         marker = 0;
       }
+      if((ret = getc_block_header(&hufftable_id, cbufptr, ebufptr)))
+         return(ret);
 
-      /* get next huffman category code from compressed input data stream */
-      if((ret = decode_data_mem(&nodeptr, mincode, maxcode, valptr,
-                            (dht_table+hufftable_id)->huffvalues,
-                            cbufptr, ebufptr, &bit_count, &marker, context)))
+      /* build the decoding tables for the block's huffman table */
+      if((ret = block_decoder_wsq(&blocks[blk].decoder, dht_table,
+                                  hufftable_id)))
          return(ret);
+      memcpy(&blocks[blk].dqt_table, dqt_table, sizeof(DQT_TABLE));
 
-      if(nodeptr == -1) {
-         while(marker == COM_WSQ && blk == 3) {
-            if((ret = getc_table_wsq(marker, dtt_table, dqt_table,
-                                dht_table, cbufptr, ebufptr, context)))
-               return(ret);
-            if((ret = getc_marker_wsq(&marker, ANY_WSQ, cbufptr, ebufptr)))
-               return(ret);
-         }
-         continue;
+      blocks[blk].cbufptr = *cbufptr;
+      scan_block_data_mem(&marker, &blocks[blk].ebufptr, cbufptr, ebufptr);
+      blocks[blk].marker = marker;
+      /* the block is unstuffed into memory taken here, on this thread */
+      blocks[blk].ubuf = (unsigned char *)alloc_scratch_wsq(&context->scratch,
+                          (blocks[blk].ebufptr - blocks[blk].cbufptr) +
+                          BIT_READER_PAD);
+      if(blocks[blk].ubuf == (unsigned char *)NULL) {
+         fprintf(stderr, "ERROR : locate_blocks_wsq : alloc : ubuf\n");
+         return(-20);
       }
+      *onblk = ++blk;
 
-      if(nodeptr > 0 && nodeptr <= 100)
-         for(n = 0; n < nodeptr; n++) {
-            *ip++ = 0; /* z run */
-         }
-      else if(nodeptr > 106 && nodeptr < 0xff)
-         *ip++ = nodeptr - 180;
-      else if(nodeptr == 101){
-         if((ret = getc_nextbits_wsq(&tbits, &marker, cbufptr, ebufptr,
-                                &bit_count, 8, context)))
+      while(marker == COM_WSQ && blk == 3) {
+         if((ret = getc_table_wsq(marker, dtt_table, dqt_table,
+                             dht_table, cbufptr, ebufptr, context)))
             return(ret);
-         *ip++ = tbits;
-      }
-      else if(nodeptr == 102){
-         if((ret = getc_nextbits_wsq(&tbits, &marker, cbufptr, ebufptr,
-                                &bit_count, 8, context)))
+         if((ret = getc_marker_wsq(&marker, ANY_WSQ, cbufptr, ebufptr)))
             return(ret);
-         *ip++ = -tbits;
       }
-      else if(nodeptr == 103){
-         if((ret = getc_nextbits_wsq(&tbits, &marker, cbufptr, ebufptr,
-                                &bit_count, 16, context)))
-            return(ret);
-         *ip++ = tbits;
+   }
+
+   return(0);
+}
+
+/***************************************************************************/
+/* Routine to unstuff a located block of entropy coded data and decode it  */
+/* with a coefficient writer.                                               */
+/***************************************************************************/
+static int decode_located_block_wsq(
+   HUFF_DBLOCK_WSQ *block,  /* located block */
+   COEF_WRITER_WSQ *writer) /* subbands the block decodes to */
+{
+   unsigned char *cptr;
+   unsigned short marker;
+   int ulen;              /* length of unstuffed data */
+   BIT_READER_WSQ reader; /* entropy coded data reader */
+
+   cptr = block->cbufptr;
+   unstuff_block_data_mem(block->ubuf, &ulen, &marker, &cptr,
+                          block->ebufptr);
+   init_bit_reader_wsq(&reader, block->ubuf, ulen, block->marker);
+   return(decode_block_data_mem(writer, &block->decoder, &reader));
+}
+
+/***************************************************************************/
+/* Routine to decode located blocks in order, as NBIS did: the            */
+/* coefficients of each follow those of the block before through the      */
+/* subbands, wherever it ended, and a subband takes the quantization      */
+/* table of the block it starts in.  Returns the error of the first block */
+/* failing.                                                                */
+/***************************************************************************/
+static int decode_blocks_in_order_wsq(
+   HUFF_DBLOCK_WSQ *blocks, /* located blocks */
+   const int nblk,          /* number of blocks located */
+   float *fip,              /* floating point image, zeroed */
+   unsigned long long *bands, /* non-zero subbands of each row, zeroed */
+   const int width,         /* image width */
+   const int height,        /* image height */
+   const Q_TREE *q_tree)    /* subband locations */
+{
+   int ret, i;
+   COEF_WRITER_WSQ writer; /* subbands the blocks decode to */
+
+   init_coef_writer_wsq(&writer, fip, bands, width, height,
+                        &blocks[0].dqt_table, q_tree, 0, NUM_SUBBANDS);
+   for(i = 0; i < nblk; i++) {
+      writer.dqt_table = &blocks[i].dqt_table;
+      if((ret = decode_located_block_wsq(blocks + i, &writer)))
+         return(ret);
+   }
+
+   return(0);
+}
+
+/***************************************************************************/
+/* Routine to decode an entire "block" of encoded data from memory buffer. */
+/***************************************************************************/
+int huffman_decode_data_mem(
+   float *fip,              /* floating point image, zeroed */
+   unsigned long long *bands, /* non-zero subbands of each row, zeroed */
+   const int width,         /* image width */
+   const int height,        /* image height */
+   DTT_TABLE *dtt_table,    /*transform table pointer */
+   DQT_TABLE *dqt_table,    /* quantization table */
+   DHT_TABLE *dht_table,    /* huffman table */
+   unsigned char **cbufptr, /* points to current byte in input buffer */
+   unsigned char *ebufptr,  /* points to end of input buffer */
+   const int nblocks,       /* blocks to decode, the first of them */
+   WSQContext *context)
+{
+   int ret, ret_locate;
+   int blk;               /* blocks located */
+   HUFF_DBLOCK_WSQ *blocks;
+   size_t mark;           /* scratch used before the blocks */
+
+   mark = context->scratch.used;
+   blocks = (HUFF_DBLOCK_WSQ *)alloc_scratch_wsq(&context->scratch,
+                                          3 * sizeof(HUFF_DBLOCK_WSQ));
+   if(blocks == (HUFF_DBLOCK_WSQ *)NULL) {
+      fprintf(stderr, "ERROR : huffman_decode_data_mem : alloc : blocks\n");
+      return(-20);
+   }
+
+   /* the blocks located come before any error found past them */
+   ret_locate = locate_blocks_wsq(blocks, &blk, dtt_table, dqt_table,
+                                  dht_table, cbufptr, ebufptr, nblocks,
+                                  context);
+   ret = decode_blocks_in_order_wsq(blocks, blk, fip, bands, width, height,
+                                    context->q_tree);
+
+   context->scratch.used = mark;
+   return(ret ? ret : ret_locate);
+}
+
+/***************************************************************************/
+/* Routine to locate the end of a block of entropy coded data: the first   */
+/* 0xFF not followed by a stuffed zero.  cbufptr is returned past the      */
+/* marker, or at the end of the input buffer with a zero marker.           */
+/***************************************************************************/
+void scan_block_data_mem(
+   unsigned short *omarker, /* returned marker ending the data */
+   unsigned char **oend,    /* returned end of entropy coded data */
+   unsigned char **cbufptr, /* points to current byte in input buffer */
+   unsigned char *ebufptr)  /* points to end of input buffer */
+{
+   unsigned char *cptr;
+
+   cptr = *cbufptr;
+   while(cptr < ebufptr) {
+      cptr = (unsigned char *)memchr(cptr, 0xFF, ebufptr - cptr);
+      if(cptr == (unsigned char *)NULL || cptr + 1 >= ebufptr)
+         break;
+      if(*(cptr+1) != 0x00) {
+         *omarker = (*cptr << 8) | *(cptr+1);
+         *oend = cptr;
+         *cbufptr = cptr + 2;
+         return;
       }
-      else if(nodeptr == 104){
-         if((ret = getc_nextbits_wsq(&tbits, &marker, cbufptr, ebufptr,
-                                &bit_count, 16, context)))
-            return(ret);
-         *ip++ = -tbits;
+      cptr += 2;
+   }
+
+   *omarker = 0;
+   *oend = ebufptr;
+   *cbufptr = ebufptr;
+}
+
+/***************************************************************************/
+/* Job decoding a located block of entropy coded data into its own         */
+/* subbands.  A block that does not fill them exactly fails with -53.      */
+/***************************************************************************/
+static void decode_block_job(void *arg)
+{
+   HUFF_DBLOCK_WSQ *block;
+
+   block = (HUFF_DBLOCK_WSQ *)arg;
+   block->ret = decode_located_block_wsq(block, &block->writer);
+   if(block->ret == 0 && !coef_writer_done_wsq(&block->writer))
+      block->ret = -53;
+}
+
+/***************************************************************************/
+/* Routine to decode the huffman encoded blocks from a memory buffer on    */
+/* up to context->threads threads.  The blocks are first located by        */
+/* scanning for the markers that end them, which stuffing keeps out of     */
+/* the entropy coded data, and each is then decoded into its own subbands */
+/* of the floating point image.  If any block fails, or does not fill its */
+/* subbands exactly, the blocks are decoded again in order, as by          */
+/* huffman_decode_data_mem, so that both accept the same datastreams and  */
+/* decode them alike.                                                      */
+/***************************************************************************/
+int huffman_decode_blocks_wsq(
+   float *fip,              /* floating point image, zeroed */
+   unsigned long long *bands, /* non-zero subbands of each row, zeroed, */
+                              /*    for each of 3 blocks               */
+   const int width,         /* image width */
+   const int height,        /* image height */
+   DTT_TABLE *dtt_table,    /*transform table pointer */
+   DQT_TABLE *dqt_table,    /* quantization table */
+   DHT_TABLE *dht_table,    /* huffman table */
+   unsigned char **cbufptr, /* points to current byte in input buffer */
+   unsigned char *ebufptr,  /* points to end of input buffer */
+   const int nblocks,       /* blocks to decode, the first of them */
+   WSQContext *context)
+{
+   int ret, ret_locate, i, y;
+   int blk;               /* blocks located */
+   static const int block_bands[4] = {0, STRT_SUBBAND_2, STRT_SUBBAND_3,
+                                      STRT_SUBBAND_DEL}; /* of the blocks */
+   HUFF_DBLOCK_WSQ *blocks;
+   WSQ_SCRATCH *scratch;  /* working memory of the call */
+   size_t mark;           /* scratch used before the blocks */
+
+   scratch = &context->scratch;
+   mark = scratch->used;
+   blocks = (HUFF_DBLOCK_WSQ *)alloc_scratch_wsq(scratch,
+                                          3 * sizeof(HUFF_DBLOCK_WSQ));
+   if(blocks == (HUFF_DBLOCK_WSQ *)NULL) {
+      fprintf(stderr, "ERROR : huffman_decode_blocks_wsq : alloc : blocks\n");
+      return(-20);
+   }
+
+   /* the blocks located come before any error found past them */
+   ret_locate = locate_blocks_wsq(blocks, &blk, dtt_table, dqt_table,
+                                  dht_table, cbufptr, ebufptr, nblocks,
+                                  context);
+
+   /* Each block decodes to its own subbands of the image. */
+   for(i = 0; i < blk; i++)
+      init_coef_writer_wsq(&blocks[i].writer, fip, bands + i * height,
+                           width, height, &blocks[i].dqt_table,
+                           context->q_tree, block_bands[i],
+                           block_bands[i+1]);
+   if(blk > 0)
+      run_jobs_wsq(decode_block_job, blocks, sizeof(HUFF_DBLOCK_WSQ), blk,
+                   context->threads);
+
+   ret = 0;
+   for(i = 0; i < blk && ret == 0; i++)
+      ret = blocks[i].ret;
+   if(ret == 0) {
+      /* The rows of the blocks together, in the first. */
+      for(i = 1; i < blk; i++)
+         for(y = 0; y < height; y++)
+            bands[y] |= bands[i * height + y];
+   }
+   else {
+      memset(fip, 0, (size_t)width * height * sizeof(float));
+      memset(bands, 0, 3 * (size_t)height * sizeof(unsigned long long));
+      ret = decode_blocks_in_order_wsq(blocks, blk, fip, bands, width,
+                                       height, context->q_tree);
+   }
+
+   scratch->used = mark;
+   return(ret ? ret : ret_locate);
+}
+
+/*******************************************************************/
+/* Routine to build the tables used in decoding a huffman block:   */
+/* the maxcode/mincode/valptr tables for the bit at a time walk    */
+/* and the lookup table resolving short codes in a single probe.   */
+/*******************************************************************/
+int build_huff_decoder_wsq(
+   HUFF_DECODER *decoder,   /* returned decoding tables */
+   DHT_TABLE *dht_table)    /* huffman table to be decoded */
+{
+   int last_size;           /* last huffvalue */
+   HUFFCODE hufftable[MAX_HUFFCOUNTS_WSQ+1];  /* huffman code structure */
+
+   /* the next two routines reconstruct the huffman tables */
+   build_huffsizes_wsq(hufftable, &last_size, dht_table->huffbits);
+
+   build_huffcodes(hufftable);
+   /* a non compliant table may still be decodable, so only warn */
+   check_huffcodes_wsq(hufftable, last_size);
+
+   /* this routine builds a set of three tables used in decoding */
+   /* the compressed data*/
+   gen_decode_table(hufftable, decoder->maxcode, decoder->mincode,
+                    decoder->valptr, dht_table->huffbits);
+   gen_decode_lookup(decoder->lookup, hufftable, last_size,
+                     dht_table->huffvalues);
+   memcpy(decoder->huffvalues, dht_table->huffvalues,
+          sizeof(decoder->huffvalues));
+
+   return(0);
+}
+
+/*******************************************************************/
+/* Routine to generate the lookup table for codes of up to         */
+/* HUFF_LOOKUP_BITS bits.  Every entry whose leading bits hold a   */
+/* complete code gets that code's length and value.  When the bits */
+/* left after a zero run or coefficient code also hold a complete  */
+/* zero run or coefficient code, the pair is stored as well so     */
+/* both are decoded in one step.                                   */
+/*******************************************************************/
+#define SIMPLE_HUFFVAL_WSQ(_v_) \
+   (((_v_) > 0 && (_v_) <= 100) || ((_v_) > 106 && (_v_) < 0xff))
+
+void gen_decode_lookup(
+   HUFF_LOOKUP *lookup,       /* returned lookup table */
+   HUFFCODE *hufftable,       /* huffman codes in code order */
+   const int last_size,       /* number of codes in hufftable */
+   unsigned char *huffvalues) /* huffman values in code order */
+{
+   int i, j, first, count;
+   int len;
+   HUFF_LOOKUP *entry, *next;
+
+   memset(lookup, 0, HUFF_LOOKUP_SIZE * sizeof(HUFF_LOOKUP));
+
+   for(i = 0; i < last_size; i++) {
+      len = (hufftable+i)->size;
+      if(len > HUFF_LOOKUP_BITS)
+         break;
+      first = (hufftable+i)->code << (HUFF_LOOKUP_BITS - len);
+      count = 1 << (HUFF_LOOKUP_BITS - len);
+      for(j = first; j < first + count; j++) {
+         lookup[j].len = (unsigned char)len;
+         lookup[j].val = huffvalues[i];
       }
-      else if(nodeptr == 105) {
-         if((ret = getc_nextbits_wsq(&tbits, &marker, cbufptr, ebufptr,
-                                &bit_count, 8, context)))
-            return(ret);
-         n = tbits;
-         while(n--)
-            *ip++ = 0;
+   }
+
+   for(j = 0; j < HUFF_LOOKUP_SIZE; j++) {
+      entry = lookup + j;
+      if(entry->len == 0 || entry->len == HUFF_LOOKUP_BITS ||
+         !SIMPLE_HUFFVAL_WSQ(entry->val))
+         continue;
+      next = lookup + ((j << entry->len) & (HUFF_LOOKUP_SIZE - 1));
+      if(next->len == 0 || next->len > HUFF_LOOKUP_BITS - entry->len ||
+         !SIMPLE_HUFFVAL_WSQ(next->val))
+         continue;
+      entry->len2 = entry->len + next->len;
+      entry->val2 = next->val;
+   }
+}
+
+/*******************************************************************/
+/* Routine to copy the entropy coded data at cbufptr into obuf,    */
+/* dropping the zero bytes stuffed after each 0xFF, up to the      */
+/* marker that ends it.  cbufptr is returned past the marker, or   */
+/* at the end of the input buffer with a zero marker if none was   */
+/* found.  obuf must hold the remaining input plus BIT_READER_PAD  */
+/* bytes; the unstuffed data is followed by BIT_READER_PAD bytes   */
+/* of 0xFF.                                                        */
+/*******************************************************************/
+int unstuff_block_data_mem(
+   unsigned char *obuf,     /* returned unstuffed data */
+   int *olen,               /* returned length of unstuffed data */
+   unsigned short *omarker, /* returned marker ending the data */
+   unsigned char **cbufptr, /* points to current byte in input buffer */
+   unsigned char *ebufptr)  /* points to end of input buffer */
+{
+   unsigned char *cptr, *optr, *fptr;
+   unsigned short marker;
+
+   cptr = *cbufptr;
+   optr = obuf;
+   marker = 0;
+
+   while(cptr < ebufptr) {
+      fptr = (unsigned char *)memchr(cptr, 0xFF, ebufptr - cptr);
+      if(fptr == (unsigned char *)NULL) {
+         memcpy(optr, cptr, ebufptr - cptr);
+         optr += ebufptr - cptr;
+         cptr = ebufptr;
+         break;
       }
-      else if(nodeptr == 106) {
-         if((ret = getc_nextbits_wsq(&tbits, &marker, cbufptr, ebufptr,
-                                &bit_count, 16, context)))
-            return(ret);
-         n = tbits;
-         while(n--)
-            *ip++ = 0;
+      memcpy(optr, cptr, fptr - cptr);
+      optr += fptr - cptr;
+      cptr = fptr;
+      /* a trailing 0xFF can be neither data nor a marker */
+      if(cptr + 1 >= ebufptr) {
+         cptr = ebufptr;
+         break;
       }
-      else {
-         fprintf(stderr,
-                "ERROR: huffman_decode_data_mem : Invalid code %d (%x).\n",
-                nodeptr, nodeptr);
-         return(-52);
+      if(*(cptr+1) != 0x00) {
+         marker = (*cptr << 8) | *(cptr+1);
+         cptr += 2;
+         break;
       }
-
+      *optr++ = 0xFF;
+      cptr += 2;
    }
 
+   memset(optr, 0xFF, BIT_READER_PAD);
+   *olen = (int)(optr - obuf);
+   *omarker = marker;
+   *cbufptr = cptr;
+
    return(0);
 }
 
-/**********************************************************/
-/* Routine to decode the encoded data from memory buffer. */
-/**********************************************************/
-int decode_data_mem(
-   int *onodeptr,       /* returned huffman code category        */
-   int *mincode,        /* points to minimum code value for      */
-                        /*    a given code length                */
-   int *maxcode,        /* points to maximum code value for      */
-                        /*    a given code length                */
-   int *valptr,         /* points to first code in the huffman   */
-                        /*    code table for a given code length */
-   unsigned char *huffvalues,   /* defines order of huffman code          */
-                                /*    lengths in relation to code sizes   */
-   unsigned char **cbufptr,     /* points to current byte in input buffer */
-   unsigned char *ebufptr,      /* points to end of input buffer          */
-   int *bit_count,      /* marks the bit to receive from the input byte */
-   unsigned short *marker,
-   WSQContext *context)
+/*******************************************************************/
+/* Routine to start reading len bytes of unstuffed entropy coded   */
+/* data ended by marker.                                           */
+/*******************************************************************/
+void init_bit_reader_wsq(
+   BIT_READER_WSQ *reader,   /* reader to initialize */
+   unsigned char *buf,       /* unstuffed data, padded with 0xFF */
+   const int len,            /* length of unstuffed data */
+   const unsigned short marker) /* marker ending the data */
 {
-   int ret;
-   int inx, inx2;       /*increment variables*/
-   unsigned short code, tbits;  /* becomes a huffman code word
-                                   (one bit at a time)*/
+   reader->cbufptr = buf;
+   reader->bitbuf = 0;
+   reader->bits = 0;
+   reader->bitsleft = len << 3;
+   reader->marker = marker;
+}
 
-   if((ret = getc_nextbits_wsq(&code, marker, cbufptr, ebufptr, bit_count, 1, context)))
-      return(ret);
+/*******************************************************************/
+/* Loads the next 8 bytes as a big endian word.                    */
+/*******************************************************************/
+static INLINE unsigned long long load_be64_wsq(const unsigned char *p)
+{
+#if defined(__GNUC__) && defined(CPU_LE)
+   unsigned long long v;
+   memcpy(&v, p, sizeof(v));
+   return(__builtin_bswap64(v));
+#elif defined(_MSC_VER) && defined(CPU_LE)
+   unsigned long long v;
+   memcpy(&v, p, sizeof(v));
+   return(_byteswap_uint64(v));
+#else
+   return(((unsigned long long)p[0] << 56) | ((unsigned long long)p[1] << 48) |
+          ((unsigned long long)p[2] << 40) | ((unsigned long long)p[3] << 32) |
+          ((unsigned long long)p[4] << 24) | ((unsigned long long)p[5] << 16) |
+          ((unsigned long long)p[6] << 8) | (unsigned long long)p[7]);
+#endif
+}
 
-   if(*marker != 0){
-      *onodeptr = -1;
-      return(0);
+/*******************************************************************/
+/* Tops up the bit buffer to at least 56 bits with a single load.  */
+/* Reads past the data land in the 0xFF padding, which never       */
+/* completes a WSQ code and is excluded by bitsleft.               */
+/*******************************************************************/
+#define FILL_BIT_READER_WSQ(_r_) \
+   { \
+      (_r_)->bitbuf |= load_be64_wsq((_r_)->cbufptr) >> (_r_)->bits; \
+      (_r_)->cbufptr += (63 - (_r_)->bits) >> 3; \
+      (_r_)->bits |= 56; \
    }
 
-   for(inx = 1; (int)code > maxcode[inx]; inx++) {
-      if((ret = getc_nextbits_wsq(&tbits, marker, cbufptr, ebufptr, bit_count, 1, context)))
-         return(ret);
+#define SKIP_BITS_WSQ(_r_, _n_) \
+   { \
+      (_r_)->bitbuf <<= (_n_); \
+      (_r_)->bits -= (_n_); \
+      (_r_)->bitsleft -= (_n_); \
+   }
 
-      code = (code << 1) + tbits;
-      if(*marker != 0){
-         *onodeptr = -1;
-         return(0);
+/*******************************************************************/
+/* Runs out of entropy coded data in the middle of a code: that is */
+/* the end of the block if a marker was reached, else an error.    */
+/*******************************************************************/
+static int end_of_block_wsq(BIT_READER_WSQ *reader)
+{
+   if(reader->marker != 0)
+      return(0);
+   fprintf(stderr, "ERROR : decode_block_data_mem : premature End Of Buffer\n");
+   return(-39);
+}
+
+/*******************************************************************/
+/* Reads the extra bits that follow an escape code.  The bit       */
+/* buffer always holds enough bits after a refill.                 */
+/*******************************************************************/
+static int getc_extra_bits_wsq(
+   unsigned short *obits,
+   BIT_READER_WSQ *reader,
+   const int bits_req)
+{
+   if(reader->bitsleft < bits_req) {
+      if(reader->marker != 0) {
+         fprintf(stderr, "ERROR: decode_block_data_mem : No stuffed zeros\n");
+         return(-41);
       }
+      fprintf(stderr, "ERROR : decode_block_data_mem : premature End Of Buffer\n");
+      return(-39);
    }
-   inx2 = valptr[inx];
-   inx2 = inx2 + code - mincode[inx];
+   *obits = (unsigned short)(reader->bitbuf >> (64 - bits_req));
+   SKIP_BITS_WSQ(reader, bits_req);
+   return(0);
+}
 
-   *onodeptr = huffvalues[inx2];
+/*******************************************************************/
+/* Writes a decoded coefficient to its place in the subbands,      */
+/* dequantized: zero stays zero, and a coefficient c of a subband  */
+/* of bin width Q, zero bin Z and bin center C becomes             */
+/* Q*(c-C) + Z/2 if positive, Q*(c+C) - Z/2 if negative.  Its row  */
+/* is flagged when non-zero.                                       */
+/*******************************************************************/
+static INLINE int put_coef_wsq(COEF_WRITER_WSQ *writer, const short coef)
+{
+   int ret;
+
+   if(writer->left == 0 && (ret = next_coef_row_wsq(writer)))
+      return(ret);
+   if(writer->fptr != (float *)NULL) {
+      if(coef > 0)
+         *writer->fptr = (writer->q_bin * ((float)coef - writer->C))
+                       + writer->z_half;
+      else if(coef < 0)
+         *writer->fptr = (writer->q_bin * ((float)coef + writer->C))
+                       - writer->z_half;
+      if(coef != 0)
+         writer->bands[writer->y] |= writer->bit;
+      writer->fptr++;
+   }
+   writer->left--;
    return(0);
 }
 
-/****************************************************************/
-/* Routine to get nextbit(s) of data stream from memory buffer. */
-/****************************************************************/
-int getc_nextbits_wsq(
-   unsigned short *obits,       /* returned bits */
-   unsigned short *marker,      /* returned marker */
-   unsigned char **cbufptr,     /* points to current byte in input buffer */
-   unsigned char *ebufptr,      /* points to end of input buffer */
-   int *bit_count,      /* marks the bit to receive from the input byte */
-   const int bits_req,  /* points to end of input buffer */
-   WSQContext *context)
+/*******************************************************************/
+/* Skips a run of zero coefficients, zero in the image already.    */
+/*******************************************************************/
+static INLINE int skip_coefs_wsq(COEF_WRITER_WSQ *writer, int count)
 {
    int ret;
-   unsigned short bits, tbits;  /*bits of current data byte requested*/
-   int bits_needed;     /*additional bits required to finish request*/
-
-                              /*used to "mask out" n number of
-                                bits from data stream*/
-   static unsigned char bit_mask[9] = {0x00,0x01,0x03,0x07,0x0f,
-                                       0x1f,0x3f,0x7f,0xff};
-   if(*bit_count == 0) {
-      if((ret = getc_byte(&context->code, cbufptr, ebufptr))){
+
+   while(count > writer->left) {
+      count -= writer->left;
+      if(writer->fptr != (float *)NULL)
+         writer->fptr += writer->left;
+      writer->left = 0;
+      if((ret = next_coef_row_wsq(writer)))
          return(ret);
-      }
-      *bit_count = 8;
-      if(context->code == 0xFF) {
-         if((ret = getc_byte(&context->code2, cbufptr, ebufptr))){
+   }
+   if(writer->fptr != (float *)NULL)
+      writer->fptr += count;
+   writer->left -= count;
+   return(0);
+}
+
+/*******************************************************************/
+/* Routine to decode the huffman coded data of a block, up to the  */
+/* marker that ends it, dequantizing each coefficient into its     */
+/* subband as it comes out.                                        */
+/*******************************************************************/
+int decode_block_data_mem(
+   COEF_WRITER_WSQ *writer, /* subbands, returned past the block */
+   HUFF_DECODER *decoder,   /* decoding tables of the block */
+   BIT_READER_WSQ *reader)  /* entropy coded data of the block */
+{
+   int ret;
+   int inx, code;
+   int nodeptr;           /* huffman value decoded */
+   HUFF_LOOKUP *entry;
+   unsigned short tbits;
+
+   while(1) {
+      /* one refill covers the longest code and its extra bits */
+      FILL_BIT_READER_WSQ(reader);
+
+      entry = decoder->lookup + (reader->bitbuf >> (64 - HUFF_LOOKUP_BITS));
+
+      if(entry->len2 != 0 && entry->len2 <= reader->bitsleft) {
+         /* zero run or coefficient followed by another */
+         SKIP_BITS_WSQ(reader, entry->len2);
+         if(entry->val <= 100)
+            ret = skip_coefs_wsq(writer, entry->val);
+         else
+            ret = put_coef_wsq(writer, entry->val - 180);
+         if(ret)
             return(ret);
+         if(entry->val2 <= 100)
+            ret = skip_coefs_wsq(writer, entry->val2);
+         else
+            ret = put_coef_wsq(writer, entry->val2 - 180);
+         if(ret)
+            return(ret);
+         continue;
+      }
+
+      if(entry->len != 0) {
+         if(entry->len > reader->bitsleft)
+            break;
+         SKIP_BITS_WSQ(reader, entry->len);
+         nodeptr = entry->val;
+      }
+      else {
+         /* code longer than the lookup, compare its leading bits */
+         for(inx = HUFF_LOOKUP_BITS + 1; ; inx++) {
+            code = (int)(reader->bitbuf >> (64 - inx));
+            if(code <= decoder->maxcode[inx])
+               break;
+            if(inx == MAX_HUFFBITS) {
+               if(MAX_HUFFBITS > reader->bitsleft)
+                  break;
+               fprintf(stderr,
+                      "ERROR: decode_block_data_mem : Invalid code.\n");
+               return(-52);
+            }
          }
-         if(context->code2 != 0x00 && bits_req == 1) {
-            *marker = (context->code << 8) | context->code2;
-            *obits = 1;
-            return(0);
-         }
-         if(context->code2 != 0x00) {
-            fprintf(stderr, "ERROR: getc_nextbits_wsq : No stuffed zeros\n");
-            return(-41);
-         }
+         if(inx > reader->bitsleft)
+            break;
+         SKIP_BITS_WSQ(reader, inx);
+         nodeptr = decoder->huffvalues[decoder->valptr[inx] + code -
+                                       decoder->mincode[inx]];
       }
-   }
-   if(bits_req <= *bit_count) {
-      bits = (context->code >>(*bit_count - bits_req)) & (bit_mask[bits_req]);
-      *bit_count -= bits_req;
-      context->code &= bit_mask[*bit_count];
-   }
-   else {
-      bits_needed = bits_req - *bit_count;
-      bits = context->code << bits_needed;
-      *bit_count = 0;
-      if((ret = getc_nextbits_wsq(&tbits, (unsigned short *)NULL, cbufptr,
-                             ebufptr, bit_count, bits_needed, context)))
+
+      if(nodeptr > 0 && nodeptr <= 100)
+         ret = skip_coefs_wsq(writer, nodeptr); /* z run */
+      else if(nodeptr > 106 && nodeptr < 0xff)
+         ret = put_coef_wsq(writer, nodeptr - 180);
+      else if(nodeptr == 101){
+         if((ret = getc_extra_bits_wsq(&tbits, reader, 8)))
+            return(ret);
+         ret = put_coef_wsq(writer, (short)tbits);
+      }
+      else if(nodeptr == 102){
+         if((ret = getc_extra_bits_wsq(&tbits, reader, 8)))
+            return(ret);
+         ret = put_coef_wsq(writer, (short)-tbits);
+      }
+      else if(nodeptr == 103){
+         if((ret = getc_extra_bits_wsq(&tbits, reader, 16)))
+            return(ret);
+         ret = put_coef_wsq(writer, (short)tbits);
+      }
+      else if(nodeptr == 104){
+         if((ret = getc_extra_bits_wsq(&tbits, reader, 16)))
+            return(ret);
+         ret = put_coef_wsq(writer, (short)-tbits);
+      }
+      else if(nodeptr == 105) {
+         if((ret = getc_extra_bits_wsq(&tbits, reader, 8)))
+            return(ret);
+         ret = skip_coefs_wsq(writer, tbits);
+      }
+      else if(nodeptr == 106) {
+         if((ret = getc_extra_bits_wsq(&tbits, reader, 16)))
+            return(ret);
+         ret = skip_coefs_wsq(writer, tbits);
+      }
+      else {
+         fprintf(stderr,
+                "ERROR: decode_block_data_mem : Invalid code %d (%x).\n",
+                nodeptr, nodeptr);
+         return(-52);
+      }
+      if(ret)
          return(ret);
-      bits |= tbits;
    }
 
-   *obits = bits;
-   return(0);
+   return(end_of_block_wsq(reader));
 }
@@ -12,17 +12,55 @@
 #include "tableio.h"
 #include "ppi.h"
 
+/* A decode between its entropy and transform stages; the subbands */
+/* are in the scratch of the context that ran the first stage.      */
+typedef struct wsq_decode_state {
+   int width;           /* of the image decoded, at its scale */
+   int height;
+   int ppi;
+   int scale;           /* 1, or 2, 4 or 8 for a reduced resolution */
+   int roi_x;           /* window of the image written to odata, */
+   int roi_y;           /*    the whole image unless cropped     */
+   int roi_width;
+   int roi_height;
+   float *fdata;        /* dequantized subbands */
+   unsigned long long *bands; /* non-zero subbands of each row of fdata */
+   WSQPlan *plan;       /* plan of the image size */
+} WSQ_DECODE_STATE;
+
 /* decoder.c */
 int wsq_decode_mem(unsigned char *odata, int *ow, int *oh, int *od, int *oppi,
                    int *lossyflag, unsigned char *idata, const int ilen, WSQContext * context);
-int huffman_decode_data_mem(short *ip, DTT_TABLE *dtt_table, DQT_TABLE *dqt_table,
+int wsq_decode_scaled_mem(unsigned char *odata, int *ow, int *oh, int *od,
+                   int *oppi, int *lossyflag, unsigned char *idata,
+                   const int ilen, const int scale, WSQContext *context);
+int wsq_decode_region_mem(unsigned char *odata, const int x, const int y,
+                   const int w, const int h, int *od, int *oppi,
+                   int *lossyflag, unsigned char *idata, const int ilen,
+                   WSQContext *context);
+int decode_entropy_wsq(WSQ_DECODE_STATE *state, unsigned char *idata,
+                   const int ilen, const int scale, WSQContext *context);
+int decode_transform_wsq(unsigned char *odata, WSQ_DECODE_STATE *state,
+                   WSQContext *context);
+int huffman_decode_data_mem(float *fip, unsigned long long *bands,
+                            const int width, const int height,
+                            DTT_TABLE *dtt_table, DQT_TABLE *dqt_table,
                             DHT_TABLE *dht_table, unsigned char **cbufptr, unsigned char *ebufptr,
-                            WSQContext *context);
-int decode_data_mem(int *onodeptr, int *mincode, int *maxcode, int *valptr,
-   unsigned char *huffvalues, unsigned char **cbufptr, unsigned char *ebufptr,
-   int *bit_count, unsigned short *marker, WSQContext *context);
-int getc_nextbits_wsq(unsigned short *obits, unsigned short *marker,
-   unsigned char **cbufptr, unsigned char *ebufptr, int *bit_count,
-   const int bits_req, WSQContext *context);
+                            const int nblocks, WSQContext *context);
+void scan_block_data_mem(unsigned short *omarker, unsigned char **oend,
+   unsigned char **cbufptr, unsigned char *ebufptr);
+int huffman_decode_blocks_wsq(float *fip, unsigned long long *bands,
+   const int width, const int height, DTT_TABLE *dtt_table,
+   DQT_TABLE *dqt_table, DHT_TABLE *dht_table, unsigned char **cbufptr,
+   unsigned char *ebufptr, const int nblocks, WSQContext *context);
+int build_huff_decoder_wsq(HUFF_DECODER *decoder, DHT_TABLE *dht_table);
+void gen_decode_lookup(HUFF_LOOKUP *lookup, HUFFCODE *hufftable,
+   const int last_size, unsigned char *huffvalues);
+int unstuff_block_data_mem(unsigned char *obuf, int *olen,
+   unsigned short *omarker, unsigned char **cbufptr, unsigned char *ebufptr);
+void init_bit_reader_wsq(BIT_READER_WSQ *reader, unsigned char *buf,
+   const int len, const unsigned short marker);
+int decode_block_data_mem(COEF_WRITER_WSQ *writer, HUFF_DECODER *decoder,
+   BIT_READER_WSQ *reader);
 int wsq_get_dimensions(unsigned char *idata, const int ilen, int *ow, int *oh, WSQContext *context);
 #endif /* DECODER_H_ */
@@ -36,22 +36,38 @@ identified are necessarily the best available for the purpose.
       ROUTINES:
 #cat: wsq_encode_mem - WSQ encodes image data storing the compressed
 #cat:                   bytes to a memory buffer.
-#cat: gen_hufftable_wsq - Generates a huffman table for a quantized
-#cat:                   data block.
-#cat: compress_block - Codes a quantized image using huffman tables.
+#cat: huffman_encode_blocks_wsq - Huffman codes the blocks of a quantized
+#cat:                   image, optionally on separate threads.
+#cat: gen_hufftable_wsq - Generates a huffman table from the counts of
+#cat:                   quantized data blocks.
+#cat: build_huff_encoder_wsq - Builds the table of codewords with their
+#cat:                   escape payloads attached.
+#cat: init_bit_writer_wsq - Starts writing huffman coded data to a
+#cat:                   memory buffer.
+#cat: flush_bit_writer_wsq - Writes the remaining huffman coded bits to
+#cat:                   a memory buffer.
+#cat: tokenize_block - Splits a quantized data block into coefficient
+#cat:                   and zero run tokens.
+#cat: compress_block - Codes a tokenized block using huffman tables.
 #cat:
 #cat: count_block - Counts the number of occurrences of each category
-#cat:                   in a huffman table.
+#cat:                   in a tokenized block.
 
 ***********************************************************************/
 
 #include <stdio.h>
+#include <string.h>
+#include "Config.h"
 #include "encoder.h"
 #include "util.h"
 #include "tree.h"
 #include "tableio.h"
 #include "dataio.h"
 #include "huff.h"
+#include "thread.h"
+#include "plan.h"
+#include "scratch.h"
+#include "sched.h"
 
 /************************************************************************/
 /*              This is an implementation based on the Crinimal         */
@@ -62,7 +78,7 @@ identified are necessarily the best available for the purpose.
 /* WSQ encodes/compresses an image pixmap.                              */
 /************************************************************************/
 
-int wsq_encode_mem(unsigned char *odata,
+static int encode_image_wsq(unsigned char *odata,
 				   int *olen,
            unsigned char *idata,
 				   int w,
@@ -77,14 +93,13 @@ int wsq_encode_mem(unsigned char *odata,
    float m_shift, r_scale;       /* shift/scale parameters      */
    short *qdata;                 /* quantized image pointer     */
    int qsize, qsize1, qsize2, qsize3;  /* quantized block sizes */
-   unsigned char *huffbits, *huffvalues; /* huffman code parameters     */
-   HUFFCODE *hufftable;          /* huffcode table              */
-   unsigned char *huff_buf;      /* huffman encoded buffer      */
-   int hsize, hsize1, hsize2, hsize3; /* Huffman coded blocks sizes */
+   int qsizes[3];                /* quantized block sizes       */
    int wsq_alloc;       /* number of bytes in buffer   */
-	int block_sizes[2];
 	float r_bitrate;
 	char* comment_text;
+   WSQPlan *plan;                /* plan of the image size      */
+   WSQ_SCRATCH *scratch;         /* working memory of the call  */
+   size_t mark;                  /* scratch used before fdata   */
 
 	r_bitrate = 0.75;
 	comment_text = "WSQ";
@@ -92,23 +107,38 @@ int wsq_encode_mem(unsigned char *odata,
    /* Compute the total number of pixels in image. */
    num_pix = w * h;
 
-   /* Allocate floating point pixmap. */
-   if((fdata = (float *) malloc(num_pix*sizeof(float))) == NULL) {
+   /* Take the trees and planned filter passes of the image size. */
+   if((ret = context_plan_wsq(&plan, context, w, h)))
+      return(ret);
+   memcpy(context->w_tree, plan->w_tree, sizeof(plan->w_tree));
+   memcpy(context->q_tree, plan->q_tree, sizeof(plan->q_tree));
+
+   /* Allocate the quantized and floating point pixmaps, the first */
+   /* kept to the end, the second released once quantized.         */
+   scratch = &context->scratch;
+   if((ret = begin_scratch_wsq(scratch,
+                               encode_scratch_size(w, h, context->threads))))
+      return(ret);
+   qdata = (short *)alloc_scratch_wsq(scratch, num_pix*sizeof(short));
+   mark = scratch->used;
+   fdata = (float *)alloc_scratch_wsq(scratch, num_pix*sizeof(float));
+   if(qdata == NULL || fdata == NULL) {
       fprintf(stderr,"ERROR : wsq_encode_1 : malloc : fdata\n");
+      end_scratch_wsq(scratch);
       return(-10);
    }
 
-   /* Convert image pixels to floating point. */
-   conv_img_2_flt(fdata, &m_shift, &r_scale, idata, num_pix);
-
-
-   /* Build WSQ decomposition trees */
-   build_wsq_trees(context->w_tree, W_TREELEN, context->q_tree, Q_TREELEN, w, h);
+   /* Shift and scale of the image pixels to floating point, */
+   /* converted as the decomposition reads them.             */
+   conv_img_2_flt((float *)NULL, &m_shift, &r_scale, idata, num_pix);
 
    /* WSQ decompose the image */
-   if((ret = wsq_decompose(fdata, w, h, context->w_tree, W_TREELEN,
-                            hifilt, MAX_HIFILT, lofilt, MAX_LOFILT))){
-      free(fdata);
+   if((ret = wsq_decompose(fdata, w, h, idata, m_shift, r_scale,
+                            context->w_tree, W_TREELEN,
+                            hifilt, MAX_HIFILT, lofilt, MAX_LOFILT,
+                            context->precision, &plan->analysis,
+                            context->q_tree, context->threads, scratch))){
+      end_scratch_wsq(scratch);
       return(ret);
    }
 
@@ -118,17 +148,18 @@ int wsq_encode_mem(unsigned char *odata,
    /* Assign specified r-bitrate into quantization structure. */
    context->quant_vals.r = r_bitrate;
    /* Compute subband variances. */
-   variance(&context->quant_vals, context->q_tree, Q_TREELEN, fdata, w, h);
+   variance(&context->quant_vals, context->q_tree, Q_TREELEN, fdata, w, h,
+            context->precision);
 
    /* Quantize the floating point pixmap. */
-   if((ret = quantize(&qdata, &qsize, &context->quant_vals, context->q_tree, Q_TREELEN,
-                      fdata, w, h))){
-      free(fdata);
+   if((ret = quantize(qdata, &qsize, &context->quant_vals, context->q_tree, Q_TREELEN,
+                      fdata, w, h, context->precision))){
+      end_scratch_wsq(scratch);
       return(ret);
    }
 
    /* Done with floating point wsq subband data. */
-   free(fdata);
+   scratch->used = mark;
 
    /* Compute quantized WSQ subband block sizes */
    quant_block_sizes(&qsize1, &qsize2, &qsize3, &context->quant_vals,
@@ -137,6 +168,7 @@ int wsq_encode_mem(unsigned char *odata,
    if(qsize != qsize1+qsize2+qsize3){
       fprintf(stderr,
               "ERROR : wsq_encode_1 : problem w/quantization block sizes\n");
+      end_scratch_wsq(scratch);
       return(-11);
    }
 
@@ -150,13 +182,13 @@ int wsq_encode_mem(unsigned char *odata,
 
    /* Add a Start Of Image (SOI) marker to the WSQ buffer. */
    if((ret = putc_ushort(SOI_WSQ, odata, wsq_alloc, olen))){
-      free(qdata);
+      end_scratch_wsq(scratch);
       return(ret);
    }
 
    if((ret = putc_nistcom_wsq(comment_text, w, h, d, ppi, 1 /* lossy */,
                              r_bitrate, odata, wsq_alloc, olen))){
-      free(qdata);
+      end_scratch_wsq(scratch);
       return(ret);
    }
 
@@ -164,464 +196,489 @@ int wsq_encode_mem(unsigned char *odata,
    if((ret = putc_transform_table(lofilt, MAX_LOFILT,
                                  hifilt, MAX_HIFILT,
                                  odata, wsq_alloc, olen))){
-      free(qdata);
+      end_scratch_wsq(scratch);
       return(ret);
    }
 
    /* Store the quantization parameters to the WSQ buffer. */
    if((ret = putc_quantization_table(&context->quant_vals,
                                     odata, wsq_alloc, olen))){
-      free(qdata);
+      end_scratch_wsq(scratch);
       return(ret);
    }
 
    /* Store a frame header to the WSQ buffer. */
    if((ret = putc_frame_header_wsq(w, h, m_shift, r_scale,
                               odata, wsq_alloc, olen))){
-      free(qdata);
+      end_scratch_wsq(scratch);
       return(ret);
    }
 
 
-   /* Allocate a temporary buffer for holding compressed block data.    */
-   /* This buffer is allocated to the size of the original input image, */
-   /* and it is "assumed" that the compressed blocks will not exceed    */
-   /* this buffer size.                                                 */
-   huff_buf = (unsigned char *)malloc(num_pix);
-   if(huff_buf == (unsigned char *)NULL) {
-      free(qdata);
-      fprintf(stderr, "ERROR : wsq_encode_1 : malloc : huff_buf\n");
-      return(-13);
-   }
+   /* Huffman code the three blocks of the quantized image. */
+   qsizes[0] = qsize1;
+   qsizes[1] = qsize2;
+   qsizes[2] = qsize3;
+   ret = huffman_encode_blocks_wsq(odata, wsq_alloc, olen, qdata, qsizes,
+                                   context->threads, scratch);
 
-   /******************/
-   /* ENCODE Block 1 */
-   /******************/
-   /* Compute Huffman table for Block 1. */
-   if((ret = gen_hufftable_wsq(&hufftable, &huffbits, &huffvalues,
-                              qdata, &qsize1, 1))){
-      free(qdata);
-      free(huff_buf);
+   /* Done with quantized image buffer. */
+   end_scratch_wsq(scratch);
+   if(ret)
       return(ret);
-   }
 
-   /* Store Huffman table for Block 1 to WSQ buffer. */
-   if((ret = putc_huffman_table(DHT_WSQ, 0, huffbits, huffvalues,
-                               odata, wsq_alloc, olen))){
-      free(qdata);
-      free(huff_buf);
-      free(huffbits);
-      free(huffvalues);
-      free(hufftable);
+   /* Add a End Of Image (EOI) marker to the WSQ buffer. */
+   if((ret = putc_ushort(EOI_WSQ, odata, wsq_alloc, olen))){
       return(ret);
    }
-   free(huffbits);
-   free(huffvalues);
 
+   /* Return normally. */
+   return(0);
+}
 
-   /* Compress Block 1 data. */
-   if((ret = compress_block(huff_buf, &hsize1, qdata, qsize1,
-                           MAX_HUFFCOEFF, MAX_HUFFZRUN, hufftable))){
-      free(qdata);
-      free(huff_buf);
-      free(hufftable);
-      return(ret);
-   }
-   /* Done with current Huffman table. */
-   free(hufftable);
+/************************************************************************/
+/* WSQ encodes an image pixmap, on the worker threads of the context,  */
+/* and on the priority lane for contexts with WSQ_PRIORITY_HIGH, see    */
+/* sched.c.                                                             */
+/************************************************************************/
+int wsq_encode_mem(unsigned char *odata, int *olen, unsigned char *idata,
+                   int w, int h, int d, int ppi, WSQContext *context)
+{
+   int ret;
+   WSQ_POOL *prev;        /* pool bound before the call */
 
-   /* Accumulate number of bytes compressed. */
-   hsize = hsize1;
+   if(context->priority)
+      enter_lane_wsq(context->threads);
+   prev = enter_pool_wsq(&context->pool, context->threads);
+   ret = encode_image_wsq(odata, olen, idata, w, h, d, ppi, context);
+   leave_pool_wsq(prev);
+   if(context->priority)
+      leave_lane_wsq(context->threads);
 
-   /* Store Block 1's header to WSQ buffer. */
-   if((ret = putc_block_header(0, odata, wsq_alloc, olen))){
-      free(qdata);
-      free(huff_buf);
-      return(ret);
-   }
+   return(ret);
+}
 
-   /* Store Block 1's compressed data to WSQ buffer. */
-   if((ret = putc_bytes(huff_buf, hsize1, odata, wsq_alloc, olen))){
-      free(qdata);
-      free(huff_buf);
-      return(ret);
-   }
+/*****************************************************************/
+/* Job tokenizing a block and counting its huffman values.       */
+/*****************************************************************/
+static void count_block_job(void *arg)
+{
+   HUFF_BLOCK_WSQ *block;
+
+   block = (HUFF_BLOCK_WSQ *)arg;
+   if((block->ret = tokenize_block(block->tokens, &block->num_tokens,
+                                   block->sip, block->sip_siz,
+                                   MAX_HUFFCOEFF, MAX_HUFFZRUN)))
+      return;
+   count_block(block->counts, MAX_HUFFCOUNTS_WSQ, block->tokens,
+               block->num_tokens);
+}
 
-   /******************/
-   /* ENCODE Block 2 */
-   /******************/
-   /* Compute  Huffman table for Blocks 2 & 3. */
-   block_sizes[0] = qsize2;
-   block_sizes[1] = qsize3;
-   if((ret = gen_hufftable_wsq(&hufftable, &huffbits, &huffvalues,
-                          qdata+qsize1, block_sizes, 2))){
-      free(qdata);
-      free(huff_buf);
-      return(ret);
-   }
+/*****************************************************************/
+/* Job compressing a tokenized block into its own buffer.        */
+/*****************************************************************/
+static void compress_block_job(void *arg)
+{
+   HUFF_BLOCK_WSQ *block;
 
-   /* Store Huffman table for Blocks 2 & 3 to WSQ buffer. */
-   if((ret = putc_huffman_table(DHT_WSQ, 1, huffbits, huffvalues,
-                               odata, wsq_alloc, olen))){
-      free(qdata);
-      free(huff_buf);
-      free(huffbits);
-      free(huffvalues);
-      free(hufftable);
-      return(ret);
-   }
-   free(huffbits);
-   free(huffvalues);
-
-   /* Compress Block 2 data. */
-   if((ret = compress_block(huff_buf, &hsize2, qdata+qsize1, qsize2,
-                           MAX_HUFFCOEFF, MAX_HUFFZRUN, hufftable))){
-      free(qdata);
-      free(huff_buf);
-      free(hufftable);
-      return(ret);
-   }
+   block = (HUFF_BLOCK_WSQ *)arg;
+   block->ret = compress_block(block->outbuf, &block->bytes, block->tokens,
+                               block->num_tokens, block->hufftable);
+}
 
-   /* Accumulate number of bytes compressed. */
-   hsize += hsize2;
+/*****************************************************************/
+/* Routine returning the most bytes a block can be compressed    */
+/* to: its exact number of coded bits, doubled for zero stuffing.*/
+/*****************************************************************/
+static int huff_block_bound_wsq(int *counts, HUFFCODE *codes)
+{
+   int i;
+   double bits;
+   HUFF_ENCODER encoder;
 
-   /* Store Block 2's header to WSQ buffer. */
-   if((ret = putc_block_header(1, odata, wsq_alloc, olen))){
-      free(qdata);
-      free(huff_buf);
-      free(hufftable);
-      return(ret);
-   }
+   build_huff_encoder_wsq(&encoder, codes);
+   bits = 0.0;
+   for(i = 0; i < MAX_HUFFCOUNTS_WSQ; i++)
+      bits += (double)counts[i] * encoder.append[i].size;
 
-   /* Store Block 2's compressed data to WSQ buffer. */
-   if((ret = putc_bytes(huff_buf, hsize2, odata, wsq_alloc, olen))){
-      free(qdata);
-      free(huff_buf);
-      free(hufftable);
-      return(ret);
-   }
+   return(2 * (int)((bits + 7.0) / 8.0));
+}
 
-   /******************/
-   /* ENCODE Block 3 */
-   /******************/
-   /* Compress Block 3 data. */
-   if((ret = compress_block(huff_buf, &hsize3, qdata+qsize1+qsize2, qsize3,
-                           MAX_HUFFCOEFF, MAX_HUFFZRUN, hufftable))){
-      free(qdata);
-      free(huff_buf);
-      free(hufftable);
-      return(ret);
+/*****************************************************************/
+/* Routine to huffman code the three blocks of a quantized image */
+/* and store their tables, headers and data to the WSQ buffer.   */
+/* Block 1 has its own table, blocks 2 and 3 share one.  Blocks  */
+/* are tokenized and counted, then compressed into private       */
+/* buffers, as independent jobs run on up to nthreads threads;   */
+/* the output does not depend on the number of threads.          */
+/*****************************************************************/
+int huffman_encode_blocks_wsq(
+   unsigned char *odata,  /* WSQ output buffer */
+   const int oalloc,      /* allocated size of output buffer */
+   int *olen,             /* bytes stored in output buffer */
+   short *qdata,          /* quantized image */
+   const int *qsizes,     /* sizes of the three quantized blocks */
+   const int nthreads,    /* most threads to use */
+   WSQ_SCRATCH *scratch)  /* working memory */
+{
+   int ret, i, j;
+   int qsize, bufsize;
+   unsigned int *tokens;         /* tokenized quantized blocks */
+   unsigned char *huff_buf;      /* huffman encoded blocks */
+   HUFF_TABLE_WSQ tables[2];     /* huffman tables */
+   HUFF_BLOCK_WSQ blocks[3];
+
+   memset(blocks, 0, sizeof(blocks));
+   qsize = qsizes[0] + qsizes[1] + qsizes[2];
+   tokens = (unsigned int *)alloc_scratch_wsq(scratch,
+                                              qsize * sizeof(unsigned int));
+   if(tokens == (unsigned int *)NULL) {
+      fprintf(stderr, "ERROR : huffman_encode_blocks_wsq : malloc : tokens\n");
+      return(-13);
    }
-   /* Done with current Huffman table. */
-   free(hufftable);
 
-   /* Done with quantized image buffer. */
-   free(qdata);
-
-   /* Accumulate number of bytes compressed. */
-   hsize += hsize3;
-
-   /* Store Block 3's header to WSQ buffer. */
-   if((ret = putc_block_header(1, odata, wsq_alloc, olen))){
-      free(huff_buf);
-      return(ret);
+   /* Tokenize and count the three blocks, each in a single pass. */
+   qsize = 0;
+   for(i = 0; i < 3; i++) {
+      blocks[i].sip = qdata + qsize;
+      blocks[i].sip_siz = qsizes[i];
+      blocks[i].tokens = tokens + qsize;
+      qsize += qsizes[i];
    }
+   run_jobs_wsq(count_block_job, blocks, sizeof(HUFF_BLOCK_WSQ), 3, nthreads);
+   for(i = 0; i < 3; i++)
+      if(blocks[i].ret)
+         return(blocks[i].ret);
 
-   /* Store Block 3's compressed data to WSQ buffer. */
-   if((ret = putc_bytes(huff_buf, hsize3, odata, wsq_alloc, olen))){
-      free(huff_buf);
+   /* Compute Huffman table for Block 1, then for Blocks 2 & 3. */
+   if((ret = gen_hufftable_wsq(&tables[0], blocks[0].counts)))
+      return(ret);
+   for(j = 0; j < MAX_HUFFCOUNTS_WSQ; j++)
+      blocks[1].counts[j] += blocks[2].counts[j];
+   if((ret = gen_hufftable_wsq(&tables[1], blocks[1].counts)))
       return(ret);
+   blocks[0].hufftable = tables[0].codes;
+   blocks[1].hufftable = tables[1].codes;
+   blocks[2].hufftable = tables[1].codes;
+
+   /* Give each block a private part of the compressed block buffer, */
+   /* sized from its counts.                                         */
+   for(j = 0; j < MAX_HUFFCOUNTS_WSQ; j++)
+      blocks[1].counts[j] -= blocks[2].counts[j];
+   bufsize = 0;
+   for(i = 0; i < 3; i++)
+      bufsize += huff_block_bound_wsq(blocks[i].counts, blocks[i].hufftable);
+   huff_buf = (unsigned char *)alloc_scratch_wsq(scratch, bufsize);
+   if(huff_buf == (unsigned char *)NULL) {
+      fprintf(stderr, "ERROR : huffman_encode_blocks_wsq : malloc : huff_buf\n");
+      return(-13);
+   }
+   bufsize = 0;
+   for(i = 0; i < 3; i++) {
+      blocks[i].outbuf = huff_buf + bufsize;
+      bufsize += huff_block_bound_wsq(blocks[i].counts, blocks[i].hufftable);
    }
 
-   /* Done with huffman compressing blocks, so done with buffer. */
-   free(huff_buf);
+   /* Compress the three blocks. */
+   run_jobs_wsq(compress_block_job, blocks, sizeof(HUFF_BLOCK_WSQ), 3,
+                nthreads);
 
-   /* Add a End Of Image (EOI) marker to the WSQ buffer. */
-   if((ret = putc_ushort(EOI_WSQ, odata, wsq_alloc, olen))){
-      return(ret);
+   /* Store the tables, headers and data in order to the WSQ buffer. */
+   ret = 0;
+   for(i = 0; i < 3 && ret == 0; i++) {
+      if(i < 2 && (ret = putc_huffman_table(DHT_WSQ, i, tables[i].bits,
+                                            tables[i].values, odata, oalloc,
+                                            olen)))
+         break;
+      if((ret = blocks[i].ret))
+         break;
+      if((ret = putc_block_header(i ? 1 : 0, odata, oalloc, olen)))
+         break;
+      ret = putc_bytes(blocks[i].outbuf, blocks[i].bytes, odata, oalloc, olen);
    }
 
-   /* Return normally. */
-   return(0);
+   return(ret);
 }
 
 /*************************************************************/
 /* Generate a Huffman code table for a quantized data block. */
+/* The steps of find_huff_sizes, find_num_huff_sizes,        */
+/* sort_code_sizes and build_huffcode_table, on the arrays   */
+/* of the table rather than allocated ones.                  */
 /*************************************************************/
-int gen_hufftable_wsq(HUFFCODE **ohufftable, unsigned char **ohuffbits,
-               unsigned char **ohuffvalues, short *sip, const int *block_sizes,
-               const int num_sizes)
+int gen_hufftable_wsq(HUFF_TABLE_WSQ *table, int *huffcounts)
 {
-   int i, j;
-   int ret;
+   int ret, i, n, size;
    int adjust;          /* tells if codesize is greater than MAX_HUFFBITS */
-   int *codesize;       /* code sizes to use */
    int last_size;       /* last huffvalue */
-   unsigned char *huffbits;     /* huffbits values */
-   unsigned char *huffvalues;   /* huffvalues */
-   int *huffcounts;     /* counts for each huffman category */
-   int *huffcounts2;    /* counts for each huffman category */
-   HUFFCODE *hufftable1, *hufftable2;  /* hufftables */
-
-   if((ret = count_block(&huffcounts, MAX_HUFFCOUNTS_WSQ,
-			 sip, block_sizes[0], MAX_HUFFCOEFF, MAX_HUFFZRUN)))
-      return(ret);
-
-   for(i = 1; i < num_sizes; i++) {
-      if((ret = count_block(&huffcounts2, MAX_HUFFCOUNTS_WSQ,
-                           sip+block_sizes[i-1], block_sizes[i],
-                           MAX_HUFFCOEFF, MAX_HUFFZRUN)))
-         return(ret);
-
-      for(j = 0; j < MAX_HUFFCOUNTS_WSQ; j++)
-         huffcounts[j] += huffcounts2[j];
+   int value1, value2;  /* least frequent values */
+   int freq[MAX_HUFFCOUNTS_WSQ+1];     /* counts merged as codes are sized */
+   int codesize[MAX_HUFFCOUNTS_WSQ+1]; /* code sizes to use */
+   int others[MAX_HUFFCOUNTS_WSQ+1];   /* values merged with each value */
+   HUFFCODE sizes[MAX_HUFFCOUNTS_WSQ+1]; /* codes in code order */
+
+   /* Size the codes by merging the least frequent values. */
+   memcpy(freq, huffcounts, sizeof(freq));
+   for(i = 0; i <= MAX_HUFFCOUNTS_WSQ; i++) {
+      codesize[i] = 0;
+      others[i] = -1;
+   }
+   while(1) {
+      find_least_freq(&value1, &value2, freq, MAX_HUFFCOUNTS_WSQ);
+      if(value2 == -1)
+         break;
+
+      freq[value1] += freq[value2];
+      freq[value2] = 0;
+
+      codesize[value1]++;
+      while(others[value1] != -1) {
+         value1 = others[value1];
+         codesize[value1]++;
+      }
+      others[value1] = value2;
+      codesize[value2]++;
 
-      free(huffcounts2);
+      while(others[value2] != -1) {
+         value2 = others[value2];
+         codesize[value2]++;
+      }
    }
 
-   if((ret = find_huff_sizes(&codesize, huffcounts, MAX_HUFFCOUNTS_WSQ))){
-      free(huffcounts);
-      return(ret);
+   /* Count the codes of each size, none longer than MAX_HUFFBITS. */
+   memset(table->bits, 0, sizeof(table->bits));
+   adjust = 0;
+   for(i = 0; i < MAX_HUFFCOUNTS_WSQ; i++) {
+      if(codesize[i] != 0)
+         table->bits[codesize[i] - 1]++;
+      if(codesize[i] > MAX_HUFFBITS)
+         adjust = 1;
    }
-   free(huffcounts);
+   if(adjust && (ret = sort_huffbits(table->bits)))
+      return(ret);
 
-   if((ret = find_num_huff_sizes(&huffbits, &adjust, codesize,
-                                MAX_HUFFCOUNTS_WSQ))){
-      free(codesize);
+   /* Order the values by code size. */
+   memset(table->values, 0, sizeof(table->values));
+   n = 0;
+   for(size = 1; size <= (MAX_HUFFBITS<<1); size++)
+      for(i = 0; i < MAX_HUFFCOUNTS_WSQ; i++)
+         if(codesize[i] == size)
+            table->values[n++] = i;
+
+   build_huffsizes_wsq(sizes, &last_size, table->bits);
+   build_huffcodes(sizes);
+   if((ret = check_huffcodes_wsq(sizes, last_size))){
+      fprintf(stderr, "ERROR: This huffcode warning is an error ");
+      fprintf(stderr, "for the encoder.\n");
       return(ret);
    }
 
-   if(adjust){
-      if((ret = sort_huffbits(huffbits))){
-         free(codesize);
-         free(huffbits);
-         return(ret);
-      }
+   /* Codes by huffman value. */
+   memset(table->codes, 0, sizeof(table->codes));
+   for(i = 0; i < last_size; i++) {
+      table->codes[table->values[i]].code = sizes[i].code;
+      table->codes[table->values[i]].size = sizes[i].size;
    }
 
-   if((ret = sort_code_sizes(&huffvalues, codesize, MAX_HUFFCOUNTS_WSQ))){
-      free(codesize);
-      free(huffbits);
-      return(ret);
+   return(0);
+}
+
+/*****************************************************************/
+/* Routine to build the table appending each token as a single   */
+/* codeword, shifted to make room for its escape payload.        */
+/*****************************************************************/
+void build_huff_encoder_wsq(
+   HUFF_ENCODER *encoder, /* returned append table */
+   HUFFCODE *codes)       /* huffman code table */
+{
+   int i, extra;
+
+   for(i = 0; i < MAX_HUFFCOUNTS_WSQ; i++) {
+      if(i == 101 || i == 102 || i == 105)
+         extra = 8;   /* 8bit escapes */
+      else if(i == 103 || i == 104 || i == 106)
+         extra = 16;  /* 16bit escapes */
+      else
+         extra = 0;
+      encoder->append[i].code = codes[i].code << extra;
+      encoder->append[i].size = codes[i].size + extra;
    }
-   free(codesize);
+}
 
-   if((ret = build_huffsizes(&hufftable1, &last_size,
-                              huffbits, MAX_HUFFCOUNTS_WSQ))){
-      free(huffbits);
-      free(huffvalues);
-      return(ret);
+/*****************************************************************/
+/* Routine to start writing huffman coded data to outbuf.        */
+/*****************************************************************/
+void init_bit_writer_wsq(
+   BIT_WRITER_WSQ *writer, /* writer to initialize */
+   unsigned char *outbuf)  /* compressed output buffer */
+{
+   writer->outbuf = outbuf;
+   writer->bitbuf = 0;
+   writer->bits = 0;
+}
+
+/*****************************************************************/
+/* Writes a byte, stuffing a zero byte after a 0xFF.             */
+/*****************************************************************/
+static INLINE void put_byte_wsq(BIT_WRITER_WSQ *writer,
+                                const unsigned char byte)
+{
+   *writer->outbuf++ = byte;
+   if(byte == 0xFF)
+      *writer->outbuf++ = 0;
+}
+
+/*****************************************************************/
+/* Writes 4 bytes, with a single test for any 0xFF among them.   */
+/*****************************************************************/
+static INLINE void put_word_wsq(BIT_WRITER_WSQ *writer,
+                                const unsigned int word)
+{
+   if(((~word - 0x01010101) & word & 0x80808080) == 0) {
+      writer->outbuf[0] = (unsigned char)(word >> 24);
+      writer->outbuf[1] = (unsigned char)(word >> 16);
+      writer->outbuf[2] = (unsigned char)(word >> 8);
+      writer->outbuf[3] = (unsigned char)word;
+      writer->outbuf += 4;
+   }
+   else {
+      put_byte_wsq(writer, (unsigned char)(word >> 24));
+      put_byte_wsq(writer, (unsigned char)(word >> 16));
+      put_byte_wsq(writer, (unsigned char)(word >> 8));
+      put_byte_wsq(writer, (unsigned char)word);
    }
+}
 
-   build_huffcodes(hufftable1);
-   if((ret = check_huffcodes_wsq(hufftable1, last_size))){
-      fprintf(stderr, "ERROR: This huffcode warning is an error ");
-      fprintf(stderr, "for the encoder.\n");
-      free(huffbits);
-      free(huffvalues);
-      free(hufftable1);
-      return(ret);
+/*****************************************************************/
+/* Appends size bits of code, up to 32, writing out whole words. */
+/*****************************************************************/
+static INLINE void put_bits_wsq(BIT_WRITER_WSQ *writer,
+                                const unsigned int code, const int size)
+{
+   writer->bitbuf = (writer->bitbuf << size) | code;
+   writer->bits += size;
+   if(writer->bits >= 32) {
+      writer->bits -= 32;
+      put_word_wsq(writer, (unsigned int)(writer->bitbuf >> writer->bits));
    }
+}
 
-   if((ret = build_huffcode_table(&hufftable2, hufftable1, last_size,
-                                 huffvalues, MAX_HUFFCOUNTS_WSQ))){
-      free(huffbits);
-      free(huffvalues);
-      free(hufftable1);
-      return(ret);
+/*****************************************************************/
+/* Routine to write out the pending bits, padding the last byte  */
+/* with ones.  Returns the end of the written data.              */
+/*****************************************************************/
+unsigned char *flush_bit_writer_wsq(BIT_WRITER_WSQ *writer)
+{
+   int pad;
+
+   pad = (8 - (writer->bits & 7)) & 7;
+   writer->bitbuf = (writer->bitbuf << pad) | ((1 << pad) - 1);
+   writer->bits += pad;
+   while(writer->bits > 0) {
+      writer->bits -= 8;
+      put_byte_wsq(writer, (unsigned char)(writer->bitbuf >> writer->bits));
    }
 
-   free(hufftable1);
+   return(writer->outbuf);
+}
 
-   *ohuffbits = huffbits;
-   *ohuffvalues = huffvalues;
-   *ohufftable = hufftable2;
+/*****************************************************************/
+/* Returns the token of a nonzero coefficient.                   */
+/*****************************************************************/
+static INLINE unsigned int coeff_token_wsq(const short pix,
+                                 const int MaxCoeff, const int LoMaxCoeff)
+{
+   if(pix > MaxCoeff) {
+      if(pix > 255)
+         return(WSQ_TOKEN(103, pix));  /* 16bit pos esc */
+      return(WSQ_TOKEN(101, pix));     /* 8bit pos esc */
+   }
+   if(pix < LoMaxCoeff) {
+      if(pix < -255)
+         return(WSQ_TOKEN(104, -pix)); /* 16bit neg esc */
+      return(WSQ_TOKEN(102, -pix));    /* 8bit neg esc */
+   }
+   return(WSQ_TOKEN(pix+180, 0));      /* within table */
+}
 
-   return(0);
+/*****************************************************************/
+/* Returns the token of a zero run of up to 0xFFFF.              */
+/*****************************************************************/
+static INLINE unsigned int zrun_token_wsq(const int rcnt, const int MaxZRun)
+{
+   if(rcnt <= MaxZRun)
+      return(WSQ_TOKEN(rcnt, 0));      /* log zero run length */
+   if(rcnt <= 0xFF)
+      return(WSQ_TOKEN(105, rcnt));    /* 8bit zrun esc */
+   return(WSQ_TOKEN(106, rcnt));       /* 16bit zrun esc */
 }
 
 /*****************************************************************/
-/* Routine "codes" the quantized image using the huffman tables. */
+/* Routine to tokenize a quantized block in a single pass into   */
+/* the coefficients and zero runs shared by count_block and      */
+/* compress_block.  otokens must hold sip_siz tokens.            */
 /*****************************************************************/
-int compress_block(
-   unsigned char *outbuf,       /* compressed output buffer            */
-   int   *obytes,       /* number of compressed bytes          */
-   short *sip,          /* quantized image                     */
-   const int sip_siz,   /* size of quantized image to compress */
-   const int MaxCoeff,  /* Maximum values for coefficients     */
-   const int MaxZRun,   /* Maximum zero runs                   */
-   HUFFCODE *codes)     /* huffman code table                  */
+int tokenize_block(
+   unsigned int *otokens, /* returned tokens                      */
+   int *onum_tokens,      /* returned number of tokens            */
+   short *sip,            /* quantized data                       */
+   const int sip_siz,     /* size of block being compressed       */
+   const int MaxCoeff,    /* maximum values for coefficients      */
+   const int MaxZRun)     /* maximum zero runs                    */
 {
-   unsigned char *optr;
+   unsigned int *tptr;
    int LoMaxCoeff;        /* lower (negative) MaxCoeff limit */
-   short pix;             /* temp pixel pointer */
-   unsigned int rcnt = 0, state;  /* zero run count and if current pixel
-                             is in a zero run or just a coefficient */
-   int cnt;               /* pixel counter */
-   int outbit, bytes;     /* parameters used by write_bits to */
-   unsigned char bits;            /* output the "coded" image to the  */
-                          /* output buffer                    */
+   int cnt, start;        /* pixel counters */
+   int rcnt;              /* zero run count */
 
    LoMaxCoeff = 1 - MaxCoeff;
-   optr = outbuf;
-   outbit = 7;
-   bytes = 0;
-   bits = 0;
-   state = COEFF_CODE;
-   for (cnt = 0; cnt < sip_siz; cnt++) {
-      pix = *(sip + cnt);
-
-      switch (state) {
-
-         case COEFF_CODE:
-            if (pix == 0) {
-               state = RUN_CODE;
-               rcnt = 1;
-               break;
-            }
-            if (pix > MaxCoeff) {
-               if (pix > 255) {
-                  /* 16bit pos esc */
-                  write_bits( &optr, (unsigned short) codes[103].code,
-                              codes[103].size, &outbit, &bits, &bytes );
-                  write_bits( &optr, (unsigned short) pix, 16,
-                              &outbit, &bits, &bytes);
-               }
-               else {
-                  /* 8bit pos esc */
-                  write_bits( &optr, (unsigned short) codes[101].code,
-                              codes[101].size, &outbit, &bits, &bytes );
-                  write_bits( &optr, (unsigned short) pix, 8,
-                              &outbit, &bits, &bytes);
-               }
-            }
-            else if (pix < LoMaxCoeff) {
-               if (pix < -255) {
-                  /* 16bit neg esc */
-                  write_bits( &optr, (unsigned short) codes[104].code,
-                              codes[104].size, &outbit, &bits, &bytes );
-                  write_bits( &optr, (unsigned short) -pix, 16,
-                              &outbit, &bits, &bytes);
-               }
-               else {
-                  /* 8bit neg esc */
-                  write_bits( &optr, (unsigned short) codes[102].code,
-                              codes[102].size, &outbit, &bits, &bytes );
-                  write_bits( &optr, (unsigned short) -pix, 8,
-                              &outbit, &bits, &bytes);
-               }
-            }
-            else {
-               /* within table */
-               write_bits( &optr, (unsigned short) codes[pix+180].code,
-                           codes[pix+180].size, &outbit, &bits, &bytes);
-            }
-            break;
-
-         case RUN_CODE:
-            if (pix == 0  &&  rcnt < 0xFFFF) {
-               ++rcnt;
-               break;
-            }
-            if (rcnt <= MaxZRun) {
-               /* log zero run length */
-               write_bits( &optr, (unsigned short) codes[rcnt].code,
-                           codes[rcnt].size, &outbit, &bits, &bytes );
-            }
-            else if (rcnt <= 0xFF) {
-               /* 8bit zrun esc */
-               write_bits( &optr, (unsigned short) codes[105].code,
-                           codes[105].size, &outbit, &bits, &bytes );
-               write_bits( &optr, (unsigned short) rcnt, 8,
-                           &outbit, &bits, &bytes);
-            }
-            else if (rcnt <= 0xFFFF) {
-               /* 16bit zrun esc */
-               write_bits( &optr, (unsigned short) codes[106].code,
-                           codes[106].size, &outbit, &bits, &bytes );
-               write_bits( &optr, (unsigned short) rcnt, 16,
-                           &outbit, &bits, &bytes);
-            }
-            else {
-               fprintf(stderr,
-                      "ERROR : compress_block : zrun too large.\n");
-               return(-47);
-            }
-
-            if(pix != 0) {
-               if (pix > MaxCoeff) {
-                  /** log current pix **/
-                  if (pix > 255) {
-                     /* 16bit pos esc */
-                     write_bits( &optr, (unsigned short) codes[103].code,
-                                 codes[103].size, &outbit, &bits, &bytes );
-                     write_bits( &optr, (unsigned short) pix, 16,
-                                 &outbit, &bits, &bytes);
-                  }
-                  else {
-                     /* 8bit pos esc */
-                     write_bits( &optr, (unsigned short) codes[101].code,
-                                 codes[101].size, &outbit, &bits, &bytes );
-                     write_bits( &optr, (unsigned short) pix, 8,
-                                 &outbit, &bits, &bytes);
-                  }
-               }
-               else if (pix < LoMaxCoeff) {
-                  if (pix < -255) {
-                     /* 16bit neg esc */
-                     write_bits( &optr, (unsigned short) codes[104].code,
-                                 codes[104].size, &outbit, &bits, &bytes );
-                     write_bits( &optr, (unsigned short) -pix, 16,
-                                 &outbit, &bits, &bytes);
-                  }
-                  else {
-                     /* 8bit neg esc */
-                     write_bits( &optr, (unsigned short) codes[102].code,
-                                 codes[102].size, &outbit, &bits, &bytes );
-                     write_bits( &optr, (unsigned short) -pix, 8,
-                                 &outbit, &bits, &bytes);
-                  }
-               }
-               else {
-                  /* within table */
-                  write_bits( &optr, (unsigned short) codes[pix+180].code,
-                              codes[pix+180].size, &outbit, &bits, &bytes);
-               }
-               state = COEFF_CODE;
-            }
-            else {
-               rcnt = 1;
-               state = RUN_CODE;
-            }
-            break;
-      }
-   }
-   if (state == RUN_CODE) {
-      if (rcnt <= MaxZRun) {
-         write_bits( &optr, (unsigned short) codes[rcnt].code,
-                     codes[rcnt].size, &outbit, &bits, &bytes );
-      }
-      else if (rcnt <= 0xFF) {
-         write_bits( &optr, (unsigned short) codes[105].code,
-                     codes[105].size, &outbit, &bits, &bytes );
-         write_bits( &optr, (unsigned short) rcnt, 8,
-                     &outbit, &bits, &bytes);
-      }
-      else if (rcnt <= 0xFFFF) {
-         write_bits( &optr, (unsigned short) codes[106].code,
-                     codes[106].size, &outbit, &bits, &bytes );
-         write_bits( &optr, (unsigned short) rcnt, 16,
-                     &outbit, &bits, &bytes);
-      }
-      else {
-         fprintf(stderr, "ERROR : compress_block : zrun2 too large.\n");
-         return(-48);
+   tptr = otokens;
+   cnt = 0;
+   while(cnt < sip_siz) {
+      if(sip[cnt] != 0) {
+         *tptr++ = coeff_token_wsq(sip[cnt], MaxCoeff, LoMaxCoeff);
+         cnt++;
+         continue;
       }
+
+      start = cnt;
+      while(cnt < sip_siz && sip[cnt] == 0)
+         cnt++;
+      /* runs are limited to 0xFFFF, longer ones are split */
+      for(rcnt = cnt - start; rcnt > 0xFFFF; rcnt -= 0xFFFF)
+         *tptr++ = zrun_token_wsq(0xFFFF, MaxZRun);
+      *tptr++ = zrun_token_wsq(rcnt, MaxZRun);
    }
 
-   flush_bits( &optr, &outbit, &bits, &bytes);
+   *onum_tokens = (int)(tptr - otokens);
+   return(0);
+}
 
-   *obytes = bytes;
+/*****************************************************************/
+/* Routine "codes" the quantized image using the huffman tables. */
+/*****************************************************************/
+int compress_block(
+   unsigned char *outbuf,   /* compressed output buffer   */
+   int   *obytes,           /* number of compressed bytes */
+   unsigned int *tokens,    /* tokenized quantized image  */
+   const int num_tokens,    /* number of tokens           */
+   HUFFCODE *codes)         /* huffman code table         */
+{
+   int cnt;               /* token counter */
+   HUFF_APPEND *entry;
+   HUFF_ENCODER encoder;  /* codewords shifted for escape payloads */
+   BIT_WRITER_WSQ writer; /* outputs the "coded" image to the buffer */
+
+   build_huff_encoder_wsq(&encoder, codes);
+   init_bit_writer_wsq(&writer, outbuf);
+
+   for(cnt = 0; cnt < num_tokens; cnt++) {
+      entry = encoder.append + WSQ_TOKEN_VAL(tokens[cnt]);
+      put_bits_wsq(&writer, entry->code | WSQ_TOKEN_EXTRA(tokens[cnt]),
+                   entry->size);
+   }
+
+   *obytes = (int)(flush_bit_writer_wsq(&writer) - outbuf);
    return(0);
 }
 
@@ -629,115 +686,19 @@ int compress_block(
 /* This routine counts the number of occurences of each category */
 /* in the huffman coding tables.                                 */
 /*****************************************************************/
-int count_block(
-   int **ocounts,     /* output count for each huffman catetory */
+void count_block(
+   int *counts,       /* output count for each huffman catetory */
    const int max_huffcounts, /* maximum number of counts */
-   short *sip,          /* quantized data */
-   const int sip_siz,   /* size of block being compressed */
-   const int MaxCoeff,  /* maximum values for coefficients */
-   const int MaxZRun)   /* maximum zero runs */
+   unsigned int *tokens,     /* tokenized quantized data */
+   const int num_tokens)     /* number of tokens */
 {
-   int *counts;         /* count for each huffman category */
-   int LoMaxCoeff;        /* lower (negative) MaxCoeff limit */
-   short pix;             /* temp pixel pointer */
-   unsigned int rcnt = 0, state;  /* zero run count and if current pixel
-                             is in a zero run or just a coefficient */
-   int cnt;               /* pixel counter */
+   int cnt;             /* token counter */
 
    /* Ininitalize vector of counts to 0. */
-   counts = (int *)calloc(max_huffcounts+1, sizeof(int));
-   if(counts == (int *)NULL){
-      fprintf(stderr,
-      "ERROR : count_block : calloc : counts\n");
-      return(-48);
-   }
+   memset(counts, 0, (max_huffcounts+1) * sizeof(int));
    /* Set last count to 1. */
    counts[max_huffcounts] = 1;
 
-   LoMaxCoeff = 1 - MaxCoeff;
-   state = COEFF_CODE;
-   for(cnt = 0; cnt < sip_siz; cnt++) {
-      pix = *(sip + cnt);
-      switch(state) {
-
-         case COEFF_CODE:   /* for runs of zeros */
-            if(pix == 0) {
-               state = RUN_CODE;
-               rcnt = 1;
-               break;
-            }
-            if(pix > MaxCoeff) {
-               if(pix > 255)
-                  counts[103]++; /* 16bit pos esc */
-               else
-                  counts[101]++; /* 8bit pos esc */
-            }
-            else if (pix < LoMaxCoeff) {
-               if(pix < -255)
-                  counts[104]++; /* 16bit neg esc */
-               else
-                  counts[102]++; /* 8bit neg esc */
-            }
-            else
-               counts[pix+180]++; /* within table */
-            break;
-
-         case RUN_CODE:  /* get length of zero run */
-            if(pix == 0  &&  rcnt < 0xFFFF) {
-               ++rcnt;
-               break;
-            }
-               /* limit rcnt to avoid EOF problem in bitio.c */
-            if(rcnt <= MaxZRun)
-               counts[rcnt]++;  /** log zero run length **/
-            else if(rcnt <= 0xFF)
-               counts[105]++;
-            else if(rcnt <= 0xFFFF)
-               counts[106]++; /* 16bit zrun esc */
-            else {
-               fprintf(stderr,
-               "ERROR: count_block : Zrun to long in count block.\n");
-               return(-49);
-            }
-
-            if(pix != 0) {
-               if(pix > MaxCoeff) { /** log current pix **/
-                  if(pix > 255)
-                     counts[103]++; /* 16bit pos esc */
-                  else
-                     counts[101]++; /* 8bit pos esc */
-               }
-               else if(pix < LoMaxCoeff) {
-                  if(pix < -255)
-                     counts[104]++; /* 16bit neg esc */
-                  else
-                     counts[102]++; /* 8bit neg esc */
-               }
-               else
-                  counts[pix+180]++; /* within table */
-               state = COEFF_CODE;
-            }
-            else {
-               rcnt = 1;
-               state = RUN_CODE;
-            }
-            break;
-      }
-   }
-   if(state == RUN_CODE){ /** log zero run length **/
-      if(rcnt <= MaxZRun)
-         counts[rcnt]++;
-      else if(rcnt <= 0xFF)
-         counts[105]++;
-      else if(rcnt <= 0xFFFF)
-         counts[106]++; /* 16bit zrun esc */
-      else {
-         fprintf(stderr,
-         "ERROR: count_block : Zrun to long in count block.\n");
-         return(-50);
-      }
-   }
-
-   *ocounts = counts;
-   return(0);
+   for(cnt = 0; cnt < num_tokens; cnt++)
+      counts[WSQ_TOKEN_VAL(tokens[cnt])]++;
 }
@@ -13,11 +13,16 @@
 /* encoder.c */
 int wsq_encode_mem(unsigned char *, int *, unsigned char *, int ,
 				   int, int, int, WSQContext *);
-int gen_hufftable_wsq(HUFFCODE **, unsigned char **, unsigned char **,
-                 short *, const int *, const int);
-int compress_block(unsigned char *, int *, short *,
-                 const int, const int, const int, HUFFCODE *);
-int count_block(int **, const int, short *,
-                 const int, const int, const int);
+int huffman_encode_blocks_wsq(unsigned char *, const int, int *, short *,
+                 const int *, const int, WSQ_SCRATCH *);
+int gen_hufftable_wsq(HUFF_TABLE_WSQ *, int *);
+void build_huff_encoder_wsq(HUFF_ENCODER *, HUFFCODE *);
+void init_bit_writer_wsq(BIT_WRITER_WSQ *, unsigned char *);
+unsigned char *flush_bit_writer_wsq(BIT_WRITER_WSQ *);
+int tokenize_block(unsigned int *, int *, short *, const int,
+                 const int, const int);
+int compress_block(unsigned char *, int *, unsigned int *, const int,
+                 HUFFCODE *);
+void count_block(int *, const int, unsigned int *, const int);
 
 #endif /* ENCODER_H_ */
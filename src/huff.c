@@ -34,9 +34,12 @@ identified are necessarily the best available for the purpose.
 
       ROUTINES:
 #cat: check_huffcodes_wsq - Checks for an all 1's code in the code table.
+#cat: build_huffsizes_wsq - Defines the code sizes of a huffman table,
+#cat:                   as build_huffsizes, into a caller's table.
 
 ***********************************************************************/
 
+#include <string.h>
 #include "huff.h"
 
 int check_huffcodes_wsq(HUFFCODE *hufftable, int last_size)
@@ -58,3 +61,27 @@ int check_huffcodes_wsq(HUFFCODE *hufftable, int last_size)
    }
    return(0);
 }
+
+/*****************************************************************/
+/* Routine defining the code sizes of a huffman table in code    */
+/* order, as build_huffsizes does, into hufftable rather than an */
+/* allocated table of MAX_HUFFCOUNTS_WSQ+1 codes.                */
+/*****************************************************************/
+void build_huffsizes_wsq(HUFFCODE *hufftable, int *last_size,
+                         unsigned char *huffbits)
+{
+   int code_size;               /*code sizes*/
+   int number_of_codes;         /*the number codes for a given code size*/
+
+   memset(hufftable, 0, (MAX_HUFFCOUNTS_WSQ+1) * sizeof(HUFFCODE));
+   *last_size = 0;
+
+   for(code_size = 1; code_size <= MAX_HUFFBITS; code_size++) {
+      for(number_of_codes = 1; number_of_codes <= huffbits[code_size - 1] &&
+          *last_size < MAX_HUFFCOUNTS_WSQ; number_of_codes++) {
+         (hufftable + *last_size)->size = code_size;
+         (*last_size)++;
+      }
+   }
+   (hufftable + *last_size)->size = 0;
+}
@@ -12,5 +12,6 @@
 
 /* huff.c */
 int check_huffcodes_wsq(HUFFCODE *, int);
+void build_huffsizes_wsq(HUFFCODE *, int *, unsigned char *);
 
 #endif /* HUFF_H_ */
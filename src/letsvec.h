@@ -0,0 +1,205 @@
+/*
+ * letsvec.h
+ *
+ *  Vector kernels of the wavelet filter runs, instantiated by
+ *  wavelet.c once per instruction set.  The including file defines
+ *
+ *     VEC, VLEN            vector type and its floats
+ *     VLOAD, VSTORE        unaligned load and store
+ *     VADD, VMUL, VXOR     lane-wise operations
+ *     VMADD(a, b, c)       c + a*b, rounded once only where fused
+ *     VSET1, VZERO         broadcast, all zeros
+ *     VSTORE2(p, e, o)     stores e[0] o[0] e[1] o[1] ... at p
+ *     SFX(name)            name with the instruction set suffix
+ *     VTARGET              attributes of the generated functions
+ *
+ *  Each kernel computes the outputs of a run a vector at a time and
+ *  returns how many it computed; the caller finishes the remainder.
+ *  The fixed size kernels are the generic ones with the term count
+ *  a constant, so the compiler unrolls them; they are generated for
+ *  the runs of the standard 9/7 and 8/8 banks.
+ *
+ *  Folded runs are only planned when results need not match the
+ *  scalar routines, so a file defining LETS_FOLD_ONLY instantiates
+ *  just their kernels, free to fuse the multiply-adds.
+ */
+
+/* Folded terms: np pairs sharing a coefficient, then ns singles. */
+static INLINE VTARGET VEC SFX(lets_fold)(const LETS_ARGS *a, const int np,
+                                         const int ns, const int j)
+{
+   VEC acc, x;
+   int k;
+
+   acc = VZERO();
+   for(k = 0; k < np; k++) {
+      x = VADD(VLOAD(a->base[2*k] + j),
+               VXOR(VLOAD(a->base[2*k+1] + j), VSET1(a->mask[k])));
+      acc = VMADD(x, VSET1(a->coef[k]), acc);
+   }
+   for(k = 0; k < ns; k++)
+      acc = VMADD(VLOAD(a->base[2*np+k] + j), VSET1(a->coef[np+k]), acc);
+
+   return(acc);
+}
+
+#define LETS_FOLD_KERNEL(name, np, ns) \
+static VTARGET int SFX(name)(float *out, const LETS_ARGS *a, \
+                             const int count) \
+{ \
+   int j; \
+   for(j = 0; j + VLEN <= count; j += VLEN) \
+      VSTORE(out + j, SFX(lets_fold)(a, np, ns, j)); \
+   return(j); \
+}
+
+#define LETS_FOLD_PAIR(name, enp, ens, onp, ons) \
+static VTARGET int SFX(name)(float *out, const LETS_ARGS *e, \
+                             const LETS_ARGS *o, const int count) \
+{ \
+   int j; \
+   for(j = 0; j + VLEN <= count; j += VLEN) \
+      VSTORE2(out + 2*j, SFX(lets_fold)(e, enp, ens, j), \
+                         SFX(lets_fold)(o, onp, ons, j)); \
+   return(j); \
+}
+
+LETS_FOLD_KERNEL(lets_fold_n, a->npairs, a->nsingle)
+LETS_FOLD_KERNEL(lets_fold_3_1, 3, 1)
+LETS_FOLD_KERNEL(lets_fold_4_0, 4, 0)
+LETS_FOLD_KERNEL(lets_fold_4_1, 4, 1)
+LETS_FOLD_PAIR(lets_fold_pair_n, e->npairs, e->nsingle, o->npairs, o->nsingle)
+LETS_FOLD_PAIR(lets_fold_pair_31_41, 3, 1, 4, 1)
+LETS_FOLD_PAIR(lets_fold_pair_41_31, 4, 1, 3, 1)
+LETS_FOLD_PAIR(lets_fold_pair_40_40, 4, 0, 4, 0)
+
+/*****************************************************************/
+/* Routine to pick the kernel of a folded run: a fixed size one  */
+/* for the runs of a standard bank, the generic one otherwise.   */
+/*****************************************************************/
+static LETS_RUN_FN SFX(lets_fold_kernel)(const LETS_ARGS *a, const int bank)
+{
+   if(bank != WSQ_BANK_OTHER) {
+      if(a->npairs == 3 && a->nsingle == 1)
+         return(SFX(lets_fold_3_1));
+      if(a->npairs == 4 && a->nsingle == 0)
+         return(SFX(lets_fold_4_0));
+      if(a->npairs == 4 && a->nsingle == 1)
+         return(SFX(lets_fold_4_1));
+   }
+   return(SFX(lets_fold_n));
+}
+
+/*****************************************************************/
+/* Routine to pick the kernel of a pair of even and odd folded   */
+/* runs.                                                         */
+/*****************************************************************/
+static LETS_PAIR_FN SFX(lets_fold_pair_kernel)(const LETS_ARGS *e,
+                                               const LETS_ARGS *o,
+                                               const int bank)
+{
+   if(bank != WSQ_BANK_OTHER) {
+      if(e->npairs == 3 && e->nsingle == 1 &&
+         o->npairs == 4 && o->nsingle == 1)
+         return(SFX(lets_fold_pair_31_41));
+      if(e->npairs == 4 && e->nsingle == 1 &&
+         o->npairs == 3 && o->nsingle == 1)
+         return(SFX(lets_fold_pair_41_31));
+      if(e->npairs == 4 && e->nsingle == 0 &&
+         o->npairs == 4 && o->nsingle == 0)
+         return(SFX(lets_fold_pair_40_40));
+   }
+   return(SFX(lets_fold_pair_n));
+}
+
+#if !defined(LETS_FOLD_ONLY)
+/* Exact terms: added in order onto the first product, or onto */
+/* +0.0 for outputs the scalar routines zero first.            */
+static INLINE VTARGET VEC SFX(lets_sum)(const LETS_ARGS *a, const int n,
+                                        const int j)
+{
+   VEC acc;
+   int k;
+
+   acc = VMUL(VLOAD(a->base[0] + j), VSET1(a->coef[0]));
+   if(a->zero)
+      acc = VADD(VZERO(), acc);
+   for(k = 1; k < n; k++)
+      acc = VADD(acc, VMUL(VLOAD(a->base[k] + j), VSET1(a->coef[k])));
+
+   return(acc);
+}
+
+#define LETS_SUM_KERNEL(name, n) \
+static VTARGET int SFX(name)(float *out, const LETS_ARGS *a, \
+                             const int count) \
+{ \
+   int j; \
+   for(j = 0; j + VLEN <= count; j += VLEN) \
+      VSTORE(out + j, SFX(lets_sum)(a, n, j)); \
+   return(j); \
+}
+
+#define LETS_SUM_PAIR(name, en, on) \
+static VTARGET int SFX(name)(float *out, const LETS_ARGS *e, \
+                             const LETS_ARGS *o, const int count) \
+{ \
+   int j; \
+   for(j = 0; j + VLEN <= count; j += VLEN) \
+      VSTORE2(out + 2*j, SFX(lets_sum)(e, en, j), SFX(lets_sum)(o, on, j)); \
+   return(j); \
+}
+
+LETS_SUM_KERNEL(lets_sum_n, a->nterms)
+LETS_SUM_KERNEL(lets_sum_7, 7)
+LETS_SUM_KERNEL(lets_sum_8, 8)
+LETS_SUM_KERNEL(lets_sum_9, 9)
+LETS_SUM_PAIR(lets_sum_pair_n, e->nterms, o->nterms)
+LETS_SUM_PAIR(lets_sum_pair_7_9, 7, 9)
+LETS_SUM_PAIR(lets_sum_pair_9_7, 9, 7)
+LETS_SUM_PAIR(lets_sum_pair_8_8, 8, 8)
+
+/*****************************************************************/
+/* Routine to pick the kernel of a run: a fixed size one for the */
+/* runs of a standard bank, the generic one otherwise.           */
+/*****************************************************************/
+static LETS_RUN_FN SFX(lets_run_kernel)(const LETS_ARGS *a, const int bank)
+{
+   if(a->fold)
+      return(SFX(lets_fold_kernel)(a, bank));
+   if(bank != WSQ_BANK_OTHER) {
+      if(a->nterms == 7)
+         return(SFX(lets_sum_7));
+      if(a->nterms == 8)
+         return(SFX(lets_sum_8));
+      if(a->nterms == 9)
+         return(SFX(lets_sum_9));
+   }
+   return(SFX(lets_sum_n));
+}
+
+/*****************************************************************/
+/* Routine to pick the kernel of a pair of even and odd runs.    */
+/*****************************************************************/
+static LETS_PAIR_FN SFX(lets_pair_kernel)(const LETS_ARGS *e,
+                                          const LETS_ARGS *o, const int bank)
+{
+   if(e->fold)
+      return(SFX(lets_fold_pair_kernel)(e, o, bank));
+   if(bank != WSQ_BANK_OTHER) {
+      if(e->nterms == 7 && o->nterms == 9)
+         return(SFX(lets_sum_pair_7_9));
+      if(e->nterms == 9 && o->nterms == 7)
+         return(SFX(lets_sum_pair_9_7));
+      if(e->nterms == 8 && o->nterms == 8)
+         return(SFX(lets_sum_pair_8_8));
+   }
+   return(SFX(lets_sum_pair_n));
+}
+
+#undef LETS_SUM_KERNEL
+#undef LETS_SUM_PAIR
+#endif /* !LETS_FOLD_ONLY */
+
+#undef LETS_FOLD_KERNEL
+#undef LETS_FOLD_PAIR
@@ -0,0 +1,169 @@
+/***********************************************************************
+      LIBRARY: WSQ - Grayscale Image Compression
+
+      FILE:    PLAN.C
+
+      Contains routines responsible for the plans a context may share
+      with others to encode or decode images of one size: the wavelet
+      and quantization trees and the planned filter passes of both
+      transforms, built once rather than at every call.
+
+***********************************************************************
+               ROUTINES:
+#cat: create_wsq_plan - Builds the plan of an image size and precision.
+#cat:
+#cat: free_wsq_plan - Deallocates the memory of a plan.
+#cat:
+#cat: context_plan_wsq - Returns the plan a context uses for images of
+#cat:                    the given size.
+#cat:
+#cat: same_dtt_table - Tests if two transform tables hold the same
+#cat:                  filters, bit for bit.
+
+***********************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "plan.h"
+#include "tableio.h"
+#include "tree.h"
+
+/************************************************************************/
+/* Routine to build the plan of images width x height at the given      */
+/* precision with the standard filter bank.                             */
+/************************************************************************/
+int create_wsq_plan(
+   WSQPlan **oplan,       /* returned plan */
+   const int width,
+   const int height,
+   const int precision)   /* WSQ_PRECISION_* */
+{
+   int ret, len;
+   WSQPlan *plan;
+   unsigned char table[64], *cbufptr;
+
+   if(width <= 0 || height <= 0 ||
+      (precision != WSQ_PRECISION_STRICT && precision != WSQ_PRECISION_FAST)) {
+      fprintf(stderr, "ERROR : create_wsq_plan : invalid plan %d x %d\n",
+              width, height);
+      return(-1);
+   }
+
+   plan = (WSQPlan *)calloc(1, sizeof(WSQPlan));
+   if(plan == (WSQPlan *)NULL) {
+      fprintf(stderr, "ERROR : create_wsq_plan : calloc : plan\n");
+      return(-94);
+   }
+   plan->width = width;
+   plan->height = height;
+   plan->precision = precision;
+
+   build_wsq_trees(plan->w_tree, W_TREELEN, plan->q_tree, Q_TREELEN,
+                   width, height);
+
+   /* The decoder filters with the taps read back from the file, so */
+   /* derive them the same way, through the table the encoder writes. */
+   len = 0;
+   if((ret = putc_transform_table(lofilt, MAX_LOFILT, hifilt, MAX_HIFILT,
+                                  table, sizeof(table), &len))) {
+      free_wsq_plan(plan);
+      return(ret);
+   }
+   /* Skip the DTT_WSQ marker. */
+   cbufptr = table + 2;
+   if((ret = getc_transform_table(&plan->dtt_table, &cbufptr, table + len))) {
+      free_wsq_plan(plan);
+      return(ret);
+   }
+
+   if((ret = build_wavelet_plan(&plan->analysis, plan->w_tree, W_TREELEN,
+                   hifilt, MAX_HIFILT, lofilt, MAX_LOFILT, 0, precision)) ||
+      (ret = build_wavelet_plan(&plan->synthesis, plan->w_tree, W_TREELEN,
+                   plan->dtt_table.hifilt, plan->dtt_table.hisz,
+                   plan->dtt_table.lofilt, plan->dtt_table.losz,
+                   1, precision))) {
+      free_wsq_plan(plan);
+      return(ret);
+   }
+   /* Windows are cut from the exact convolution passes, which the */
+   /* synthesis passes are in strict precision only.               */
+   if(precision != WSQ_PRECISION_STRICT &&
+      (ret = build_wavelet_plan(&plan->window, plan->w_tree, W_TREELEN,
+                   plan->dtt_table.hifilt, plan->dtt_table.hisz,
+                   plan->dtt_table.lofilt, plan->dtt_table.losz,
+                   1, WSQ_PRECISION_STRICT))) {
+      free_wsq_plan(plan);
+      return(ret);
+   }
+
+   *oplan = plan;
+   return(0);
+}
+
+/************************************************************************/
+/* Routine to deallocate the memory of a plan.                          */
+/************************************************************************/
+void free_wsq_plan(WSQPlan *plan)
+{
+   if(plan == (WSQPlan *)NULL)
+      return;
+   free_wavelet_plan(&plan->analysis);
+   free_wavelet_plan(&plan->synthesis);
+   free_wavelet_plan(&plan->window);
+   if(plan->dtt_table.lofilt != (float *)NULL)
+      free(plan->dtt_table.lofilt);
+   if(plan->dtt_table.hifilt != (float *)NULL)
+      free(plan->dtt_table.hifilt);
+   free(plan);
+}
+
+/************************************************************************/
+/* Routine to return the plan for images width x height at the current  */
+/* precision of a context: the plan attached to it if it applies, else  */
+/* one of its own, built again only when the size or precision changes. */
+/************************************************************************/
+int context_plan_wsq(
+   WSQPlan **oplan,       /* returned plan */
+   WSQContext *context,
+   const int width,
+   const int height)
+{
+   int ret;
+   WSQPlan *plan;
+
+   plan = context->plan;
+   if(plan != (WSQPlan *)NULL && plan->width == width &&
+      plan->height == height && plan->precision == context->precision) {
+      *oplan = plan;
+      return(0);
+   }
+
+   plan = context->own_plan;
+   if(plan == (WSQPlan *)NULL || plan->width != width ||
+      plan->height != height || plan->precision != context->precision) {
+      free_wsq_plan(plan);
+      context->own_plan = (WSQPlan *)NULL;
+      if((ret = create_wsq_plan(&plan, width, height, context->precision)))
+         return(ret);
+      context->own_plan = plan;
+   }
+
+   *oplan = plan;
+   return(0);
+}
+
+/************************************************************************/
+/* Routine to test if two defined transform tables hold the same filter */
+/* taps, bit for bit, so the passes planned for one apply to the other. */
+/************************************************************************/
+int same_dtt_table(const DTT_TABLE *a, const DTT_TABLE *b)
+{
+   if(a->lodef != 1 || a->hidef != 1 || b->lodef != 1 || b->hidef != 1)
+      return(0);
+   if(a->losz != b->losz || a->hisz != b->hisz)
+      return(0);
+
+   return(memcmp(a->lofilt, b->lofilt, a->losz * sizeof(float)) == 0 &&
+          memcmp(a->hifilt, b->hifilt, a->hisz * sizeof(float)) == 0);
+}
@@ -0,0 +1,37 @@
+/*
+ * plan.h
+ *
+ *  Reusable encoder and decoder plans keyed by image dimensions.
+ */
+
+#ifndef PLAN_H_
+#define PLAN_H_
+
+#include "wsqInternal.h"
+#include "wavelet.h"
+
+/* Everything about a transform that depends only on the image      */
+/* dimensions, the precision and the standard filter bank.  A plan  */
+/* is not modified once created, so any number of contexts may use  */
+/* it at once.                                                      */
+struct _WSQPlan {
+   int width;
+   int height;
+   int precision;               /* WSQ_PRECISION_* */
+   W_TREE w_tree[W_TREELEN];
+   Q_TREE q_tree[Q_TREELEN];
+   DTT_TABLE dtt_table;         /* synthesis filters read back from the */
+                                /* transform table the encoder writes  */
+   WAVELET_PLAN analysis;       /* passes of wsq_decompose */
+   WAVELET_PLAN synthesis;      /* passes of wsq_reconstruct */
+   WAVELET_PLAN window;         /* exact passes of wsq_reconstruct_window, */
+                                /* for plans of other precisions only      */
+};
+
+/* plan.c */
+int create_wsq_plan(WSQPlan **, const int, const int, const int);
+void free_wsq_plan(WSQPlan *);
+int context_plan_wsq(WSQPlan **, WSQContext *, const int, const int);
+int same_dtt_table(const DTT_TABLE *, const DTT_TABLE *);
+
+#endif /* PLAN_H_ */
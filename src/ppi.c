@@ -47,37 +47,89 @@ identified are necessarily the best available for the purpose.
 ***********************************************************************/
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include "ppi.h"
 #include "tableio.h"
 
+/************************************************************************/
+/* The NISTCOM is scanned where it lies in the data stream rather than  */
+/* parsed into a FET, so decoding allocates no memory for it.  Fields   */
+/* are read as string2fet reads them: a name up to white space, then    */
+/* the rest of the line; a later field of a name replaces an earlier.   */
 /************************************************************************/
 int getc_ppi_wsq(int *oppi, unsigned char *idata, const int ilen)
 {
    int ret;
-   int ppi;
-   char *value;
-   NISTCOM *nistcom;
+   int ppi, found;
+   int i, len, nlen;
+   unsigned char *text, *name, *value;
+   char digits[MAXFETLENGTH];
+   int vlen;
 
    /* Get ppi from NISTCOM, if one exists ... */
-   if((ret = getc_nistcom_wsq(&nistcom, idata, ilen)))
+   if((ret = getc_nistcom_text_wsq(&text, &len, idata, ilen)))
       return(ret);
-   if(nistcom != (NISTCOM *)NULL){
-      if((ret = extractfet_ret(&value, NCM_PPI, nistcom))){
-         freefet(nistcom);
-         return(ret);
+   /* Otherwise, NISTCOM does NOT exist, so ppi = -1. */
+   if(text == (unsigned char *)NULL){
+      *oppi = -1;
+      return(0);
+   }
+
+   /* The comment ends at its length or a NULL terminator. */
+   for(i = 0; i < len && text[i] != '\0'; i++);
+   len = i;
+
+   found = 0;
+   ppi = -1;
+   i = 0;
+   while(i < len){
+      /* Get next name */
+      name = text + i;
+      while((i < len)&&(text[i] != ' ')&&(text[i] != '\t'))
+         i++;
+      nlen = (int)(text + i - name);
+
+      /* Skip white space */
+      while((i < len)&&((text[i] == ' ')||(text[i] == '\t')))
+         i++;
+
+      /* Get next value */
+      value = text + i;
+      while((i < len)&&(text[i] != '\n'))
+         i++;
+      vlen = (int)(text + i - value);
+
+      /* Skip white space */
+      while((i < len)&&
+            ((text[i] == ' ')||(text[i] == '\t')||(text[i] == '\n')))
+         i++;
+
+      if(nlen == 0){
+         fprintf(stderr, "ERROR : getc_ppi_wsq : empty name string found\n");
+         return(-2);
       }
-      if(value != (char *)NULL){
-         ppi = atoi(value);
-         free(value);
+      if(nlen == (int)strlen(NCM_PPI) &&
+         strncmp((char *)name, NCM_PPI, nlen) == 0){
+         found = 1;
+         /* PPI without a value, so ppi = -1. */
+         if(vlen == 0)
+            ppi = -1;
+         else{
+            if(vlen > MAXFETLENGTH-1)
+               vlen = MAXFETLENGTH-1;
+            memcpy(digits, value, vlen);
+            digits[vlen] = '\0';
+            ppi = atoi(digits);
+         }
       }
-      /* Otherwise, PPI not in NISTCOM, so ppi = -1. */
-      else
-         ppi = -1;
-      freefet(nistcom);
    }
-   /* Otherwise, NISTCOM does NOT exist, so ppi = -1. */
-   else
-      ppi = -1;
+
+   if(!found){
+      fprintf(stderr, "ERROR : getc_ppi_wsq : feature %s not found\n",
+              NCM_PPI);
+      return(-2);
+   }
 
    *oppi = ppi;
 
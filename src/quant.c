@@ -0,0 +1,336 @@
+/*
+ * quant.c
+ *
+ *  Vector kernels of variance and quantize, generated for SSE2 and
+ *  AVX2 and picked when run, by cpu_features_wsq.
+ *
+ *  Quantizing is branchless: the dead zone and the sign of each
+ *  coefficient are masks.  With WSQ_PRECISION_STRICT every one is
+ *  divided by the bin width and rounded as in the scalar routine,
+ *  so results are bit identical to it; with WSQ_PRECISION_FAST it
+ *  is multiplied by the reciprocal of the bin width instead.
+ *
+ *  The variance of a subband sums the values and their squares in
+ *  float, in order, with WSQ_PRECISION_STRICT; no vector sum can
+ *  round the same way, so that stays scalar.  With
+ *  WSQ_PRECISION_FAST the sums are vectors of doubles, which hold
+ *  the squares of the floats exactly.
+ *
+ *      ROUTINES:
+#cat: subband_variance_wsq - Computes the variance of a window of a
+#cat:                   subband.
+#cat: quantize_subband_wsq - Quantizes the coefficients of a subband.
+ */
+
+#include "Config.h"
+#include "cpu.h"
+#include "quant.h"
+#include "wsqInternal.h"
+
+#if defined(CPU_WSQ_KERNELS_AVX2)
+#include <immintrin.h>
+#elif defined(CPU_SSE2)
+#include <emmintrin.h>
+#endif
+
+/* Variance of the values and squares summed in float, in order. */
+static float subband_variance_rest(const float *fp, const int lenx,
+                                   const int leny, const int width)
+{
+   int row, col;
+   float ssq;             /* sum of squares */
+   float sum2;            /* variance calculation parameter */
+   float sum_pix;         /* sum of pixels */
+
+   ssq = 0.0;
+   sum_pix = 0.0;
+   for(row = 0; row < leny; row++, fp += (width - lenx)) {
+      for(col = 0; col < lenx; col++) {
+         sum_pix += *fp;
+         ssq += *fp * *fp;
+         fp++;
+      }
+   }
+   sum2 = (sum_pix * sum_pix)/(lenx * leny);
+   return((float)((ssq - sum2)/((lenx * leny)-1.0)));
+}
+
+/* Variance of the sums in double. */
+static float variance_of_sums(const double sum_pix, const double ssq,
+                              const int lenx, const int leny)
+{
+   double n;
+
+   n = (double)lenx * leny;
+   return((float)((ssq - (sum_pix * sum_pix)/n)/(n-1.0)));
+}
+
+/* Quantized coefficients cnt to len of a row, dividing by qbss or, */
+/* fast, multiplying by rqbss.                                      */
+static void quantize_row_rest(short *sip, const float *fip, int cnt,
+                              const int len, const float zbin,
+                              const float qbss, const float rqbss,
+                              const int fast)
+{
+   for(; cnt < len; cnt++) {
+      if(-zbin <= fip[cnt] && fip[cnt] <= zbin)
+         sip[cnt] = 0;
+      else if(fip[cnt] > 0.0)
+         sip[cnt] = (short)((fast ? (fip[cnt]-zbin)*rqbss :
+                                    (fip[cnt]-zbin)/qbss) + 1.0);
+      else
+         sip[cnt] = (short)((fast ? (fip[cnt]+zbin)*rqbss :
+                                    (fip[cnt]+zbin)/qbss) - 1.0);
+   }
+}
+
+#if !defined(CPU_SSE2)
+/* Quantized coefficients of a subband. */
+static void quantize_subband_rest(short *sip, const float *fip,
+                                  const int lenx, const int leny,
+                                  const int width, const float zbin,
+                                  const float qbss, const float rqbss,
+                                  const int fast)
+{
+   int row;
+
+   for(row = 0; row < leny; row++, sip += lenx, fip += width)
+      quantize_row_rest(sip, fip, 0, lenx, zbin, qbss, rqbss, fast);
+}
+#endif
+
+#if defined(CPU_SSE2)
+static float subband_variance_sse2(const float *fp, const int lenx,
+                                   const int leny, const int width)
+{
+   int row, col;
+   __m128 x;
+   __m128d lo, hi, vsum, vssq;
+   double sums[2], ssqs[2], sum_pix, ssq;
+
+   vsum = _mm_setzero_pd();
+   vssq = _mm_setzero_pd();
+   sum_pix = 0.0;
+   ssq = 0.0;
+   for(row = 0; row < leny; row++, fp += width) {
+      for(col = 0; col + 4 <= lenx; col += 4) {
+         x = _mm_loadu_ps(fp + col);
+         lo = _mm_cvtps_pd(x);
+         hi = _mm_cvtps_pd(_mm_movehl_ps(x, x));
+         vsum = _mm_add_pd(vsum, _mm_add_pd(lo, hi));
+         vssq = _mm_add_pd(vssq, _mm_add_pd(_mm_mul_pd(lo, lo),
+                                            _mm_mul_pd(hi, hi)));
+      }
+      for(; col < lenx; col++) {
+         sum_pix += fp[col];
+         ssq += (double)fp[col] * fp[col];
+      }
+   }
+   _mm_storeu_pd(sums, vsum);
+   _mm_storeu_pd(ssqs, vssq);
+   return(variance_of_sums(sum_pix + sums[0] + sums[1],
+                           ssq + ssqs[0] + ssqs[1], lenx, leny));
+}
+
+/* Quantizes 4 coefficients, into ints that are the shorts of the */
+/* scalar routine once sign extended from their low 16 bits.      */
+static INLINE __m128i quantize_ints_sse2(const float *fip, const __m128 vz,
+                                         const __m128 vq, const int fast)
+{
+   __m128 f, pos, dead, y;
+   __m128i i, bad;
+
+   f = _mm_loadu_ps(fip);
+   pos = _mm_cmpgt_ps(f, _mm_setzero_ps());
+   /* a NaN is neither in the dead zone nor positive */
+   dead = _mm_and_ps(_mm_cmple_ps(_mm_xor_ps(vz, _mm_set1_ps(-0.0f)), f),
+                     _mm_cmple_ps(f, vz));
+   /* f-zbin if positive, else f+zbin: the zero bin signed as f */
+   y = _mm_sub_ps(f, _mm_or_ps(_mm_and_ps(pos, vz),
+                               _mm_andnot_ps(pos, _mm_xor_ps(vz,
+                                                _mm_set1_ps(-0.0f)))));
+   y = fast ? _mm_mul_ps(y, vq) : _mm_div_ps(y, vq);
+   /* adding 1 away from zero after truncating is adding it before, */
+   /* except out of range, where the scalar conversion gives INT_MIN */
+   i = _mm_cvttps_epi32(y);
+   bad = _mm_cmpeq_epi32(i, _mm_set1_epi32((int)0x80000000));
+   i = _mm_add_epi32(i, _mm_andnot_si128(bad,
+          _mm_sub_epi32(_mm_and_si128(_mm_castps_si128(pos),
+                                      _mm_set1_epi32(2)),
+                        _mm_set1_epi32(1))));
+   i = _mm_andnot_si128(_mm_castps_si128(dead), i);
+   return(_mm_srai_epi32(_mm_slli_epi32(i, 16), 16));
+}
+
+static void quantize_subband_sse2(short *sip, const float *fip,
+                                  const int lenx, const int leny,
+                                  const int width, const float zbin,
+                                  const float qbss, const float rqbss,
+                                  const int fast)
+{
+   int row, col;
+   __m128 vz, vq;
+
+   vz = _mm_set1_ps(zbin);
+   vq = _mm_set1_ps(fast ? rqbss : qbss);
+   for(row = 0; row < leny; row++, sip += lenx, fip += width) {
+      for(col = 0; col + 8 <= lenx; col += 8)
+         _mm_storeu_si128((__m128i *)(sip + col),
+                          _mm_packs_epi32(
+                             quantize_ints_sse2(fip + col, vz, vq, fast),
+                             quantize_ints_sse2(fip + col + 4, vz, vq,
+                                                fast)));
+      quantize_row_rest(sip, fip, col, lenx, zbin, qbss, rqbss, fast);
+   }
+}
+#endif
+
+#if defined(CPU_WSQ_KERNELS_AVX2)
+static TARGET_AVX2 float subband_variance_avx2(const float *fp,
+                                               const int lenx,
+                                               const int leny,
+                                               const int width)
+{
+   int row, col;
+   __m128 x;
+   __m256d d, vsum, vssq;
+   double sums[4], ssqs[4], sum_pix, ssq;
+
+   vsum = _mm256_setzero_pd();
+   vssq = _mm256_setzero_pd();
+   sum_pix = 0.0;
+   ssq = 0.0;
+   for(row = 0; row < leny; row++, fp += width) {
+      for(col = 0; col + 4 <= lenx; col += 4) {
+         x = _mm_loadu_ps(fp + col);
+         d = _mm256_cvtps_pd(x);
+         vsum = _mm256_add_pd(vsum, d);
+         vssq = _mm256_add_pd(vssq, _mm256_mul_pd(d, d));
+      }
+      for(; col < lenx; col++) {
+         sum_pix += fp[col];
+         ssq += (double)fp[col] * fp[col];
+      }
+   }
+   _mm256_storeu_pd(sums, vsum);
+   _mm256_storeu_pd(ssqs, vssq);
+   return(variance_of_sums(sum_pix + sums[0] + sums[1] + sums[2] + sums[3],
+                           ssq + ssqs[0] + ssqs[1] + ssqs[2] + ssqs[3],
+                           lenx, leny));
+}
+
+/* Quantizes 8 coefficients as quantize_ints_sse2 does. */
+static INLINE TARGET_AVX2 __m256i quantize_ints_avx2(const float *fip,
+                                                     const __m256 vz,
+                                                     const __m256 vq,
+                                                     const int fast)
+{
+   __m256 f, pos, dead, y, nz;
+   __m256i i, bad;
+
+   f = _mm256_loadu_ps(fip);
+   nz = _mm256_xor_ps(vz, _mm256_set1_ps(-0.0f));
+   pos = _mm256_cmp_ps(f, _mm256_setzero_ps(), _CMP_GT_OQ);
+   dead = _mm256_and_ps(_mm256_cmp_ps(nz, f, _CMP_LE_OQ),
+                        _mm256_cmp_ps(f, vz, _CMP_LE_OQ));
+   y = _mm256_sub_ps(f, _mm256_blendv_ps(nz, vz, pos));
+   y = fast ? _mm256_mul_ps(y, vq) : _mm256_div_ps(y, vq);
+   i = _mm256_cvttps_epi32(y);
+   bad = _mm256_cmpeq_epi32(i, _mm256_set1_epi32((int)0x80000000));
+   i = _mm256_add_epi32(i, _mm256_andnot_si256(bad,
+          _mm256_sub_epi32(_mm256_and_si256(_mm256_castps_si256(pos),
+                                            _mm256_set1_epi32(2)),
+                           _mm256_set1_epi32(1))));
+   i = _mm256_andnot_si256(_mm256_castps_si256(dead), i);
+   return(_mm256_srai_epi32(_mm256_slli_epi32(i, 16), 16));
+}
+
+static TARGET_AVX2 void quantize_subband_avx2(short *sip, const float *fip,
+                                              const int lenx,
+                                              const int leny,
+                                              const int width,
+                                              const float zbin,
+                                              const float qbss,
+                                              const float rqbss,
+                                              const int fast)
+{
+   int row, col;
+   __m256 vz, vq;
+
+   vz = _mm256_set1_ps(zbin);
+   vq = _mm256_set1_ps(fast ? rqbss : qbss);
+   for(row = 0; row < leny; row++, sip += lenx, fip += width) {
+      for(col = 0; col + 16 <= lenx; col += 16)
+         /* packs works within 128 bit lanes: put the halves in order */
+         _mm256_storeu_si256((__m256i *)(sip + col),
+            _mm256_permute4x64_epi64(_mm256_packs_epi32(
+               quantize_ints_avx2(fip + col, vz, vq, fast),
+               quantize_ints_avx2(fip + col + 8, vz, vq, fast)), 0xd8));
+      quantize_row_rest(sip, fip, col, lenx, zbin, qbss, rqbss, fast);
+   }
+}
+#endif
+
+/*****************************************************************/
+/* Routine to compute the variance of the lenx by leny window at */
+/* fp of a subband, rows width apart.  Bit identical to variance */
+/* with WSQ_PRECISION_STRICT.                                    */
+/*****************************************************************/
+float subband_variance_wsq(
+   const float *fp,     /* first value of the window */
+   const int lenx,      /* window width */
+   const int leny,      /* window height */
+   const int width,     /* image width */
+   const int precision) /* WSQ_PRECISION_* */
+{
+   if(precision != WSQ_PRECISION_FAST)
+      return(subband_variance_rest(fp, lenx, leny, width));
+
+#if defined(CPU_WSQ_KERNELS_AVX2)
+   if(cpu_features_wsq() & CPU_WSQ_AVX2)
+      return(subband_variance_avx2(fp, lenx, leny, width));
+#endif
+#if defined(CPU_SSE2)
+   return(subband_variance_sse2(fp, lenx, leny, width));
+#else
+   return(subband_variance_rest(fp, lenx, leny, width));
+#endif
+}
+
+/*****************************************************************/
+/* Routine to quantize the lenx by leny coefficients of the      */
+/* subband at fip, rows width apart, into lenx*leny shorts at    */
+/* sip, with bin width qbss and zero bin 2*zbin.  Bit identical  */
+/* to quantize with WSQ_PRECISION_STRICT.                        */
+/*****************************************************************/
+void quantize_subband_wsq(
+   short *sip,          /* quantized output */
+   const float *fip,    /* first coefficient of the subband */
+   const int lenx,      /* subband width */
+   const int leny,      /* subband height */
+   const int width,     /* image width */
+   const float zbin,    /* half the zero bin width */
+   const float qbss,    /* bin width */
+   const int precision) /* WSQ_PRECISION_* */
+{
+   int fast;
+   float rqbss;
+
+   fast = precision == WSQ_PRECISION_FAST;
+   rqbss = 1.0f / qbss;
+
+#if defined(CPU_WSQ_KERNELS_AVX2)
+   if(cpu_features_wsq() & CPU_WSQ_AVX2) {
+      quantize_subband_avx2(sip, fip, lenx, leny, width, zbin, qbss, rqbss,
+                            fast);
+      return;
+   }
+#endif
+#if defined(CPU_SSE2)
+   quantize_subband_sse2(sip, fip, lenx, leny, width, zbin, qbss, rqbss,
+                         fast);
+#else
+   quantize_subband_rest(sip, fip, lenx, leny, width, zbin, qbss, rqbss,
+                         fast);
+#endif
+}
@@ -0,0 +1,16 @@
+/*
+ * quant.h
+ *
+ *  Vector kernels of variance and quantize.
+ */
+
+#ifndef QUANT_H_
+#define QUANT_H_
+
+/* quant.c */
+float subband_variance_wsq(const float *, const int, const int, const int,
+                 const int);
+void quantize_subband_wsq(short *, const float *, const int, const int,
+                 const int, const float, const float, const int);
+
+#endif /* QUANT_H_ */
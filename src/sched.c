@@ -0,0 +1,349 @@
+/***********************************************************************
+      LIBRARY: WSQ - Grayscale Image Compression
+
+      FILE:    SCHED.C
+
+      Contains routines responsible for scheduling the work of a
+      batch on worker threads.
+
+      The work on each item is a pipeline of stages, the entropy and
+      transform stages of a decode for instance.  An item holds a
+      slot, a context, from its first stage to its last, so there are
+      more slots than workers: while one worker runs the second stage
+      of an item, another starts the first stage of the next, and the
+      branchy entropy decoding of one image overlaps the float heavy
+      transform of another.
+
+      Each worker starts with a run of the items and a stack of the
+      stages ready to run.  It runs the most recent of its ready
+      stages first, its data still in cache, then starts the next of
+      its items; once out of both it steals, the oldest ready stage
+      of another worker or the last item of the longest run left.
+      Runs, stacks and slots are guarded by one mutex per batch, held
+      only to pick work, never while running a stage.
+
+      Calls on contexts with WSQ_PRIORITY_HIGH take the priority
+      lane for their duration.  Bulk pipelines pause one worker for
+      each thread of the lane, between two stages, so that an
+      interactive request gets the processors without waiting for a
+      bulk reload to finish; the calling thread of a pipeline never
+      pauses, so bulk work always progresses.
+
+***********************************************************************
+               ROUTINES:
+#cat: enter_lane_wsq - Takes the priority lane for a high priority call.
+#cat:
+#cat: leave_lane_wsq - Leaves the priority lane.
+#cat:
+#cat: run_pipeline_wsq - Runs the stages of an array of items on worker
+#cat:                    threads.
+
+***********************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "sched.h"
+#include "thread.h"
+
+/* Threads of the high priority calls in progress, process wide. */
+static WSQ_MUTEX lane_mutex = WSQ_MUTEX_INIT;
+static WSQ_COND lane_cond = WSQ_COND_INIT;
+static int lane_threads = 0;
+
+struct pipe_state;
+
+/* A worker: its run of items not started yet, and its stack of */
+/* slots whose item has a stage ready to run.                   */
+typedef struct pipe_worker {
+   struct pipe_state *state;
+   int index;              /* 0 for the calling thread */
+   int first;              /* next item of the run to start */
+   int last;               /* one past the last item of the run */
+   int *ready;             /* slots ready, most recent last */
+   int nready;
+} PIPE_WORKER;
+
+typedef struct pipe_state {
+   WSQ_PIPELINE *pipe;
+   WSQ_MUTEX mutex;
+   WSQ_COND cond;          /* work or a slot freed, or done */
+   PIPE_WORKER workers[MAX_THREADS_WSQ];
+   int *slot_item;         /* position in pipe->items of each slot */
+   int *slot_stage;        /* next stage of each slot */
+   int *slot_group;        /* group last held by each slot, -1 none */
+   int *free_slots;
+   int nfree;
+   int running;            /* stages running */
+   int done;               /* no work left */
+} PIPE_STATE;
+
+/*****************************************************************/
+/* Routines to take and leave the priority lane, with the number */
+/* of threads of the call.                                       */
+/*****************************************************************/
+void enter_lane_wsq(const int threads)
+{
+   lock_mutex_wsq(&lane_mutex);
+   lane_threads += threads;
+   unlock_mutex_wsq(&lane_mutex);
+}
+
+void leave_lane_wsq(const int threads)
+{
+   lock_mutex_wsq(&lane_mutex);
+   lane_threads -= threads;
+   wake_cond_wsq(&lane_cond);
+   unlock_mutex_wsq(&lane_mutex);
+}
+
+/*****************************************************************/
+/* Routine pausing a worker of a bulk pipeline while the lane    */
+/* needs its processor, until the lane frees it or the pipeline  */
+/* is done.                                                      */
+/*****************************************************************/
+static void yield_to_lane(PIPE_WORKER *worker)
+{
+   PIPE_STATE *state;
+
+   state = worker->state;
+   lock_mutex_wsq(&lane_mutex);
+   while(worker->index > 0 && !state->done &&
+         worker->index >= state->pipe->nworkers - lane_threads)
+      wait_cond_wsq(&lane_cond, &lane_mutex);
+   unlock_mutex_wsq(&lane_mutex);
+}
+
+/*****************************************************************/
+/* Routine to pick the next stage a worker runs, with the mutex  */
+/* held.  Returns its slot, or -1 if there is none for now.      */
+/*****************************************************************/
+static int next_stage(PIPE_STATE *state, PIPE_WORKER *worker)
+{
+   WSQ_PIPELINE *pipe;
+   PIPE_WORKER *victim;
+   int i, slot, pos, group;
+
+   pipe = state->pipe;
+
+   /* Its own most recent ready stage. */
+   if(worker->nready > 0)
+      return(worker->ready[--worker->nready]);
+
+   /* The oldest ready stage of another worker. */
+   for(i = 0; i < pipe->nworkers; i++) {
+      victim = state->workers + i;
+      if(victim->nready > 0) {
+         slot = victim->ready[0];
+         victim->nready--;
+         for(pos = 0; pos < victim->nready; pos++)
+            victim->ready[pos] = victim->ready[pos+1];
+         return(slot);
+      }
+   }
+
+   /* Start an item, if a slot is free: the next of its run, else */
+   /* the last of the longest run left.                           */
+   if(state->nfree == 0)
+      return(-1);
+   victim = worker;
+   if(worker->first >= worker->last) {
+      for(i = 0; i < pipe->nworkers; i++)
+         if(state->workers[i].last - state->workers[i].first >
+            victim->last - victim->first)
+            victim = state->workers + i;
+      if(victim->first >= victim->last)
+         return(-1);
+      pos = --victim->last;
+   }
+   else
+      pos = worker->first++;
+
+   /* A free slot that last held the group, else the latest freed. */
+   group = pipe->groups[pos];
+   for(i = state->nfree - 1; i >= 0; i--)
+      if(state->slot_group[state->free_slots[i]] == group)
+         break;
+   if(i < 0)
+      i = state->nfree - 1;
+   slot = state->free_slots[i];
+   state->free_slots[i] = state->free_slots[--state->nfree];
+   state->slot_item[slot] = pos;
+   state->slot_stage[slot] = 0;
+   state->slot_group[slot] = group;
+
+   return(slot);
+}
+
+/*****************************************************************/
+/* Routine to test, with the mutex held, if no work is left.     */
+/*****************************************************************/
+static int pipeline_done(PIPE_STATE *state)
+{
+   int i;
+
+   if(state->running > 0)
+      return(0);
+   for(i = 0; i < state->pipe->nworkers; i++)
+      if(state->workers[i].nready > 0 ||
+         state->workers[i].first < state->workers[i].last)
+         return(0);
+
+   return(1);
+}
+
+static void pipe_worker_job(void *arg)
+{
+   PIPE_WORKER *worker;
+   PIPE_STATE *state;
+   WSQ_PIPELINE *pipe;
+   int slot, stage, pos, ret;
+   WSQ_POOL *prev;        /* pool bound before the stage */
+
+   worker = (PIPE_WORKER *)arg;
+   state = worker->state;
+   pipe = state->pipe;
+
+   lock_mutex_wsq(&state->mutex);
+   while(!state->done) {
+      if(pipe->bulk) {
+         unlock_mutex_wsq(&state->mutex);
+         yield_to_lane(worker);
+         lock_mutex_wsq(&state->mutex);
+         if(state->done)
+            break;
+      }
+
+      slot = next_stage(state, worker);
+      if(slot < 0) {
+         if(pipeline_done(state)) {
+            /* Wake the workers waiting for work or the lane. */
+            lock_mutex_wsq(&lane_mutex);
+            state->done = 1;
+            wake_cond_wsq(&lane_cond);
+            unlock_mutex_wsq(&lane_mutex);
+            break;
+         }
+         wait_cond_wsq(&state->cond, &state->mutex);
+         continue;
+      }
+
+      stage = state->slot_stage[slot];
+      pos = state->slot_item[slot];
+      state->running++;
+      unlock_mutex_wsq(&state->mutex);
+
+      /* the jobs of a stage run on the threads of its slot */
+      prev = enter_pool_wsq(&pipe->slots[slot]->pool,
+                            pipe->slots[slot]->threads);
+      ret = pipe->stages[stage](pipe->arg, pipe->items[pos], slot,
+                                pipe->slots[slot]);
+      leave_pool_wsq(prev);
+
+      lock_mutex_wsq(&state->mutex);
+      state->running--;
+      if(ret == 0 && stage + 1 < pipe->nstages) {
+         state->slot_stage[slot] = stage + 1;
+         worker->ready[worker->nready++] = slot;
+      }
+      else
+         state->free_slots[state->nfree++] = slot;
+      wake_cond_wsq(&state->cond);
+   }
+   wake_cond_wsq(&state->cond);
+   unlock_mutex_wsq(&state->mutex);
+}
+
+/*****************************************************************/
+/* Routine to run every stage of each item of a pipeline on up   */
+/* to pipe->nworkers threads, the calling one included, and      */
+/* return when all are done.  Items are handed out in runs of    */
+/* about equal cost, in order.  Returns 0, or an error code if   */
+/* the pipeline could not be set up.                             */
+/*****************************************************************/
+int run_pipeline_wsq(WSQ_PIPELINE *pipe)
+{
+   PIPE_STATE *state;
+   PIPE_WORKER *worker;
+   int *ints;
+   int i, first, last, nworkers;
+   double total, done;
+
+   nworkers = pipe->nworkers;
+   if(nworkers > MAX_THREADS_WSQ)
+      nworkers = MAX_THREADS_WSQ;
+   if(nworkers < 1 || pipe->nslots < 1 || pipe->nstages < 1 ||
+      pipe->nstages > MAX_STAGES_WSQ) {
+      fprintf(stderr, "ERROR : run_pipeline_wsq : invalid pipeline\n");
+      return(-1);
+   }
+   pipe->nworkers = nworkers;
+   if(pipe->nitems <= 0)
+      return(0);
+
+   state = (PIPE_STATE *)malloc(sizeof(PIPE_STATE));
+   ints = (int *)malloc(((size_t)nworkers + 4) * pipe->nslots * sizeof(int));
+   if(state == (PIPE_STATE *)NULL || ints == (int *)NULL) {
+      fprintf(stderr, "ERROR : run_pipeline_wsq : malloc : state\n");
+      free(state);
+      free(ints);
+      return(-1);
+   }
+   if(init_mutex_wsq(&state->mutex)) {
+      fprintf(stderr, "ERROR : run_pipeline_wsq : mutex\n");
+      free(state);
+      free(ints);
+      return(-1);
+   }
+   if(init_cond_wsq(&state->cond)) {
+      fprintf(stderr, "ERROR : run_pipeline_wsq : condition\n");
+      free_mutex_wsq(&state->mutex);
+      free(state);
+      free(ints);
+      return(-1);
+   }
+
+   state->pipe = pipe;
+   state->slot_item = ints;
+   state->slot_stage = ints + pipe->nslots;
+   state->slot_group = ints + 2 * pipe->nslots;
+   state->free_slots = ints + 3 * pipe->nslots;
+   for(i = 0; i < pipe->nslots; i++) {
+      state->slot_group[i] = -1;
+      state->free_slots[i] = pipe->nslots - 1 - i;
+   }
+   state->nfree = pipe->nslots;
+   state->running = 0;
+   state->done = 0;
+
+   /* Runs of about equal cost, one for each worker. */
+   total = 0.0;
+   for(i = 0; i < pipe->nitems; i++)
+      total += pipe->costs[i];
+   first = 0;
+   done = 0.0;
+   for(i = 0; i < nworkers; i++) {
+      worker = state->workers + i;
+      worker->state = state;
+      worker->index = i;
+      worker->ready = ints + (4 + i) * pipe->nslots;
+      worker->nready = 0;
+      for(last = first; last < pipe->nitems; last++) {
+         if(i < nworkers - 1 && done >= total * (i+1) / nworkers)
+            break;
+         done += pipe->costs[last];
+      }
+      worker->first = first;
+      worker->last = last;
+      first = last;
+   }
+
+   run_jobs_wsq(pipe_worker_job, state->workers, sizeof(PIPE_WORKER),
+                nworkers, nworkers);
+
+   free_cond_wsq(&state->cond);
+   free_mutex_wsq(&state->mutex);
+   free(state);
+   free(ints);
+
+   return(0);
+}
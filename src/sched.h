@@ -0,0 +1,44 @@
+/*
+ * sched.h
+ *
+ *  Scheduling of batches on worker threads: a pipeline of the stages
+ *  of each item, with work stealing, and the priority lane that high
+ *  priority calls take ahead of bulk work.
+ */
+
+#ifndef SCHED_H_
+#define SCHED_H_
+
+#include "wsqInternal.h"
+
+/* Most stages of the work on one item. */
+#define MAX_STAGES_WSQ   2
+
+/* A stage of the work on an item, run with the context of the slot */
+/* holding the item; a non-zero return skips its later stages.      */
+typedef int (*WSQ_STAGE)(void *, const int, const int, WSQContext *);
+
+/* The items of a pipeline, in the order to start them, and the   */
+/* slots (contexts) items occupy from their first stage to their  */
+/* last.  Items of one group are preferably given the slot that   */
+/* last held their group, for what it keeps from one to the next. */
+typedef struct wsq_pipeline {
+   int nstages;
+   WSQ_STAGE stages[MAX_STAGES_WSQ];
+   void *arg;              /* passed to every stage */
+   const int *items;       /* items, in the order to start them */
+   const int *groups;      /* group of each of items */
+   const double *costs;    /* relative cost of each of items */
+   int nitems;
+   WSQContext **slots;     /* contexts of the items in progress */
+   int nslots;
+   int nworkers;           /* threads, the calling one included */
+   int bulk;               /* yields threads to the priority lane */
+} WSQ_PIPELINE;
+
+/* sched.c */
+void enter_lane_wsq(const int);
+void leave_lane_wsq(const int);
+int run_pipeline_wsq(WSQ_PIPELINE *);
+
+#endif /* SCHED_H_ */
@@ -0,0 +1,196 @@
+/***********************************************************************
+      LIBRARY: WSQ - Grayscale Image Compression
+
+      FILE:    SCRATCH.C
+
+      Contains routines responsible for the working memory of the
+      encoder and decoder.  A call starts by reserving a block large
+      enough for everything it is expected to need, then takes its
+      buffers from the block in order, releasing them by resetting
+      the used count to an earlier value.  The block is kept for the
+      next call and grown to the most any call has needed, so calls
+      on images of one size stop allocating after the first.
+
+***********************************************************************
+               ROUTINES:
+#cat: encode_scratch_size - Returns the scratch bytes an encode needs.
+#cat:
+#cat: decode_scratch_size - Returns the scratch bytes a decode needs.
+#cat:
+#cat: begin_scratch_wsq - Reserves the scratch block of a call.
+#cat:
+#cat: alloc_scratch_wsq - Hands out aligned memory of the scratch block.
+#cat:
+#cat: end_scratch_wsq - Releases the memory of a call.
+#cat:
+#cat: free_scratch_wsq - Deallocates the scratch block.
+
+***********************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "scratch.h"
+#include "wavelet.h"
+
+/* Bytes n takes once aligned. */
+#define SCRATCH_ROUND(n)  (((n) + SCRATCH_ALIGN - 1) & ~(size_t)(SCRATCH_ALIGN - 1))
+
+/************************************************************************/
+/* Routine to return the floats of working memory wsq_decompose and     */
+/* wsq_reconstruct take on up to nthreads threads: a second image, and  */
+/* lines or strips of lines for each job of a pass.                     */
+/************************************************************************/
+static size_t transform_scratch_size(const int width, const int height,
+                                     const int nthreads)
+{
+   size_t lines;
+
+   lines = (size_t)(width > height ? width : height) * LIFT_STRIP;
+   if(lines < 2 * (size_t)width + 1)
+      lines = 2 * (size_t)width + 1;
+   lines *= lets_max_jobs(nthreads);
+
+   return(SCRATCH_ROUND((size_t)width * height * sizeof(float)) +
+          SCRATCH_ROUND(lines * sizeof(float)));
+}
+
+/************************************************************************/
+/* Routine to return the scratch bytes encoding a width x height image  */
+/* on up to nthreads threads takes: the quantized image, then the       */
+/* floating point image and the transform memory, or the tokens and     */
+/* compressed blocks.                                                   */
+/************************************************************************/
+size_t encode_scratch_size(const int width, const int height,
+                           const int nthreads)
+{
+   size_t num_pix, transform, huffman;
+
+   num_pix = (size_t)width * height;
+   transform = SCRATCH_ROUND(num_pix * sizeof(float)) +
+               transform_scratch_size(width, height, nthreads);
+   /* a token codes in at most 32 bits, doubled by zero stuffing */
+   huffman = SCRATCH_ROUND(num_pix * sizeof(unsigned int)) +
+             SCRATCH_ROUND(8 * num_pix) + 3 * SCRATCH_ALIGN;
+
+   return(SCRATCH_ROUND(num_pix * sizeof(short)) +
+          (transform > huffman ? transform : huffman));
+}
+
+/************************************************************************/
+/* Routine to return the scratch bytes decoding a width x height image  */
+/* from ilen bytes on up to nthreads threads takes: the floating point  */
+/* image, which the blocks are decoded into, and the non-zero subbands  */
+/* of its rows, then the unstuffed blocks, or the transform memory.     */
+/************************************************************************/
+size_t decode_scratch_size(const int width, const int height, const int ilen,
+                           const int nthreads)
+{
+   size_t num_pix, huffman, transform;
+
+   num_pix = (size_t)width * height;
+   huffman = SCRATCH_ROUND(3 * sizeof(HUFF_DBLOCK_WSQ)) +
+             SCRATCH_ROUND((size_t)ilen + BIT_READER_PAD) +
+             3 * SCRATCH_ROUND(BIT_READER_PAD);
+   /* the zero rows of the nodes, and of their two column bands */
+   transform = transform_scratch_size(width, height, nthreads) +
+               SCRATCH_ROUND((size_t)height * sizeof(unsigned int)) +
+               SCRATCH_ROUND(4 * (size_t)height);
+
+   return(SCRATCH_ROUND(num_pix * sizeof(float)) +
+          SCRATCH_ROUND(3 * (size_t)height * sizeof(unsigned long long)) +
+          (huffman > transform ? huffman : transform));
+}
+
+/************************************************************************/
+/* Routine to reserve the scratch block of a call expected to need size */
+/* bytes: the block set by WSQSetScratch if large enough, otherwise the */
+/* block of the library, grown to the most any call has needed.         */
+/************************************************************************/
+int begin_scratch_wsq(WSQ_SCRATCH *scratch, const size_t size)
+{
+   size_t need;
+   unsigned char *base;
+
+   end_scratch_wsq(scratch);
+
+   need = size > scratch->peak ? size : scratch->peak;
+   if(scratch->user != (unsigned char *)NULL &&
+      scratch->user_size >= need + SCRATCH_ALIGN) {
+      base = scratch->user;
+      need = scratch->user_size - SCRATCH_ALIGN;
+   }
+   else {
+      if(scratch->owned_size < need) {
+         if(scratch->owned != (unsigned char *)NULL)
+            free(scratch->owned);
+         scratch->owned_size = 0;
+         scratch->owned = (unsigned char *)malloc(need + SCRATCH_ALIGN);
+         if(scratch->owned == (unsigned char *)NULL) {
+            fprintf(stderr, "ERROR : begin_scratch_wsq : malloc : owned\n");
+            return(-99);
+         }
+         scratch->owned_size = need;
+      }
+      base = scratch->owned;
+      need = scratch->owned_size;
+   }
+
+   scratch->base = (unsigned char *)SCRATCH_ROUND((size_t)base);
+   scratch->size = need;
+   scratch->used = 0;
+
+   return(0);
+}
+
+/************************************************************************/
+/* Routine to hand out size bytes aligned on SCRATCH_ALIGN.  Once the   */
+/* block is used up, the memory is allocated on its own until the end   */
+/* of the call, and the next call reserves a larger block.              */
+/************************************************************************/
+void *alloc_scratch_wsq(WSQ_SCRATCH *scratch, const size_t size)
+{
+   void *mem;
+
+   if(scratch->used + SCRATCH_ROUND(size) <= scratch->size) {
+      mem = scratch->base + scratch->used;
+      scratch->used += SCRATCH_ROUND(size);
+   }
+   else {
+      if(scratch->nextra == MAX_SCRATCH_EXTRA ||
+         (mem = malloc(size)) == NULL) {
+         fprintf(stderr, "ERROR : alloc_scratch_wsq : malloc : mem\n");
+         return(NULL);
+      }
+      scratch->extra[scratch->nextra++] = mem;
+      scratch->extra_size += SCRATCH_ROUND(size);
+   }
+   if(scratch->used + scratch->extra_size > scratch->peak)
+      scratch->peak = scratch->used + scratch->extra_size;
+
+   return(mem);
+}
+
+/************************************************************************/
+/* Routine to release all the memory of a call, keeping the block.      */
+/************************************************************************/
+void end_scratch_wsq(WSQ_SCRATCH *scratch)
+{
+   while(scratch->nextra > 0)
+      free(scratch->extra[--scratch->nextra]);
+   scratch->extra_size = 0;
+   scratch->used = 0;
+}
+
+/************************************************************************/
+/* Routine to deallocate the memory of the library.                     */
+/************************************************************************/
+void free_scratch_wsq(WSQ_SCRATCH *scratch)
+{
+   end_scratch_wsq(scratch);
+   if(scratch->owned != (unsigned char *)NULL)
+      free(scratch->owned);
+   scratch->owned = (unsigned char *)NULL;
+   scratch->owned_size = 0;
+   scratch->base = (unsigned char *)NULL;
+   scratch->size = 0;
+}
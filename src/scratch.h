@@ -0,0 +1,24 @@
+/*
+ * scratch.h
+ *
+ *  Working memory of the encoder and decoder, reused from call to
+ *  call so that repeated calls do not allocate.
+ */
+
+#ifndef SCRATCH_H_
+#define SCRATCH_H_
+
+#include "wsqInternal.h"
+
+/* Alignment of the memory alloc_scratch_wsq hands out. */
+#define SCRATCH_ALIGN  64
+
+/* scratch.c */
+size_t encode_scratch_size(const int, const int, const int);
+size_t decode_scratch_size(const int, const int, const int, const int);
+int begin_scratch_wsq(WSQ_SCRATCH *, const size_t);
+void *alloc_scratch_wsq(WSQ_SCRATCH *, const size_t);
+void end_scratch_wsq(WSQ_SCRATCH *);
+void free_scratch_wsq(WSQ_SCRATCH *);
+
+#endif /* SCRATCH_H_ */
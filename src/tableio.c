@@ -85,8 +85,8 @@ identified are necessarily the best available for the purpose.
 #cat:                   WSQ compressed datastream through a memory buffer.
 #cat: read_nistcom_wsq - Gets and returns the first NISTCOM comment block
 #cat:                   in an open file.
-#cat: getc_nistcom_wsq - Gets and returns the first NISTCOM comment block
-#cat:                   in a memory buffer.
+#cat: getc_nistcom_text_wsq - Locates the text of the first NISTCOM comment
+#cat:                   block in a memory buffer, without copying it.
 #cat: print_comments_wsq - Gets and prints the first NISTOCM comment block
 #cat:                   in a WSQ compressed memory buffer to a specified
 #cat:                   file pointer.
@@ -176,7 +176,9 @@ int getc_table_wsq(
    WSQContext *context)
 {
    int ret;
+#ifdef PRINT_COMMENT
    unsigned char *comment;
+#endif
 
    switch(marker){
    case DTT_WSQ:
@@ -192,12 +194,16 @@ int getc_table_wsq(
          return(ret);
       break;
    case COM_WSQ:
+#ifdef PRINT_COMMENT
       if((ret = getc_comment(&comment, cbufptr, ebufptr)))
          return(ret);
-#ifdef PRINT_COMMENT
       fprintf(stderr, "COMMENT:\n%s\n\n", comment);
-#endif
       free(comment);
+#else
+      /* Nothing reads comments here, so skip them unallocated. */
+      if((ret = getc_skip_marker_segment(marker, cbufptr, ebufptr)))
+         return(ret);
+#endif
       break;
    default:
       fprintf(stderr,"ERROR: getc_table_wsq : Invalid table defined -> {%u}\n",
@@ -218,7 +224,8 @@ int getc_transform_table(
 {
    int ret;
    unsigned short hdr_size;              /* header size */
-   float *a_lofilt, *a_hifilt;  /* unexpanded filter coefficients */
+   float a_lofilt[MAX_DTT_FILT/2+1];     /* unexpanded filter coefficients */
+   float a_hifilt[MAX_DTT_FILT/2+1];
    unsigned char a_size;                 /* size of unexpanded coefficients */
    unsigned int cnt, shrt_dat;           /* counter and temp short data */
    unsigned char scale, sign;            /* scaling and sign parameters */
@@ -230,73 +237,49 @@ int getc_transform_table(
       return(ret);
    if((ret = getc_byte(&(dtt_table->losz), cbufptr, ebufptr)))
       return(ret);
-
-
-   /* Added 02-24-05 by MDG */
-   /* If lofilt member previously allocated ... */
-   if(dtt_table->lofilt != (float *)NULL){
-      /* Deallocate the member prior to new allocation */
-      free(dtt_table->lofilt);
-      dtt_table->lofilt = (float *)NULL;
-   }
-
-   dtt_table->lofilt = (float *)calloc(dtt_table->losz,sizeof(float));
-   if(dtt_table->lofilt == (float *)NULL) {
+   if(dtt_table->hisz == 0 || dtt_table->losz == 0) {
       fprintf(stderr,
-      "ERROR : getc_transform_table : calloc : lofilt\n");
-      return(-94);
+      "ERROR : getc_transform_table : empty filter\n");
+      return(-93);
    }
 
-   /* Added 02-24-05 by MDG */
-   /* If hifilt member previously allocated ... */
-   if(dtt_table->hifilt != (float *)NULL){
-      /* Deallocate the member prior to new allocation */
-      free(dtt_table->hifilt);
-      dtt_table->hifilt = (float *)NULL;
+
+   /* The filter members hold the largest filters a table may */
+   /* define, so they are allocated once and reused by later   */
+   /* tables; free_wsq_decoder_resources deallocates them.     */
+   if(dtt_table->lofilt == (float *)NULL) {
+      dtt_table->lofilt = (float *)calloc(MAX_DTT_FILT, sizeof(float));
+      if(dtt_table->lofilt == (float *)NULL) {
+         fprintf(stderr,
+         "ERROR : getc_transform_table : calloc : lofilt\n");
+         return(-94);
+      }
    }
 
-   dtt_table->hifilt = (float *)calloc(dtt_table->hisz,sizeof(float));
    if(dtt_table->hifilt == (float *)NULL) {
-      free(dtt_table->lofilt);
-      fprintf(stderr,
-      "ERROR : getc_transform_table : calloc : hifilt\n");
-      return(-95);
+      dtt_table->hifilt = (float *)calloc(MAX_DTT_FILT, sizeof(float));
+      if(dtt_table->hifilt == (float *)NULL) {
+         fprintf(stderr,
+         "ERROR : getc_transform_table : calloc : hifilt\n");
+         return(-95);
+      }
    }
+   dtt_table->lodef = 0;
+   dtt_table->hidef = 0;
 
    if(dtt_table->hisz % 2)
       a_size = (dtt_table->hisz + 1) / 2;
    else
       a_size = dtt_table->hisz / 2;
 
-   a_lofilt = (float *) calloc(a_size, sizeof(float));
-   if(a_lofilt == (float *)NULL) {
-      free(dtt_table->lofilt);
-      free(dtt_table->hifilt);
-      fprintf(stderr,
-      "ERROR : getc_transform_table : calloc : a_lofilt\n");
-      return(-96);
-   }
-
    a_size--;
    for(cnt = 0; cnt <= a_size; cnt++) {
-      if((ret = getc_byte(&sign, cbufptr, ebufptr))){
-         free(dtt_table->lofilt);
-         free(dtt_table->hifilt);
-         free(a_lofilt);
+      if((ret = getc_byte(&sign, cbufptr, ebufptr)))
          return(ret);
-      }
-      if((ret = getc_byte(&scale, cbufptr, ebufptr))){
-         free(dtt_table->lofilt);
-         free(dtt_table->hifilt);
-         free(a_lofilt);
+      if((ret = getc_byte(&scale, cbufptr, ebufptr)))
          return(ret);
-      }
-      if((ret = getc_uint(&shrt_dat, cbufptr, ebufptr))){
-         free(dtt_table->lofilt);
-         free(dtt_table->hifilt);
-         free(a_lofilt);
+      if((ret = getc_uint(&shrt_dat, cbufptr, ebufptr)))
          return(ret);
-      }
       a_lofilt[cnt] = (float)shrt_dat;
       while(scale > 0) {
          a_lofilt[cnt] /= 10.0;
@@ -320,42 +303,20 @@ int getc_transform_table(
       }
 
    }
-   free(a_lofilt);
 
    if(dtt_table->losz % 2)
       a_size = (dtt_table->losz + 1) / 2;
    else
       a_size = dtt_table->losz / 2;
 
-   a_hifilt = (float *) calloc(a_size, sizeof(float));
-   if(a_hifilt == (float *)NULL) {
-      free(dtt_table->lofilt);
-      free(dtt_table->hifilt);
-      fprintf(stderr,
-      "ERROR : getc_transform_table : calloc : a_hifilt\n");
-      return(-97);
-   }
-
    a_size--;
    for(cnt = 0; cnt <= a_size; cnt++) {
-      if((ret = getc_byte(&sign, cbufptr, ebufptr))){
-         free(dtt_table->lofilt);
-         free(dtt_table->hifilt);
-         free(a_hifilt);
+      if((ret = getc_byte(&sign, cbufptr, ebufptr)))
          return(ret);
-      }
-      if((ret = getc_byte(&scale, cbufptr, ebufptr))){
-         free(dtt_table->lofilt);
-         free(dtt_table->hifilt);
-         free(a_hifilt);
+      if((ret = getc_byte(&scale, cbufptr, ebufptr)))
          return(ret);
-      }
-      if((ret = getc_uint(&shrt_dat, cbufptr, ebufptr))){
-         free(dtt_table->lofilt);
-         free(dtt_table->hifilt);
-         free(a_hifilt);
+      if((ret = getc_uint(&shrt_dat, cbufptr, ebufptr)))
          return(ret);
-      }
       a_hifilt[cnt] = (float)shrt_dat;
       while(scale > 0) {
          a_hifilt[cnt] /= 10.0;
@@ -379,7 +340,6 @@ int getc_transform_table(
 
 
    }
-   free(a_hifilt);
 
    dtt_table->lodef = 1;
    dtt_table->hidef = 1;
@@ -646,49 +606,74 @@ int getc_huffman_table_wsq(
    unsigned char **cbufptr,  /* current byte in input buffer */
    unsigned char *ebufptr)   /* end of input buffer */
 {
-   int ret;
+   int ret, i, first;
+   unsigned short table_len;
    unsigned char table_id;        /* huffman table indicator */
-   unsigned char *huffbits;
-   unsigned char *huffvalues;
+   unsigned char huffbits[MAX_HUFFBITS];
+   int num_hufvals;
    int bytes_left;
 
-   /* First time, read table len. */
-   if((ret = getc_huffman_table(&table_id, &huffbits, &huffvalues,
-                               MAX_HUFFCOUNTS_WSQ, cbufptr, ebufptr,
-                               READ_TABLE_LEN, &bytes_left)))
+   /* Read the tables as getc_huffman_table does, into locals and   */
+   /* the global structure list rather than allocated buffers.      */
+   if((ret = getc_ushort(&table_len, cbufptr, ebufptr)))
       return(ret);
+   bytes_left = table_len - 2;
 
-   /* Store table into global structure list. */
-   memcpy((dht_table+table_id)->huffbits, huffbits, MAX_HUFFBITS);
-   memcpy((dht_table+table_id)->huffvalues, huffvalues,
-          MAX_HUFFCOUNTS_WSQ+1);
-   (dht_table+table_id)->tabdef = 1;
-   free(huffbits);
-   free(huffvalues);
-
-   while(bytes_left){
-      /* Read next table without rading table len. */
-      if((ret = getc_huffman_table(&table_id, &huffbits, &huffvalues,
-                                  MAX_HUFFCOUNTS_WSQ, cbufptr, ebufptr,
-                                  NO_READ_TABLE_LEN, &bytes_left)))
+   for(first = 1; first || bytes_left; first = 0){
+      /* If no bytes left ... */
+      if(bytes_left <= 0){
+         fprintf(stderr, "ERROR : getc_huffman_table_wsq : ");
+         fprintf(stderr, "no huffman table bytes remaining\n");
+         return(-2);
+      }
+
+      /* Table ID */
+      if((ret = getc_byte(&table_id, cbufptr, ebufptr)))
          return(ret);
+      bytes_left--;
+
+      if(table_id >= MAX_DHT_TABLES){
+         fprintf(stderr, "ERROR : getc_huffman_table_wsq : ");
+         fprintf(stderr, "huffman table ID = %d not in [0..%d]\n",
+                 table_id, MAX_DHT_TABLES-1);
+         return(-2);
+      }
 
       /* If table is already defined ... */
-      if((dht_table+table_id)->tabdef){
-         free(huffbits);
-         free(huffvalues);
+      if(!first && (dht_table+table_id)->tabdef){
          fprintf(stderr, "ERROR : getc_huffman_table_wsq : ");
          fprintf(stderr, "huffman table ID = %d already defined\n", table_id);
          return(-2);
       }
 
+      num_hufvals = 0;
+      /* L1 ... L16 */
+      for(i = 0; i < MAX_HUFFBITS; i++){
+         if((ret = getc_byte(&(huffbits[i]), cbufptr, ebufptr)))
+            return(ret);
+         num_hufvals += huffbits[i];
+      }
+      bytes_left -= MAX_HUFFBITS;
+
+      if(num_hufvals > MAX_HUFFCOUNTS_WSQ+1){
+         fprintf(stderr, "ERROR : getc_huffman_table_wsq : ");
+         fprintf(stderr, "num_hufvals (%d) is larger", num_hufvals);
+         fprintf(stderr, "than MAX_HUFFCOUNTS (%d)\n", MAX_HUFFCOUNTS_WSQ+1);
+         return(-4);
+      }
+
       /* Store table into global structure list. */
+      (dht_table+table_id)->tabdef = 0;
       memcpy((dht_table+table_id)->huffbits, huffbits, MAX_HUFFBITS);
-      memcpy((dht_table+table_id)->huffvalues, huffvalues,
-             MAX_HUFFCOUNTS_WSQ+1);
+      memset((dht_table+table_id)->huffvalues, 0, MAX_HUFFCOUNTS_WSQ+1);
+      /* V1,1 ... V16,16 */
+      for(i = 0; i < num_hufvals; i++){
+         if((ret = getc_byte(&((dht_table+table_id)->huffvalues[i]),
+                             cbufptr, ebufptr)))
+            return(ret);
+      }
+      bytes_left -= num_hufvals;
       (dht_table+table_id)->tabdef = 1;
-      free(huffbits);
-      free(huffvalues);
    }
 
    return(0);
@@ -965,6 +950,7 @@ int putc_nistcom_wsq(char *comment_text, const int w, const int h,
    int ret, gencomflag;
    NISTCOM *nistcom;
    char *comstr;
+   char combuf[512];    /* NISTCOM of the image attributes */
 
    /* Add Comment(s) here. */
    nistcom = (NISTCOM *)NULL;
@@ -983,6 +969,24 @@ int putc_nistcom_wsq(char *comment_text, const int w, const int h,
    }
    /* Otherwise, no comment passed ... */
 
+   /* Without a NISTCOM passed, the combined one holds the image  */
+   /* attributes alone; put it as fet2string would print it, with  */
+   /* no FET allocated.                                            */
+   if(nistcom == (NISTCOM *)NULL){
+      sprintf(combuf, "%s %d\n%s %d\n%s %d\n%s %d\n%s %d\n%s %d\n%s %s\n%s %s\n%s %f",
+              NCM_HEADER, 9, NCM_PIX_WIDTH, w, NCM_PIX_HEIGHT, h,
+              NCM_PIX_DEPTH, d, NCM_PPI, ppi, NCM_LOSSY, lossyflag,
+              NCM_COLORSPACE, "GRAY", NCM_COMPRESSION, "WSQ",
+              NCM_WSQ_RATE, r_bitrate);
+      if((ret = putc_comment(COM_WSQ, (unsigned char *)combuf, strlen(combuf),
+                             odata, oalloc, olen)))
+         return(ret);
+      if(gencomflag)
+         return(putc_comment(COM_WSQ, (unsigned char *)comment_text,
+                             strlen(comment_text), odata, oalloc, olen));
+      return(0);
+   }
+
    /* Combine image attributes to NISTCOM. */
    if((ret = combine_wsq_nistcom(&nistcom, w, h, d, ppi, lossyflag, r_bitrate))){
       if(nistcom != (NISTCOM *)NULL)
@@ -1018,17 +1022,16 @@ int putc_nistcom_wsq(char *comment_text, const int w, const int h,
 }
 
 /*****************************************************************/
-/* Get and return first NISTCOM from encoded data stream.        */
+/* Locate the text of the first NISTCOM in an encoded data      */
+/* stream, returning it in place, unterminated, with its length; */
+/* otext is NULL if there is no NISTCOM.                         */
 /*****************************************************************/
-int getc_nistcom_wsq(NISTCOM **onistcom, unsigned char *idata,
-                        const int ilen)
+int getc_nistcom_text_wsq(unsigned char **otext, int *olen,
+                          unsigned char *idata, const int ilen)
 {
-   int ret;
-   unsigned short marker;
+   int ret, cs;
+   unsigned short marker, hdr_size;
    unsigned char *cbufptr, *ebufptr;
-   NISTCOM *nistcom;
-   char *comment_text;
-   unsigned char *ucharptr;
 
    cbufptr = idata;
    ebufptr = idata + ilen;
@@ -1047,16 +1050,18 @@ int getc_nistcom_wsq(NISTCOM **onistcom, unsigned char *idata,
       if(marker == COM_WSQ){
          if(strncmp((char *)cbufptr+2 /* skip Length */,
                     NCM_HEADER, strlen(NCM_HEADER)) == 0){
-            if((ret = getc_comment(&ucharptr, &cbufptr,
-                                   ebufptr)))
-               return(ret);
-            comment_text = (char *)ucharptr;
-            if((ret = string2fet(&nistcom, comment_text))){
-			   free(comment_text);
+            if((ret = getc_ushort(&hdr_size, &cbufptr, ebufptr)))
                return(ret);
-			}
-            *onistcom = nistcom;
-			free(comment_text);
+            /* cs = hdr_size - sizeof(length value) */
+            cs = hdr_size - 2;
+            /* As getc_bytes checks the comment is in the buffer. */
+            if(cbufptr >= ebufptr-(cs-1)){
+               fprintf(stderr, "ERROR : getc_nistcom_text_wsq : ");
+               fprintf(stderr, "premature End Of Buffer\n");
+               return(-40);
+            }
+            *otext = cbufptr;
+            *olen = cs;
             return(0);
          }
       }
@@ -1069,6 +1074,7 @@ int getc_nistcom_wsq(NISTCOM **onistcom, unsigned char *idata,
    }
 
    /* NISTCOM not found ... */
-   *onistcom = (NISTCOM *)NULL;
+   *otext = (unsigned char *)NULL;
+   *olen = 0;
    return(0);
 }
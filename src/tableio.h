@@ -25,6 +25,7 @@ int putc_block_header(const int, unsigned char *, const int, int *);
 int add_comment_wsq(unsigned char **, int *, unsigned char *, const int, unsigned char *);
 int putc_nistcom_wsq(char *, const int, const int, const int, const int, const int, const float, unsigned char *, const int,
 		int *);
-int getc_nistcom_wsq(NISTCOM **, unsigned char *, const int);
+int getc_nistcom_text_wsq(unsigned char **, int *, unsigned char *,
+                 const int);
 
 #endif /* TABLEIO_H_ */
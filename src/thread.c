@@ -0,0 +1,429 @@
+/*
+ * thread.c
+ *
+ *  Portable worker threads for the WSQ library: POSIX threads, or
+ *  Win32 threads on Windows.
+ *
+ *      ROUTINES:
+#cat: create_thread_wsq - Starts a thread running a job.
+#cat:
+#cat: join_thread_wsq - Waits for a thread to finish.
+#cat:
+#cat: run_jobs_wsq - Runs an array of independent jobs on up to a
+#cat:                given number of threads, the caller included.
+#cat:
+#cat: enter_pool_wsq - Binds a pool of worker threads, kept from one call
+#cat:                to the next, to the calling thread.
+#cat:
+#cat: leave_pool_wsq - Binds back the pool bound before enter_pool_wsq.
+#cat:
+#cat: free_pool_wsq - Stops the workers of a pool and releases it.
+#cat:
+#cat: init_mutex_wsq - Sets up a mutex.
+#cat:
+#cat: free_mutex_wsq - Releases a mutex.
+#cat:
+#cat: lock_mutex_wsq - Waits for and takes a mutex.
+#cat:
+#cat: unlock_mutex_wsq - Gives back a mutex.
+#cat:
+#cat: init_cond_wsq - Sets up a condition variable.
+#cat:
+#cat: free_cond_wsq - Releases a condition variable.
+#cat:
+#cat: wait_cond_wsq - Waits on a condition variable, the mutex given
+#cat:                 back while waiting.
+#cat:
+#cat: wake_cond_wsq - Wakes every thread waiting on a condition
+#cat:                 variable.
+ */
+
+#include <stdlib.h>
+#include "thread.h"
+
+#if defined(PLATFORM_WIN32) || defined(PLATFORM_WIN64)
+#define WSQ_TLS  __declspec(thread)
+#else
+#define WSQ_TLS  __thread
+#endif
+
+typedef struct thread_start_wsq {
+   WSQ_JOB job;
+   void *arg;
+} THREAD_START_WSQ;
+
+#if defined(PLATFORM_WIN32) || defined(PLATFORM_WIN64)
+static DWORD WINAPI thread_main_wsq(LPVOID param)
+#else
+static void *thread_main_wsq(void *param)
+#endif
+{
+   THREAD_START_WSQ start;
+
+   start = *(THREAD_START_WSQ *)param;
+   free(param);
+   start.job(start.arg);
+
+   return(0);
+}
+
+/*****************************************************************/
+/* Routine to start a thread running job(arg).  Returns non-zero */
+/* if the thread could not be started.                           */
+/*****************************************************************/
+int create_thread_wsq(
+   WSQ_THREAD *othread,   /* returned thread */
+   WSQ_JOB job,           /* routine run by the thread */
+   void *arg)             /* argument passed to job */
+{
+   THREAD_START_WSQ *start;
+
+   start = (THREAD_START_WSQ *)malloc(sizeof(THREAD_START_WSQ));
+   if(start == (THREAD_START_WSQ *)NULL)
+      return(-1);
+   start->job = job;
+   start->arg = arg;
+
+#if defined(PLATFORM_WIN32) || defined(PLATFORM_WIN64)
+   *othread = CreateThread(NULL, 0, thread_main_wsq, start, 0, NULL);
+   if(*othread == NULL) {
+      free(start);
+      return(-1);
+   }
+#else
+   if(pthread_create(othread, NULL, thread_main_wsq, start) != 0) {
+      free(start);
+      return(-1);
+   }
+#endif
+
+   return(0);
+}
+
+/*****************************************************************/
+/* Routine to wait for a thread to finish and release it.        */
+/*****************************************************************/
+void join_thread_wsq(WSQ_THREAD thread)
+{
+#if defined(PLATFORM_WIN32) || defined(PLATFORM_WIN64)
+   WaitForSingleObject(thread, INFINITE);
+   CloseHandle(thread);
+#else
+   pthread_join(thread, NULL);
+#endif
+}
+
+typedef struct job_stripe_wsq {
+   WSQ_JOB job;
+   char *args;       /* first job argument */
+   int argsize;      /* bytes between job arguments */
+   int first;        /* first job of the stripe */
+   int step;         /* jobs between those of the stripe */
+   int njobs;        /* total number of jobs */
+} JOB_STRIPE_WSQ;
+
+static void run_stripe_wsq(void *param)
+{
+   JOB_STRIPE_WSQ *stripe;
+   int i;
+
+   stripe = (JOB_STRIPE_WSQ *)param;
+   for(i = stripe->first; i < stripe->njobs; i += stripe->step)
+      stripe->job(stripe->args + (size_t)i * stripe->argsize);
+}
+
+/* Worker threads kept from one call to the next: each run of jobs  */
+/* hands them its stripes, which they and the calling thread take in */
+/* turn until none is left.                                          */
+struct wsq_pool {
+   WSQ_MUTEX mutex;
+   WSQ_COND cond;            /* a run started or finished, or quit */
+   WSQ_THREAD threads[MAX_THREADS_WSQ];
+   int nthreads;             /* workers started */
+   int busy;                 /* a run holds the workers */
+   int quit;                 /* workers are to return */
+   JOB_STRIPE_WSQ *stripes;  /* stripes of the run, NULL between runs */
+   int nstripes;             /* number of stripes of the run */
+   int next;                 /* next stripe to take */
+   int left;                 /* stripes not finished */
+};
+
+/* Pool of the call the calling thread is working on, if any. */
+static WSQ_TLS WSQ_POOL *bound_pool = (WSQ_POOL *)NULL;
+
+static void pool_worker_wsq(void *param)
+{
+   WSQ_POOL *pool;
+   JOB_STRIPE_WSQ *stripe;
+
+   pool = (WSQ_POOL *)param;
+   lock_mutex_wsq(&pool->mutex);
+   while(!pool->quit) {
+      if(pool->stripes == (JOB_STRIPE_WSQ *)NULL ||
+         pool->next >= pool->nstripes) {
+         wait_cond_wsq(&pool->cond, &pool->mutex);
+         continue;
+      }
+      stripe = pool->stripes + pool->next++;
+      unlock_mutex_wsq(&pool->mutex);
+      run_stripe_wsq(stripe);
+      lock_mutex_wsq(&pool->mutex);
+      if(--pool->left == 0)
+         wake_cond_wsq(&pool->cond);
+   }
+   unlock_mutex_wsq(&pool->mutex);
+}
+
+/*****************************************************************/
+/* Routine to run the stripes of a run on the workers of a pool, */
+/* starting those it lacks, and on the calling thread, which     */
+/* runs the first and takes any other no worker has.  Returns    */
+/* non-zero, running nothing, if the pool is held by another run.*/
+/*****************************************************************/
+static int run_pool_wsq(WSQ_POOL *pool, JOB_STRIPE_WSQ *stripes,
+                        const int nstripes)
+{
+   JOB_STRIPE_WSQ *stripe;
+
+   lock_mutex_wsq(&pool->mutex);
+   if(pool->busy) {
+      unlock_mutex_wsq(&pool->mutex);
+      return(-1);
+   }
+   pool->busy = 1;
+   unlock_mutex_wsq(&pool->mutex);
+
+   /* only the run holding the pool starts workers */
+   while(pool->nthreads < nstripes - 1 &&
+         create_thread_wsq(&pool->threads[pool->nthreads], pool_worker_wsq,
+                           pool) == 0)
+      pool->nthreads++;
+
+   lock_mutex_wsq(&pool->mutex);
+   pool->stripes = stripes;
+   pool->nstripes = nstripes;
+   pool->next = 1;
+   pool->left = nstripes;
+   wake_cond_wsq(&pool->cond);
+   /* the first stripe runs on the calling thread, as without a pool */
+   unlock_mutex_wsq(&pool->mutex);
+   run_stripe_wsq(stripes);
+   lock_mutex_wsq(&pool->mutex);
+   pool->left--;
+   while(pool->next < pool->nstripes) {
+      stripe = pool->stripes + pool->next++;
+      unlock_mutex_wsq(&pool->mutex);
+      run_stripe_wsq(stripe);
+      lock_mutex_wsq(&pool->mutex);
+      pool->left--;
+   }
+   while(pool->left > 0)
+      wait_cond_wsq(&pool->cond, &pool->mutex);
+   pool->stripes = (JOB_STRIPE_WSQ *)NULL;
+   pool->busy = 0;
+   unlock_mutex_wsq(&pool->mutex);
+
+   return(0);
+}
+
+/*****************************************************************/
+/* Routine to run job on each of the njobs arguments, which are  */
+/* argsize bytes apart, using up to nthreads threads including   */
+/* the calling one.  Returns when all the jobs are done.  The    */
+/* workers of the pool bound to the calling thread run them if   */
+/* it is free, otherwise threads started for the run.  Jobs a    */
+/* thread could not be started for run on the calling thread.    */
+/*****************************************************************/
+void run_jobs_wsq(
+   WSQ_JOB job,           /* routine run for each argument */
+   void *args,            /* array of job arguments */
+   const int argsize,     /* size of each job argument */
+   const int njobs,       /* number of jobs */
+   const int nthreads)    /* most threads to use */
+{
+   JOB_STRIPE_WSQ stripes[MAX_THREADS_WSQ];
+   WSQ_THREAD threads[MAX_THREADS_WSQ];
+   int started[MAX_THREADS_WSQ];
+   int i, nstripes;
+
+   nstripes = nthreads;
+   if(nstripes > njobs)
+      nstripes = njobs;
+   if(nstripes > MAX_THREADS_WSQ)
+      nstripes = MAX_THREADS_WSQ;
+
+   if(nstripes <= 1) {
+      for(i = 0; i < njobs; i++)
+         job((char *)args + (size_t)i * argsize);
+      return;
+   }
+
+   for(i = 0; i < nstripes; i++) {
+      stripes[i].job = job;
+      stripes[i].args = (char *)args;
+      stripes[i].argsize = argsize;
+      stripes[i].first = i;
+      stripes[i].step = nstripes;
+      stripes[i].njobs = njobs;
+   }
+
+   if(bound_pool != (WSQ_POOL *)NULL &&
+      run_pool_wsq(bound_pool, stripes, nstripes) == 0)
+      return;
+
+   for(i = 1; i < nstripes; i++)
+      started[i] = (create_thread_wsq(&threads[i], run_stripe_wsq,
+                                      &stripes[i]) == 0);
+
+   run_stripe_wsq(&stripes[0]);
+
+   for(i = 1; i < nstripes; i++) {
+      if(started[i])
+         join_thread_wsq(threads[i]);
+      else
+         run_stripe_wsq(&stripes[i]);
+   }
+}
+
+/*****************************************************************/
+/* Routine to bind the pool *opool, set up on first use, to the  */
+/* calling thread for the runs of jobs of a call on up to        */
+/* nthreads threads; none is bound for a single thread.  Returns */
+/* the pool bound before, to give to leave_pool_wsq once the     */
+/* call is done.  Without memory for a pool, runs start threads  */
+/* of their own.                                                 */
+/*****************************************************************/
+WSQ_POOL *enter_pool_wsq(
+   WSQ_POOL **opool,      /* pool of the context, NULL before first use */
+   const int nthreads)    /* most threads of the call */
+{
+   WSQ_POOL *prev, *pool;
+
+   prev = bound_pool;
+   if(nthreads > 1 && *opool == (WSQ_POOL *)NULL) {
+      pool = (WSQ_POOL *)calloc(1, sizeof(WSQ_POOL));
+      if(pool != (WSQ_POOL *)NULL) {
+         if(init_mutex_wsq(&pool->mutex) == 0) {
+            if(init_cond_wsq(&pool->cond) == 0)
+               *opool = pool;
+            else
+               free_mutex_wsq(&pool->mutex);
+         }
+         if(*opool == (WSQ_POOL *)NULL)
+            free(pool);
+      }
+   }
+   bound_pool = nthreads > 1 ? *opool : (WSQ_POOL *)NULL;
+
+   return(prev);
+}
+
+void leave_pool_wsq(WSQ_POOL *prev)
+{
+   bound_pool = prev;
+}
+
+/*****************************************************************/
+/* Routine to stop and join the workers of a pool, which no run  */
+/* may hold, and release it.                                     */
+/*****************************************************************/
+void free_pool_wsq(WSQ_POOL *pool)
+{
+   int i;
+
+   if(pool == (WSQ_POOL *)NULL)
+      return;
+
+   lock_mutex_wsq(&pool->mutex);
+   pool->quit = 1;
+   wake_cond_wsq(&pool->cond);
+   unlock_mutex_wsq(&pool->mutex);
+   for(i = 0; i < pool->nthreads; i++)
+      join_thread_wsq(pool->threads[i]);
+
+   free_cond_wsq(&pool->cond);
+   free_mutex_wsq(&pool->mutex);
+   free(pool);
+}
+
+/*****************************************************************/
+/* Routines to set up, release, take and give back a mutex, one  */
+/* not held by the calling thread for lock_mutex_wsq.  Mutexes   */
+/* may also be set up statically with WSQ_MUTEX_INIT.            */
+/*****************************************************************/
+int init_mutex_wsq(WSQ_MUTEX *mutex)
+{
+#if defined(PLATFORM_WIN32) || defined(PLATFORM_WIN64)
+   InitializeSRWLock(mutex);
+   return(0);
+#else
+   return(pthread_mutex_init(mutex, NULL) != 0 ? -1 : 0);
+#endif
+}
+
+void free_mutex_wsq(WSQ_MUTEX *mutex)
+{
+#if !defined(PLATFORM_WIN32) && !defined(PLATFORM_WIN64)
+   pthread_mutex_destroy(mutex);
+#endif
+}
+
+void lock_mutex_wsq(WSQ_MUTEX *mutex)
+{
+#if defined(PLATFORM_WIN32) || defined(PLATFORM_WIN64)
+   AcquireSRWLockExclusive(mutex);
+#else
+   pthread_mutex_lock(mutex);
+#endif
+}
+
+void unlock_mutex_wsq(WSQ_MUTEX *mutex)
+{
+#if defined(PLATFORM_WIN32) || defined(PLATFORM_WIN64)
+   ReleaseSRWLockExclusive(mutex);
+#else
+   pthread_mutex_unlock(mutex);
+#endif
+}
+
+/*****************************************************************/
+/* Routines to set up and release a condition variable, to wait  */
+/* on one with its mutex held, which is given back while waiting */
+/* and held again on return, and to wake all its waiters.        */
+/* Waits may return spuriously: callers test their condition in  */
+/* a loop.                                                       */
+/*****************************************************************/
+int init_cond_wsq(WSQ_COND *cond)
+{
+#if defined(PLATFORM_WIN32) || defined(PLATFORM_WIN64)
+   InitializeConditionVariable(cond);
+   return(0);
+#else
+   return(pthread_cond_init(cond, NULL) != 0 ? -1 : 0);
+#endif
+}
+
+void free_cond_wsq(WSQ_COND *cond)
+{
+#if !defined(PLATFORM_WIN32) && !defined(PLATFORM_WIN64)
+   pthread_cond_destroy(cond);
+#endif
+}
+
+void wait_cond_wsq(WSQ_COND *cond, WSQ_MUTEX *mutex)
+{
+#if defined(PLATFORM_WIN32) || defined(PLATFORM_WIN64)
+   SleepConditionVariableSRW(cond, mutex, INFINITE, 0);
+#else
+   pthread_cond_wait(cond, mutex);
+#endif
+}
+
+void wake_cond_wsq(WSQ_COND *cond)
+{
+#if defined(PLATFORM_WIN32) || defined(PLATFORM_WIN64)
+   WakeAllConditionVariable(cond);
+#else
+   pthread_cond_broadcast(cond);
+#endif
+}
@@ -0,0 +1,52 @@
+/*
+ * thread.h
+ *
+ *  Portable worker threads for the WSQ library.
+ */
+
+#ifndef THREAD_H_
+#define THREAD_H_
+
+#include "Config.h"
+
+#if defined(PLATFORM_WIN32) || defined(PLATFORM_WIN64)
+#include <windows.h>
+typedef HANDLE WSQ_THREAD;
+typedef SRWLOCK WSQ_MUTEX;
+typedef CONDITION_VARIABLE WSQ_COND;
+#define WSQ_MUTEX_INIT   SRWLOCK_INIT
+#define WSQ_COND_INIT    CONDITION_VARIABLE_INIT
+#else
+#include <pthread.h>
+typedef pthread_t WSQ_THREAD;
+typedef pthread_mutex_t WSQ_MUTEX;
+typedef pthread_cond_t WSQ_COND;
+#define WSQ_MUTEX_INIT   PTHREAD_MUTEX_INITIALIZER
+#define WSQ_COND_INIT    PTHREAD_COND_INITIALIZER
+#endif
+
+/* Most threads a single library call runs at once. */
+#define MAX_THREADS_WSQ  64
+
+typedef void (*WSQ_JOB)(void *);
+
+/* Worker threads a context keeps from one call to the next. */
+typedef struct wsq_pool WSQ_POOL;
+
+/* thread.c */
+int create_thread_wsq(WSQ_THREAD *, WSQ_JOB, void *);
+void join_thread_wsq(WSQ_THREAD);
+void run_jobs_wsq(WSQ_JOB, void *, const int, const int, const int);
+WSQ_POOL *enter_pool_wsq(WSQ_POOL **, const int);
+void leave_pool_wsq(WSQ_POOL *);
+void free_pool_wsq(WSQ_POOL *);
+int init_mutex_wsq(WSQ_MUTEX *);
+void free_mutex_wsq(WSQ_MUTEX *);
+void lock_mutex_wsq(WSQ_MUTEX *);
+void unlock_mutex_wsq(WSQ_MUTEX *);
+int init_cond_wsq(WSQ_COND *);
+void free_cond_wsq(WSQ_COND *);
+void wait_cond_wsq(WSQ_COND *, WSQ_MUTEX *);
+void wake_cond_wsq(WSQ_COND *);
+
+#endif /* THREAD_H_ */
@@ -44,14 +44,20 @@ identified are necessarily the best available for the purpose.
 #cat:
 #cat: quant_block_sizes - Quantizes an image's subband block.
 #cat:
-#cat: unquantize - Unquantizes an image's wavelet subbands.
-#cat:
+#cat: init_coef_writer_wsq - Starts writing decoded coefficients,
+#cat:                  dequantized, into a range of subbands.
+#cat: next_coef_row_wsq - Moves a coefficient writer to its next subband
+#cat:                  row.
+#cat: coef_writer_done_wsq - Tells whether a coefficient writer has
+#cat:                  filled its subbands.
 #cat: wsq_decompose - Computes the wavelet decomposition of an input image.
 #cat:
 #cat: get_lets - Compute the wavelet subband decomposition for the image.
 #cat:
 #cat: wsq_reconstruct - Reconstructs a lossy floating point pixmap from
 #cat:                  a WSQ compressed datastream.
+#cat: wsq_reconstruct_window - Reconstructs a window of a lossy floating
+#cat:                  point pixmap only.
 #cat: join_lets - Reconstruct the image from the wavelet subbands.
 #cat:
 #cat: int_sign - Get the sign of the sythesis filter coefficients.
@@ -65,12 +71,17 @@ identified are necessarily the best available for the purpose.
 
 ***********************************************************************/
 
+#include <limits.h>
 #include <math.h>
 #include <string.h>
 #include "util.h"
 #include "defs.h"
 #include "tableio.h"
 #include "dataio.h"
+#include "wavelet.h"
+#include "scratch.h"
+#include "convert.h"
+#include "quant.h"
 
 
 /******************************************************************/
@@ -84,7 +95,8 @@ identified are necessarily the best available for the purpose.
 /******************************************************************/
 /* This routine converts the unsigned char data to float.  In the */
 /* process it shifts and scales the data so the values range from */
-/* +/- 128.0                                                      */
+/* +/- 128.0.  If fip is NULL only the shift and scale are found,  */
+/* for wsq_decompose to convert the pixels as it reads them.      */
 /******************************************************************/
 void conv_img_2_flt(
    float *fip,         /* output float image data  */
@@ -94,22 +106,14 @@ void conv_img_2_flt(
    const int num_pix)  /* num pixels in image      */
 
 {
-   int cnt;                     /* pixel cnt */
+   unsigned int usum;           /* sum of pixel values, wrapped */
    int sum;                     /* sum of pixel values */
    float mean;                  /* mean pixel value */
    int low, high;               /* low/high pixel values */
    float low_diff, high_diff;   /* new low/high pixels values shifting */
 
-   sum = 0;
-   low = 255;
-   high = 0;
-   for(cnt = 0; cnt < num_pix; cnt++) {
-      if(data[cnt] > high)
-         high = data[cnt];
-      if(data[cnt] < low)
-         low = data[cnt];
-      sum += data[cnt];
-   }
+   pixel_stats_wsq(&usum, &low, &high, data, num_pix);
+   sum = (int)usum;
 
    mean = (float) sum / (float)num_pix;
    *m_shift = mean;
@@ -124,9 +128,8 @@ void conv_img_2_flt(
 
    *r_scale /= (float)128.0;
 
-   for(cnt = 0; cnt < num_pix; cnt++) {
-      fip[cnt] = ((float)data[cnt] - *m_shift) / *r_scale;
-   }
+   if(fip != (float *)NULL)
+      pixels_2_flt_wsq(fip, data, num_pix, *m_shift, *r_scale);
 }
 
 /*********************************************************/
@@ -140,28 +143,13 @@ void conv_img_2_uchar(
    const float m_shift,           /* shifting parameter     */
    const float r_scale)           /* scaling parameter      */
 {
-   int r, c;       /* row/column counters */
-   float img_tmp;  /* temp image data store */
-
-   for (r = 0; r < height; r++) {
-      for (c = 0; c < width; c++) {
-         img_tmp = (*img * r_scale) + m_shift;
-         img_tmp += 0.5;
-         if (img_tmp < 0.0)
-            *data = 0; /* neg pix poss after quantization */
-         else if (img_tmp > 255.0)
-            *data = 255;
-         else
-            *data = (unsigned char)img_tmp;
-
-         ++img;
-         ++data;
-      }
-   }
+   /* neg pix poss after quantization, clipped to 0 */
+   flt_2_pixels_wsq(data, img, width * height, m_shift, r_scale);
 }
 
 /**********************************************************/
 /* This routine calculates the variances of the subbands. */
+/* With WSQ_PRECISION_FAST the sums are kept in double.   */
 /**********************************************************/
 void variance(
    QUANT_VALS *quant_vals, /* quantization parameters */
@@ -169,23 +157,18 @@ void variance(
    const int q_treelen,    /* length of q_tree        */
    float *fip,             /* image pointer           */
    const int width,        /* image width             */
-   const int height)       /* image height            */
+   const int height,       /* image height            */
+   const int precision)    /* WSQ_PRECISION_*         */
 {
    float *fp;              /* temp image pointer */
    int cvr;                /* subband counter */
    int lenx = 0, leny = 0; /* dimensions of area to calculate variance */
    int skipx, skipy;       /* pixels to skip to get to area for
                               variance calculation */
-   int row, col;           /* dimension counters */
-   float ssq;             /* sum of squares */
-   float sum2;            /* variance calculation parameter */
-   float sum_pix;         /* sum of pixels */
    
 
    for(cvr = 0; cvr < NUM_SUBBANDS; cvr++) {
       fp = fip + (q_tree[cvr].y * width) + q_tree[cvr].x;
-      ssq = 0.0;
-      sum_pix = 0.0;
 
       skipx = q_tree[cvr].lenx / 8;
       skipy = (9 * q_tree[cvr].leny)/32;
@@ -194,15 +177,8 @@ void variance(
       leny = (7 * q_tree[cvr].leny)/16;
 
       fp += (skipy * width) + skipx;
-      for(row = 0; row < leny; row++, fp += (width - lenx)) {
-         for(col = 0; col < lenx; col++) {
-            sum_pix += *fp;
-            ssq += *fp * *fp;
-            fp++;
-         }
-      }
-      sum2 = (sum_pix * sum_pix)/(lenx * leny);
-      quant_vals->var[cvr] = (float)((ssq - sum2)/((lenx * leny)-1.0));
+      quant_vals->var[cvr] = subband_variance_wsq(fp, lenx, leny, width,
+                                                  precision);
    }
 }
 
@@ -210,20 +186,20 @@ void variance(
 /* This routine quantizes the wavelet subbands. */
 /************************************************/
 int quantize(
-   short **osip,           /* quantized output             */
+   short *sip,             /* quantized output, width*height long */
    int *ocmp_siz,          /* size of quantized output     */
    QUANT_VALS *quant_vals, /* quantization parameters      */
    Q_TREE q_tree[],        /* quantization "tree"          */
    const int q_treelen,    /* size of q_tree               */
    float *fip,             /* floating point image pointer */
    const int width,        /* image width                  */
-   const int height)       /* image height                 */
+   const int height,       /* image height                 */
+   const int precision)    /* WSQ_PRECISION_*              */
 {
    int i;                 /* temp counter */
    int j;                 /* interation index */
    float *fptr;           /* temp image pointer */
-   short *sip, *sptr;     /* pointers to quantized image */
-   int row, col;          /* temp image characteristic parameters */
+   short *sptr;           /* pointer to quantized image */
    int cnt;               /* subband counter */
    float zbin;            /* zero bin size */
    float A[NUM_SUBBANDS]; /* subband "weights" for quantization */
@@ -275,10 +251,6 @@ int quantize(
 
 
    /* Set up output buffer. */
-   if((sip = (short *) calloc(width*height, sizeof(short))) == NULL) {
-      fprintf(stderr,"ERROR : quantize : calloc : sip\n");
-      return(-90);
-   }
    sptr = sip;
 
    /* Set up 'm' table (these values are the reciprocal of 'm' in */
@@ -380,35 +352,25 @@ int quantize(
 
          zbin = quant_vals->qzbs[cnt] / 2.0;
 
-         for(row = 0;
-            row < q_tree[cnt].leny;
-            row++, fptr += width - q_tree[cnt].lenx){
-            for(col = 0; col < q_tree[cnt].lenx; col++) {
-               if(-zbin <= *fptr && *fptr <= zbin)
-                  *sptr = 0;
-               else if(*fptr > 0.0)
-                  *sptr = (short)(((*fptr-zbin)/quant_vals->qbss[cnt]) + 1.0);
-               else
-                  *sptr = (short)(((*fptr+zbin)/quant_vals->qbss[cnt]) - 1.0);
-               sptr++;
-               fptr++;
-            }
-         }
+         /* Branchless, and with WSQ_PRECISION_FAST multiplying */
+         /* by the reciprocal of the bin width, see quant.c.    */
+         quantize_subband_wsq(sptr, fptr, q_tree[cnt].lenx,
+                              q_tree[cnt].leny, width, zbin,
+                              quant_vals->qbss[cnt], precision);
+         sptr += q_tree[cnt].lenx * q_tree[cnt].leny;
       }
    }
 
-   *osip = sip;
    *ocmp_siz = sptr - sip;
    return(0);
 }
 
 /************************************************************************/
-/* Compute quantized WSQ subband block sizes.                           */
+/* Compute quantized WSQ subband block sizes, with the quantizer bin    */
+/* widths qbss of the subbands.                                         */
 /************************************************************************/
-void quant_block_sizes(int *oqsize1, int *oqsize2, int *oqsize3,
-                 QUANT_VALS *quant_vals,
-                 W_TREE w_tree[], const int w_treelen,
-                 Q_TREE q_tree[], const int q_treelen)
+static void qbss_block_sizes(int *oqsize1, int *oqsize2, int *oqsize3,
+                 const float *qbss, W_TREE w_tree[], Q_TREE q_tree[])
 {
    int qsize1, qsize2, qsize3;
    int node;
@@ -422,15 +384,15 @@ void quant_block_sizes(int *oqsize1, int *oqsize2, int *oqsize3,
 
    /* Adjust size of quantized WSQ subband blocks. */
    for (node = 0; node < STRT_SUBBAND_2; node++)
-      if(quant_vals->qbss[node] == 0.0)
+      if(qbss[node] == 0.0)
          qsize1 -= (q_tree[node].lenx * q_tree[node].leny);
 
    for (node = STRT_SUBBAND_2; node < STRT_SUBBAND_3; node++)
-      if(quant_vals->qbss[node] == 0.0)
+      if(qbss[node] == 0.0)
           qsize2 -= (q_tree[node].lenx * q_tree[node].leny);
 
    for (node = STRT_SUBBAND_3; node < STRT_SUBBAND_DEL; node++)
-      if(quant_vals->qbss[node] == 0.0)
+      if(qbss[node] == 0.0)
          qsize3 -= (q_tree[node].lenx * q_tree[node].leny);
 
    *oqsize1 = qsize1;
@@ -438,99 +400,329 @@ void quant_block_sizes(int *oqsize1, int *oqsize2, int *oqsize3,
    *oqsize3 = qsize3;
 }
 
-/*************************************/
-/* Routine to unquantize image data. */
-/*************************************/
-int unquantize(
-   float **ofip,         /* floating point image pointer         */
-   const DQT_TABLE *dqt_table, /* quantization table structure   */
-   Q_TREE q_tree[],      /* quantization table structure         */
-   const int q_treelen,  /* size of q_tree                       */
-   short *sip,           /* quantized image pointer              */
+/************************************************************************/
+/* Compute quantized WSQ subband block sizes.                           */
+/************************************************************************/
+void quant_block_sizes(int *oqsize1, int *oqsize2, int *oqsize3,
+                 QUANT_VALS *quant_vals,
+                 W_TREE w_tree[], const int w_treelen,
+                 Q_TREE q_tree[], const int q_treelen)
+{
+   qbss_block_sizes(oqsize1, oqsize2, oqsize3, quant_vals->qbss,
+                    w_tree, q_tree);
+}
+
+/*************************************************************/
+/* Routine to start writing the coefficients of subbands     */
+/* first to last-1, as the huffman decoder reads them, into  */
+/* the width by height floating point image, which the       */
+/* caller zeroes, flagging the rows of subbands non-zero     */
+/* coefficients are written to in bands, which the caller    */
+/* zeroes too.  The subbands are entered as the first of     */
+/* their coefficients comes, so the DQT table only has to be */
+/* read by then.                                             */
+/*************************************************************/
+void init_coef_writer_wsq(
+   COEF_WRITER_WSQ *writer, /* writer to initialize             */
+   float *fip,           /* floating point image, width*height long */
+   unsigned long long *bands, /* non-zero subbands, height long */
    const int width,      /* image width                          */
-   const int height)     /* image height                         */
+   const int height,     /* image height                         */
+   const DQT_TABLE *dqt_table, /* quantization table structure   */
+   const Q_TREE *q_tree, /* quantization table structure         */
+   const int first,      /* first subband                        */
+   const int last)       /* one past the last subband            */
+{
+   writer->fip = fip;
+   writer->bands = bands;
+   writer->width = width;
+   writer->height = height;
+   writer->dqt_table = dqt_table;
+   writer->q_tree = q_tree;
+   writer->band = first - 1;
+   writer->last = last;
+   writer->fptr = (float *)NULL;
+   writer->left = 0;
+   writer->rows = 0;
+   writer->lenx = 0;
+}
+
+/*************************************************************/
+/* Routine to move a coefficient writer past a full row, to  */
+/* the next row of its subband or the first of the next      */
+/* subband in the file.  Subbands outside the image, the low */
+/* pass region of a reduced resolution decode, are read but  */
+/* not written.  Coefficients past the last subband of the   */
+/* file are dropped, as NBIS did; past those of a writer of  */
+/* fewer subbands they return -53, unreported, for the       */
+/* caller to decode its blocks in order instead.             */
+/*************************************************************/
+int next_coef_row_wsq(COEF_WRITER_WSQ *writer)
 {
-   float *fip;    /* floating point image */
-   int row, col;  /* cover counter and row/column counters */
-   float C;       /* quantizer bin center */
-   float *fptr;   /* image pointers */
-   short *sptr;
-   int cnt;       /* subband counter */
-
-   if((fip = (float *) calloc(width*height, sizeof(float))) == NULL) {
-      fprintf(stderr,"ERROR : unquantize : calloc : fip\n");
-      return(-91);
+   const Q_TREE *qt;
+   int band;
+
+   if(writer->rows > 0) {
+      writer->rows--;
+      writer->left = writer->lenx;
+      if(writer->fptr != (float *)NULL)
+         writer->fptr += writer->width - writer->lenx;
+      writer->y++;
+      return(0);
    }
-   if(dqt_table->dqt_def != 1) {
+
+   if(writer->dqt_table->dqt_def != 1) {
       fprintf(stderr,
-      "ERROR: unquantize : quantization table parameters not defined!\n");
+      "ERROR: next_coef_row_wsq : quantization table parameters not defined!\n");
       return(-92);
    }
+   for(band = writer->band + 1; band < writer->last; band++)
+      if(writer->dqt_table->q_bin[band] != 0.0 &&
+         writer->q_tree[band].lenx > 0 && writer->q_tree[band].leny > 0)
+         break;
+   if(band >= writer->last) {
+      if(writer->last < NUM_SUBBANDS)
+         return(-53);
+      writer->band = writer->last;
+      writer->fptr = (float *)NULL;
+      writer->left = INT_MAX;
+      writer->rows = 0;
+      return(0);
+   }
 
-   sptr = sip;
-   C = dqt_table->bin_center;
-   for(cnt = 0; cnt < NUM_SUBBANDS; cnt++) {
-      if(dqt_table->q_bin[cnt] == 0.0)
-         continue;
-      fptr = fip + (q_tree[cnt].y * width) + q_tree[cnt].x;
+   qt = writer->q_tree + band;
+   writer->band = band;
+   writer->lenx = qt->lenx;
+   writer->left = qt->lenx;
+   writer->rows = qt->leny - 1;
+   writer->q_bin = writer->dqt_table->q_bin[band];
+   writer->z_half = writer->dqt_table->z_bin[band] / 2.0;
+   writer->C = writer->dqt_table->bin_center;
+   writer->y = qt->y;
+   writer->bit = 1ull << band;
+   if(qt->x + qt->lenx > writer->width || qt->y + qt->leny > writer->height)
+      writer->fptr = (float *)NULL;
+   else
+      writer->fptr = writer->fip + (qt->y * writer->width) + qt->x;
 
-      for(row = 0;
-          row < q_tree[cnt].leny;
-          row++, fptr += width - q_tree[cnt].lenx){
-         for(col = 0; col < q_tree[cnt].lenx; col++) {
-            if(*sptr == 0)
-               *fptr = 0.0;
-            else if(*sptr > 0)
-               *fptr = (dqt_table->q_bin[cnt] * ((float)*sptr - C))
-                    + (dqt_table->z_bin[cnt] / 2.0);
-            else if(*sptr < 0)
-               *fptr = (dqt_table->q_bin[cnt] * ((float)*sptr + C))
-                    - (dqt_table->z_bin[cnt] / 2.0);
-            else {
-               fprintf(stderr,
-               "ERROR : unquantize : invalid quantization pixel value\n");
-               return(-93);
-            }
-            fptr++;
-            sptr++;
+   return(0);
+}
+
+/*************************************************************/
+/* Routine to tell whether a coefficient writer has written  */
+/* every coefficient of its subbands.                        */
+/*************************************************************/
+int coef_writer_done_wsq(COEF_WRITER_WSQ *writer)
+{
+   int band;
+
+   if(writer->band >= writer->last)
+      return(1);
+   if(writer->left > 0 || writer->rows > 0)
+      return(0);
+   for(band = writer->band + 1; band < writer->last; band++)
+      if(writer->dqt_table->q_bin[band] != 0.0 &&
+         writer->q_tree[band].lenx > 0 && writer->q_tree[band].leny > 0)
+         return(0);
+
+   return(1);
+}
+
+/************************************************************************/
+/* Routine to find where quadrant q of a node is, q being its column    */
+/* band plus twice its row band, band 0 being the lowpass half.         */
+/************************************************************************/
+static void node_quadrant(W_TREE *wt, const int q, int *x, int *y,
+                          int *lenx, int *leny)
+{
+   /* The highpass half comes first when inverted. */
+   *lenx = (q & 1) ? wt->lenx / 2 : (wt->lenx + 1) / 2;
+   *leny = (q & 2) ? wt->leny / 2 : (wt->leny + 1) / 2;
+   *x = wt->x + (((q & 1) != 0) != (wt->inv_rw != 0) ? wt->lenx - *lenx : 0);
+   *y = wt->y + (((q & 2) != 0) != (wt->inv_cl != 0) ? wt->leny - *leny : 0);
+}
+
+/************************************************************************/
+/* Routine to find the quadrants of a node the encoder keeps, those     */
+/* not made only of the subbands from STRT_SUBBAND_DEL on, which are    */
+/* never quantized.  Returns the number kept.                           */
+/************************************************************************/
+static int node_kept_quadrants(int keep[4], W_TREE *wt, Q_TREE q_tree[])
+{
+   int q, i, x, y, lenx, leny, nkept;
+   Q_TREE *qt;
+
+   nkept = 0;
+   for(q = 0; q < 4; q++) {
+      node_quadrant(wt, q, &x, &y, &lenx, &leny);
+      keep[q] = 1;
+      for(i = 0; i < Q_TREELEN; i++) {
+         qt = q_tree + i;
+         if(qt->x < x + lenx && x < qt->x + qt->lenx &&
+            qt->y < y + leny && y < qt->y + qt->leny) {
+            keep[q] = i < STRT_SUBBAND_DEL;
+            if(keep[q])
+               break;
          }
       }
+      nkept += keep[q];
    }
 
-   *ofip = fip;
-   return(0);
+   return(nkept);
+}
+
+/************************************************************************/
+/* Routine to split the rows, then the columns, of a node through its   */
+/* plans, computing the quadrants flagged in keep only.  The rows are   */
+/* read from pixels, shifted and scaled, if pixels is not NULL.         */
+/************************************************************************/
+static void node_lets_passes(float *fdata_bse, float *fdata1,
+                             unsigned char *pixels, const float m_shift,
+                             const float r_scale, W_TREE *wt,
+                             LETS_PLAN *rows, LETS_PLAN *cols,
+                             const int keep[4], const int width,
+                             float *lines, const int nthreads)
+{
+   int q, cb, rb, x[4], y[4], lenx[4], leny[4], o0, o1;
+
+   for(q = 0; q < 4; q++) {
+      node_quadrant(wt, q, &x[q], &y[q], &lenx[q], &leny[q]);
+      x[q] -= wt->x;
+      y[q] -= wt->y;
+   }
+
+   /* Rows, to the column bands kept. */
+   o0 = wt->lenx;
+   o1 = 0;
+   for(cb = 0; cb < 2; cb++)
+      if(keep[cb] || keep[cb+2]) {
+         o0 = x[cb] < o0 ? x[cb] : o0;
+         o1 = x[cb] + lenx[cb] > o1 ? x[cb] + lenx[cb] : o1;
+      }
+   if(o0 < o1 && pixels != (unsigned char *)NULL)
+      pixel_lets_rows(fdata1, pixels, wt->leny, width, rows, o0, o1,
+                      m_shift, r_scale, lines, nthreads);
+   else if(o0 < o1)
+      window_lets_rows(fdata1, fdata_bse, wt->leny, width, rows, o0, o1,
+                       lines, nthreads);
+
+   /* Columns a whole row of samples at a time, once all the rows */
+   /* of the node are done: of each column band, to the row bands */
+   /* kept.                                                        */
+   if(keep[0] && keep[1] && keep[2] && keep[3]) {
+      split_lets_cols(fdata_bse, fdata1, wt->lenx, width, cols, nthreads);
+      return;
+   }
+   for(cb = 0; cb < 2; cb++) {
+      o0 = wt->leny;
+      o1 = 0;
+      for(rb = 0; rb < 2; rb++)
+         if(keep[cb + 2*rb]) {
+            o0 = y[cb + 2*rb] < o0 ? y[cb + 2*rb] : o0;
+            o1 = y[cb + 2*rb] + leny[cb + 2*rb] > o1 ?
+                 y[cb + 2*rb] + leny[cb + 2*rb] : o1;
+         }
+      if(o0 < o1 && lenx[cb] > 0)
+         window_lets_cols(fdata_bse + x[cb], fdata1 + x[cb], lenx[cb], width,
+                          cols, o0, o1, nthreads);
+   }
 }
 
 /************************************************************************/
-/* WSQ decompose the image.  NOTE: this routine modifies and returns    */
-/* the results in "fdata".                                              */
+/* WSQ decompose the image, the passes of large nodes split across up  */
+/* to nthreads threads.  The image is read from pixels if not NULL,    */
+/* each pixel x taken for (x - m_shift) / r_scale as conv_img_2_flt    */
+/* converts it; the planned row pass of the first node reads them      */
+/* directly.  The quadrants of nodes made only of subbands the encoder */
+/* discards, from STRT_SUBBAND_DEL on, are left out of the planned     */
+/* passes, and undefined on return.  NOTE: this routine modifies and   */
+/* returns the results in "fdata".                                     */
 /************************************************************************/
 int wsq_decompose(float *fdata, const int width, const int height,
-                  W_TREE w_tree[], const int w_treelen,
+                  unsigned char *pixels, const float m_shift,
+                  const float r_scale, W_TREE w_tree[], const int w_treelen,
                   float *hifilt, const int hisz,
-                  float *lofilt, const int losz)
+                  float *lofilt, const int losz, const int precision,
+                  WAVELET_PLAN *wplan, Q_TREE q_tree[], const int nthreads,
+                  WSQ_SCRATCH *scratch)
 {
-   int num_pix, node;
-   float *fdata1, *fdata_bse;
-
-   num_pix = width * height;
-   /* Allocate temporary floating point pixmap. */
-   if((fdata1 = (float *) malloc(num_pix*sizeof(float))) == NULL) {
-      fprintf(stderr,"ERROR : wsq_decompose : malloc : fdata1\n");
-      return(-94);
+   int ret, node, njobs;
+   size_t mark;
+   float *fdata1, *fdata_bse, *lines;
+   WAVELET_PLAN local;
+   int keep[4];              /* quadrants of a node the encoder keeps */
+
+   /* Plan the passes here unless the caller planned them. */
+   if(wplan == (WAVELET_PLAN *)NULL) {
+      if((ret = build_wavelet_plan(&local, w_tree, w_treelen,
+                   hifilt, hisz, lofilt, losz, 0, precision)))
+         return(ret);
+      wplan = &local;
    }
 
-   /* Compute the Wavelet image decomposition. */
-   for(node = 0; node < w_treelen; node++) {
-      fdata_bse = fdata + (w_tree[node].y * width) + w_tree[node].x;
-      get_lets(fdata1, fdata_bse, w_tree[node].leny, w_tree[node].lenx,
-               width, 1, hifilt, hisz, lofilt, losz, w_tree[node].inv_rw);
-      get_lets(fdata_bse, fdata1, w_tree[node].lenx, w_tree[node].leny,
-               1, width, hifilt, hisz, lofilt, losz, w_tree[node].inv_cl);
+   /* The pixels as floats, unless the first row pass reads them. */
+   if(pixels != (unsigned char *)NULL &&
+      (wplan->lift || !wplan->rows[0]->valid || !wplan->cols[0]->valid ||
+       w_tree[0].x != 0 || w_tree[0].y != 0)) {
+      pixels_2_flt_wsq(fdata, pixels, width * height, m_shift, r_scale);
+      pixels = (unsigned char *)NULL;
    }
-   free(fdata1);
 
-   return(0);
+   /* Temporary floating point pixmap and lines from the scratch, */
+   /* lines for each job the passes may be split in, twice as     */
+   /* long for the pixels read as floats.                         */
+   mark = scratch->used;
+   ret = 0;
+   njobs = lets_max_jobs(nthreads);
+   if(wplan->lift) {
+      /* The standard 9/7 bank may be lifted in place. */
+      lines = (float *)alloc_scratch_wsq(scratch, (size_t)njobs *
+                 (width > height ? width : height) * LIFT_STRIP * sizeof(float));
+      if(lines == NULL)
+         ret = -94;
+      else
+         lift_decompose_97(fdata, width, height, w_tree, w_treelen, lines,
+                           nthreads);
+   }
+   else {
+      fdata1 = (float *)alloc_scratch_wsq(scratch,
+                                          width * height * sizeof(float));
+      lines = (float *)alloc_scratch_wsq(scratch,
+                              (size_t)njobs * (2*width+1) * sizeof(float));
+      if(fdata1 == NULL || lines == NULL)
+         ret = -94;
+      /* Compute the Wavelet image decomposition. */
+      for(node = 0; node < w_treelen && ret == 0; node++) {
+         fdata_bse = fdata + (w_tree[node].y * width) + w_tree[node].x;
+         /* Through the planned vector kernels when possible. */
+         if(wplan->rows[node]->valid && wplan->cols[node]->valid) {
+            node_kept_quadrants(keep, w_tree + node, q_tree);
+            node_lets_passes(fdata_bse, fdata1, node == 0 ? pixels :
+                             (unsigned char *)NULL, m_shift, r_scale,
+                             w_tree + node, wplan->rows[node],
+                             wplan->cols[node], keep, width, lines,
+                             nthreads);
+            continue;
+         }
+         if(wplan->rows[node]->valid)
+            split_lets_rows(fdata1, fdata_bse, w_tree[node].leny, width,
+                            wplan->rows[node], lines, nthreads);
+         else
+            get_lets(fdata1, fdata_bse, w_tree[node].leny, w_tree[node].lenx,
+                     width, 1, hifilt, hisz, lofilt, losz, w_tree[node].inv_rw);
+         if(wplan->cols[node]->valid)
+            split_lets_cols(fdata_bse, fdata1, w_tree[node].lenx, width,
+                            wplan->cols[node], nthreads);
+         else
+            get_lets(fdata_bse, fdata1, w_tree[node].lenx, w_tree[node].leny,
+                     1, width, hifilt, hisz, lofilt, losz, w_tree[node].inv_cl);
+      }
+   }
+   scratch->used = mark;
+   if(wplan == &local)
+      free_wavelet_plan(&local);
+
+   return(ret);
 }
 
 /************************************************************/
@@ -747,15 +939,158 @@ void get_lets(
 }
 
 /************************************************************************/
-/* WSQ reconstructs the image.  NOTE: this routine modifies and returns */
-/* the results in "fdata".                                              */
+/* Routine to find what each quadrant of a node is: a node after it in  */
+/* the tree, quad set to its index, or a subband, quad set to -1 - its  */
+/* index.  Quadrants are indexed by their column band plus twice their  */
+/* row band, band 0 being the lowpass half.  Quadrants that are neither */
+/* are set to Q_TREELEN, never taken for zero.                          */
+/************************************************************************/
+static void node_quadrants(int quad[4], W_TREE w_tree[], const int w_treelen,
+                           const int node, Q_TREE q_tree[])
+{
+   int q, i, x, y, lenx, leny;
+
+   for(q = 0; q < 4; q++) {
+      node_quadrant(w_tree + node, q, &x, &y, &lenx, &leny);
+      quad[q] = Q_TREELEN;
+      for(i = node + 1; i < w_treelen; i++)
+         if(w_tree[i].x == x && w_tree[i].y == y &&
+            w_tree[i].lenx == lenx && w_tree[i].leny == leny)
+            quad[q] = i;
+      for(i = 0; i < Q_TREELEN && quad[q] == Q_TREELEN; i++)
+         if(q_tree[i].x == x && q_tree[i].y == y &&
+            q_tree[i].lenx == lenx && q_tree[i].leny == leny)
+            quad[q] = -1 - i;
+   }
+}
+
+/************************************************************************/
+/* Routine to flag the zero rows of the column band cb of a node, from  */
+/* the rows of its quadrants there known to be zero: rows of subbands   */
+/* without a bit in bands, rows of nodes without one in nodes.          */
+/************************************************************************/
+static void zero_node_rows(char *zero, W_TREE *wt, const int quad[4],
+                           const int cb, const unsigned long long *bands,
+                           const unsigned int *nodes)
+{
+   int r, q, y, ly;
+
+   ly = (wt->leny + 1) / 2;
+   for(r = 0; r < wt->leny; r++) {
+      /* The highpass half comes first when inverted. */
+      q = cb + 2 * ((r < (wt->inv_cl ? wt->leny - ly : ly)) ==
+                      (wt->inv_cl != 0));
+      y = wt->y + r;
+      if(quad[q] == Q_TREELEN)
+         zero[r] = 0;
+      else if(quad[q] >= 0)
+         zero[r] = !(nodes[y] & (1u << quad[q]));
+      else
+         zero[r] = !(bands[y] & (1ull << (-1 - quad[q])));
+   }
+}
+
+/************************************************************************/
+/* Routine to filter nlines rows of a node through a plan, into the     */
+/* image, or into its pixels if pixels is not NULL.                     */
+/************************************************************************/
+static void node_lets_rows(float *fdata_bse, float *fdata1,
+                           unsigned char *pixels, const float m_shift,
+                           const float r_scale, const int nlines,
+                           LETS_PLAN *plan, const int width, float *lines,
+                           const int nthreads)
+{
+   if(pixels != (unsigned char *)NULL)
+      lets_rows_2_pixels(pixels, fdata1, nlines, width, plan, m_shift,
+                         r_scale, lines, nthreads);
+   else
+      split_lets_rows(fdata_bse, fdata1, nlines, width, plan, lines,
+                      nthreads);
+}
+
+/************************************************************************/
+/* Routine to filter the rows of a node, lines of the same kind at a    */
+/* time: whole, without the band zero in them, or zero.  Rows that may  */
+/* be non-zero get the bit of the node in nodes.  The rows go to pixels */
+/* if not NULL, as node_lets_rows writes them.                          */
+/************************************************************************/
+static void zero_node_lets_rows(float *fdata_bse, float *fdata1,
+                                unsigned char *pixels, const float m_shift,
+                                const float r_scale, W_TREE *wt,
+                                const int node, LETS_PLAN *plan,
+                                char *zero[2], unsigned int *nodes,
+                                const int width, float *lines,
+                                const int nthreads)
+{
+   int r, first, kind, next;
+   LETS_PLAN *kplan;
+   float fzero;
+   unsigned char pzero;     /* pixel of a zero sample */
+
+   fzero = 0.0;
+   flt_2_pixels_wsq(&pzero, &fzero, 1, m_shift, r_scale);
+
+   first = 0;
+   kind = 0;
+   for(r = 0; r <= wt->leny; r++) {
+      next = r < wt->leny ? zero[0][r] + 2 * zero[1][r] : -1;
+      if(r > 0 && next == kind)
+         continue;
+      if(r > first) {
+         if(kind == 3 && pixels != (unsigned char *)NULL) {
+            while(first < r)
+               memset(pixels + (first++) * width, pzero, wt->lenx);
+         }
+         else if(kind == 3) {
+            while(first < r)
+               memset(fdata_bse + (first++) * width, 0,
+                      wt->lenx * sizeof(float));
+         }
+         else {
+            kplan = kind == 0 || plan->drop[kind-1] == (LETS_PLAN *)NULL ?
+                    plan : plan->drop[kind-1];
+            node_lets_rows(fdata_bse + first * width, fdata1 + first * width,
+                           pixels == (unsigned char *)NULL ? pixels :
+                           pixels + first * width, m_shift, r_scale,
+                           r - first, kplan, width, lines, nthreads);
+            while(first < r)
+               nodes[wt->y + first++] |= 1u << node;
+         }
+      }
+      first = r;
+      kind = next;
+   }
+}
+
+/************************************************************************/
+/* WSQ reconstructs the image, the passes of large nodes split across   */
+/* up to nthreads threads.  If bands is not NULL, bit s of bands[y] is  */
+/* set when row y of subband s of q_tree may be non-zero, and the terms */
+/* of the rows and subbands known to be zero are left out of the        */
+/* planned convolution passes.  If odata is not NULL, the image is      */
+/* converted into it as conv_img_2_uchar does, by the planned row pass  */
+/* of the first node as it computes them when possible, fdata being     */
+/* left undefined.  NOTE: this routine modifies and returns the results */
+/* in "fdata".                                                          */
 /************************************************************************/
 int wsq_reconstruct(float *fdata, const int width, const int height,
-                  W_TREE w_tree[], const int w_treelen,
-                  const DTT_TABLE *dtt_table)
+                  unsigned char *odata, const float m_shift,
+                  const float r_scale, W_TREE w_tree[], const int w_treelen,
+                  const DTT_TABLE *dtt_table, const int precision,
+                  WAVELET_PLAN *wplan, const unsigned long long *bands,
+                  Q_TREE q_tree[], const int nthreads,
+                  WSQ_SCRATCH *scratch)
 {
-   int num_pix, node;
-   float *fdata1, *fdata_bse;
+   int ret, node, njobs, cb;
+   size_t mark;
+   float *fdata1, *fdata_bse, *lines;
+   WAVELET_PLAN local;
+   unsigned int *nodes;      /* bit n set in rows node n may be non-zero */
+   char *zero[2];            /* zero input rows of each column band */
+   char *zout[2];            /* zero output rows of each column band */
+   int quad[4];              /* what the quadrants of a node are */
+   int cx[2], cw[2];         /* columns of each column band */
+   unsigned char *pixels;    /* pixels of the first node, or NULL */
 
    if(dtt_table->lodef != 1) {
       fprintf(stderr,
@@ -768,30 +1103,268 @@ int wsq_reconstruct(float *fdata, const int width, const int height,
       return(-96);
    }
 
-   num_pix = width * height;
-   /* Allocate temporary floating point pixmap. */
-   if((fdata1 = (float *) malloc(num_pix*sizeof(float))) == NULL) {
-      fprintf(stderr,"ERROR : wsq_reconstruct : malloc : fdata1\n");
-      return(-97);
+   /* Plan the passes here unless the caller planned them. */
+   if(wplan == (WAVELET_PLAN *)NULL) {
+      if((ret = build_wavelet_plan(&local, w_tree, w_treelen,
+                   dtt_table->hifilt, dtt_table->hisz,
+                   dtt_table->lofilt, dtt_table->losz, 1, precision)))
+         return(ret);
+      wplan = &local;
    }
 
-   /* Reconstruct floating point pixmap from wavelet subband data. */
-   for (node = w_treelen - 1; node >= 0; node--) {
+   /* The first node writes the pixels if its rows are planned. */
+   pixels = (unsigned char *)NULL;
+   if(odata != (unsigned char *)NULL && !wplan->lift && w_treelen > 0 &&
+      wplan->rows[0]->valid && w_tree[0].x == 0 && w_tree[0].y == 0 &&
+      w_tree[0].lenx == width && w_tree[0].leny == height)
+      pixels = odata;
+
+   /* Temporary floating point pixmap and lines from the scratch, */
+   /* lines for each job the passes may be split in, twice as     */
+   /* long for the rows written as pixels.                        */
+   mark = scratch->used;
+   ret = 0;
+   njobs = lets_max_jobs(nthreads);
+   if(wplan->lift) {
+      /* The standard 9/7 bank may be lifted in place. */
+      lines = (float *)alloc_scratch_wsq(scratch, (size_t)njobs *
+                 (width > height ? width : height) * LIFT_STRIP * sizeof(float));
+      if(lines == NULL)
+         ret = -97;
+      else
+         lift_reconstruct_97(fdata, width, height, w_tree, w_treelen, lines,
+                             nthreads);
+   }
+   else {
+      fdata1 = (float *)alloc_scratch_wsq(scratch,
+                                          width * height * sizeof(float));
+      lines = (float *)alloc_scratch_wsq(scratch,
+                              (size_t)njobs * (2*width+1) * sizeof(float));
+      if(fdata1 == NULL || lines == NULL)
+         ret = -97;
+      nodes = (unsigned int *)NULL;
+      if(bands != (const unsigned long long *)NULL && ret == 0) {
+         nodes = (unsigned int *)alloc_scratch_wsq(scratch,
+                                         height * sizeof(unsigned int));
+         zero[0] = (char *)alloc_scratch_wsq(scratch, 4 * (size_t)height);
+         if(nodes == NULL || zero[0] == NULL)
+            ret = -97;
+         else {
+            memset(nodes, 0, height * sizeof(unsigned int));
+            zero[1] = zero[0] + height;
+            zout[0] = zero[1] + height;
+            zout[1] = zout[0] + height;
+         }
+      }
+      /* Reconstruct floating point pixmap from wavelet subband data. */
+      for (node = w_treelen - 1; node >= 0 && ret == 0; node--) {
+         fdata_bse = fdata + (w_tree[node].y * width) + w_tree[node].x;
+         if(nodes != (unsigned int *)NULL && wplan->cols[node]->valid &&
+            wplan->rows[node]->valid) {
+            /* Each column band without the terms of its zero rows, */
+            /* then rows without the column bands zero in them.     */
+            node_quadrants(quad, w_tree, w_treelen, node, q_tree);
+            cw[0] = (w_tree[node].lenx + 1) / 2;
+            cw[1] = w_tree[node].lenx - cw[0];
+            cx[0] = w_tree[node].inv_rw ? cw[1] : 0;
+            cx[1] = w_tree[node].inv_rw ? 0 : cw[0];
+            for(cb = 0; cb < 2; cb++) {
+               zero_node_rows(zero[cb], w_tree + node, quad, cb, bands,
+                              nodes);
+               lets_plan_zeros(wplan->cols[node], zero[cb], zout[cb]);
+               if(cw[cb] > 0)
+                  zero_lets_cols(fdata1 + cx[cb], fdata_bse + cx[cb], cw[cb],
+                                 width, wplan->cols[node], zero[cb],
+                                 nthreads);
+            }
+            zero_node_lets_rows(fdata_bse, fdata1, node == 0 ? pixels :
+                                (unsigned char *)NULL, m_shift, r_scale,
+                                w_tree + node, node, wplan->rows[node],
+                                zout, nodes, width, lines, nthreads);
+            continue;
+         }
+         if(nodes != (unsigned int *)NULL)
+            for(cb = 0; cb < w_tree[node].leny; cb++)
+               nodes[w_tree[node].y + cb] |= 1u << node;
+         /* Columns a whole row of samples at a time. */
+         if(wplan->cols[node]->valid)
+            split_lets_cols(fdata1, fdata_bse, w_tree[node].lenx, width,
+                            wplan->cols[node], nthreads);
+         else
+            join_lets(fdata1, fdata_bse, w_tree[node].lenx, w_tree[node].leny,
+                        1, width,
+                        dtt_table->hifilt, dtt_table->hisz,
+                        dtt_table->lofilt, dtt_table->losz,
+                        w_tree[node].inv_cl);
+         /* Rows through the planned vector kernels when possible, */
+         /* once all the columns of the node are done.             */
+         if(wplan->rows[node]->valid)
+            node_lets_rows(fdata_bse, fdata1, node == 0 ? pixels :
+                           (unsigned char *)NULL, m_shift, r_scale,
+                           w_tree[node].leny, wplan->rows[node], width,
+                           lines, nthreads);
+         else
+            join_lets(fdata_bse, fdata1, w_tree[node].leny, w_tree[node].lenx,
+                        width, 1,
+                        dtt_table->hifilt, dtt_table->hisz,
+                        dtt_table->lofilt, dtt_table->losz,
+                        w_tree[node].inv_rw);
+      }
+   }
+   /* Convert floating point pixels unless written already. */
+   if(ret == 0 && odata != (unsigned char *)NULL &&
+      pixels == (unsigned char *)NULL)
+      conv_img_2_uchar(odata, fdata, width, height, m_shift, r_scale);
+   scratch->used = mark;
+   if(wplan == &local)
+      free_wavelet_plan(&local);
+
+   return(ret);
+}
+
+/************************************************************************/
+/* WSQ reconstructs the pixels of the cw by ch window at x, y of the    */
+/* image only.  Working from the window up the tree, each node is given */
+/* the outputs its parent reads, and reads in turn the inputs the terms */
+/* of its planned passes name, so that the filter lengths and the edges */
+/* of every level are accounted for; nodes outside are skipped.  The    */
+/* passes are those of the exact convolution, planned by the caller in  */
+/* strict precision whatever that of the context, so the window is that */
+/* of wsq_reconstruct in strict precision.  Without planned passes, for */
+/* filters other than the standard ones, the nodes the window needs are */
+/* reconstructed whole.  The rest of "fdata" is left partly             */
+/* reconstructed.                                                       */
+/************************************************************************/
+int wsq_reconstruct_window(float *fdata, const int width, const int height,
+                  W_TREE w_tree[], const int w_treelen,
+                  const DTT_TABLE *dtt_table, WAVELET_PLAN *wplan,
+                  const int x, const int y, const int cw, const int ch,
+                  const int nthreads, WSQ_SCRATCH *scratch)
+{
+   int ret, node, sub, njobs;
+   int need[W_TREELEN][4];   /* outputs of each node: x0, y0, x1, y1 */
+   int cols[W_TREELEN][2];   /* columns its row pass reads */
+   int rows[2];              /* rows its column pass reads */
+   int planned[W_TREELEN];   /* filtered by its plans */
+   int lx0, ly0, lx1, ly1;
+   size_t mark;
+   float *fdata1, *fdata_bse, *lines;
+
+   if(dtt_table->lodef != 1) {
+      fprintf(stderr,
+      "ERROR: wsq_reconstruct_window : Lopass filter coefficients not defined\n");
+      return(-95);
+   }
+   if(dtt_table->hidef != 1) {
+      fprintf(stderr,
+      "ERROR: wsq_reconstruct_window : Hipass filter coefficients not defined\n");
+      return(-96);
+   }
+
+   /* Outputs needed of each node, from the window down the tree: */
+   /* the inputs its parent, the last node holding it, reads.     */
+   need[0][0] = x;
+   need[0][1] = y;
+   need[0][2] = x + cw;
+   need[0][3] = y + ch;
+   for(node = 0; node < w_treelen; node++) {
+      planned[node] = wplan != (WAVELET_PLAN *)NULL &&
+                      wplan->rows[node]->valid && wplan->cols[node]->valid;
+      if(!planned[node] &&
+         need[node][0] < need[node][2] && need[node][1] < need[node][3]) {
+         /* join_lets reconstructs the whole node */
+         need[node][0] = w_tree[node].x;
+         need[node][1] = w_tree[node].y;
+         need[node][2] = w_tree[node].x + w_tree[node].lenx;
+         need[node][3] = w_tree[node].y + w_tree[node].leny;
+      }
+      lx0 = need[node][0] - w_tree[node].x;
+      ly0 = need[node][1] - w_tree[node].y;
+      lx1 = need[node][2] - w_tree[node].x;
+      ly1 = need[node][3] - w_tree[node].y;
+      if(lx0 >= lx1 || ly0 >= ly1) {
+         cols[node][0] = cols[node][1] = 0;
+         rows[0] = rows[1] = 0;
+      }
+      else if(planned[node]) {
+         lets_plan_inputs(wplan->rows[node], lx0, lx1,
+                          &cols[node][0], &cols[node][1]);
+         lets_plan_inputs(wplan->cols[node], ly0, ly1, &rows[0], &rows[1]);
+      }
+      else {
+         cols[node][0] = 0;
+         cols[node][1] = w_tree[node].lenx;
+         rows[0] = 0;
+         rows[1] = w_tree[node].leny;
+      }
+      for(sub = node + 1; sub < w_treelen; sub++) {
+         if(w_tree[sub].x < w_tree[node].x ||
+            w_tree[sub].y < w_tree[node].y ||
+            w_tree[sub].x + w_tree[sub].lenx >
+            w_tree[node].x + w_tree[node].lenx ||
+            w_tree[sub].y + w_tree[sub].leny >
+            w_tree[node].y + w_tree[node].leny)
+            continue;
+         need[sub][0] = w_tree[node].x + cols[node][0];
+         need[sub][1] = w_tree[node].y + rows[0];
+         need[sub][2] = w_tree[node].x + cols[node][1];
+         need[sub][3] = w_tree[node].y + rows[1];
+         if(need[sub][0] < w_tree[sub].x)
+            need[sub][0] = w_tree[sub].x;
+         if(need[sub][1] < w_tree[sub].y)
+            need[sub][1] = w_tree[sub].y;
+         if(need[sub][2] > w_tree[sub].x + w_tree[sub].lenx)
+            need[sub][2] = w_tree[sub].x + w_tree[sub].lenx;
+         if(need[sub][3] > w_tree[sub].y + w_tree[sub].leny)
+            need[sub][3] = w_tree[sub].y + w_tree[sub].leny;
+      }
+   }
+
+   mark = scratch->used;
+   ret = 0;
+   njobs = lets_max_jobs(nthreads);
+   fdata1 = (float *)alloc_scratch_wsq(scratch,
+                                       width * height * sizeof(float));
+   lines = (float *)alloc_scratch_wsq(scratch,
+                              (size_t)njobs * (width+1) * sizeof(float));
+   if(fdata1 == NULL || lines == NULL)
+      ret = -97;
+   for (node = w_treelen - 1; node >= 0 && ret == 0; node--) {
+      lx0 = need[node][0] - w_tree[node].x;
+      ly0 = need[node][1] - w_tree[node].y;
+      lx1 = need[node][2] - w_tree[node].x;
+      ly1 = need[node][3] - w_tree[node].y;
+      if(lx0 >= lx1 || ly0 >= ly1)
+         continue;
       fdata_bse = fdata + (w_tree[node].y * width) + w_tree[node].x;
-      join_lets(fdata1, fdata_bse, w_tree[node].lenx, w_tree[node].leny,
-                  1, width,
-                  dtt_table->hifilt, dtt_table->hisz,
-                  dtt_table->lofilt, dtt_table->losz,
-                  w_tree[node].inv_cl);
-      join_lets(fdata_bse, fdata1, w_tree[node].leny, w_tree[node].lenx,
-                  width, 1,
-                  dtt_table->hifilt, dtt_table->hisz,
-                  dtt_table->lofilt, dtt_table->losz,
-                  w_tree[node].inv_rw);
+      if(planned[node]) {
+         /* Rows ly0 to ly1 of the columns the row pass reads, */
+         /* then columns lx0 to lx1 of those rows.             */
+         if(cols[node][0] < cols[node][1])
+            window_lets_cols(fdata1 + cols[node][0],
+                             fdata_bse + cols[node][0],
+                             cols[node][1] - cols[node][0], width,
+                             wplan->cols[node], ly0, ly1, nthreads);
+         window_lets_rows(fdata_bse + ly0 * width, fdata1 + ly0 * width,
+                          ly1 - ly0, width, wplan->rows[node], lx0, lx1,
+                          lines, nthreads);
+      }
+      else {
+         join_lets(fdata1, fdata_bse, w_tree[node].lenx, w_tree[node].leny,
+                     1, width,
+                     dtt_table->hifilt, dtt_table->hisz,
+                     dtt_table->lofilt, dtt_table->losz,
+                     w_tree[node].inv_cl);
+         join_lets(fdata_bse, fdata1, w_tree[node].leny, w_tree[node].lenx,
+                     width, 1,
+                     dtt_table->hifilt, dtt_table->hisz,
+                     dtt_table->lofilt, dtt_table->losz,
+                     w_tree[node].inv_rw);
+      }
    }
-   free(fdata1);
+   scratch->used = mark;
 
-   return(0);
+   return(ret);
 }
 
 /****************************************************************/
@@ -1199,13 +1772,12 @@ int image_size(
 void init_wsq_decoder_resources(WSQContext * context)
 {
    /* Added 02-24-05 by MDG                      */
-   /* Init dymanically allocated members to NULL */
-   /* for proper memory management in:           */
-   /*    read_transform_table()                  */
-   /*    getc_transform_table()                  */
-   /*    free_wsq_resources()                    */
-   context->dtt_table.lofilt = (float *)NULL;
-   context->dtt_table.hifilt = (float *)NULL;
+   /* The filter members stay allocated from one */
+   /* call to the next and are reused by         */
+   /* getc_transform_table(); only mark them     */
+   /* undefined until a table is read.           */
+   context->dtt_table.lodef = 0;
+   context->dtt_table.hidef = 0;
 }
 
 /*************************************************************/
@@ -25,6 +25,7 @@ identified are necessarily the best available for the purpose.
 #define _UTIL_H
 
 #include "wsqInternal.h"
+#include "wavelet.h"
 
 /* UPDATED: 03/15/2005 by MDG */
 
@@ -34,21 +35,32 @@ void conv_img_2_flt(float *, float *, float *, unsigned char *,
 void conv_img_2_uchar(unsigned char *, float *, const int, const int,
                  const float, const float);
 void variance( QUANT_VALS *quant_vals, Q_TREE q_tree[], const int,
-                 float *, const int, const int);
-int quantize(short **, int *, QUANT_VALS *, Q_TREE qtree[], const int,
-                 float *, const int, const int);
+                 float *, const int, const int, const int);
+int quantize(short *, int *, QUANT_VALS *, Q_TREE qtree[], const int,
+                 float *, const int, const int, const int);
 void quant_block_sizes(int *, int *, int *,
                  QUANT_VALS *, W_TREE w_tree[], const int,
                  Q_TREE q_tree[], const int);
-int unquantize(float **, const DQT_TABLE *,
-                 Q_TREE q_tree[], const int, short *, const int, const int);
-int wsq_decompose(float *, const int, const int,
-                 W_TREE w_tree[], const int, float *, const int,
-                 float *, const int);
+void init_coef_writer_wsq(COEF_WRITER_WSQ *, float *, unsigned long long *,
+                 const int, const int, const DQT_TABLE *, const Q_TREE *,
+                 const int, const int);
+int next_coef_row_wsq(COEF_WRITER_WSQ *);
+int coef_writer_done_wsq(COEF_WRITER_WSQ *);
+int wsq_decompose(float *, const int, const int, unsigned char *,
+                 const float, const float, W_TREE w_tree[], const int,
+                 float *, const int, float *, const int, const int,
+                 WAVELET_PLAN *, Q_TREE q_tree[], const int, WSQ_SCRATCH *);
 void get_lets(float *, float *, const int, const int, const int,
                  const int, float *, const int, float *, const int, const int);
-int wsq_reconstruct(float *, const int, const int,
-                 W_TREE w_tree[], const int, const DTT_TABLE *);
+int wsq_reconstruct(float *, const int, const int, unsigned char *,
+                 const float, const float, W_TREE w_tree[], const int,
+                 const DTT_TABLE *, const int, WAVELET_PLAN *,
+                 const unsigned long long *, Q_TREE q_tree[], const int,
+                 WSQ_SCRATCH *);
+int wsq_reconstruct_window(float *, const int, const int,
+                 W_TREE w_tree[], const int, const DTT_TABLE *,
+                 WAVELET_PLAN *, const int, const int, const int, const int,
+                 const int, WSQ_SCRATCH *);
 void  join_lets(float *, float *, const int, const int,
                  const int, const int, float *, const int,
                  float *, const int, const int);
@@ -0,0 +1,2224 @@
+/*
+ * wavelet.c
+ *
+ *  Plans and SIMD kernels for the wavelet filter passes of get_lets
+ *  and join_lets.
+ *
+ *  A plan records, for each output sample of a line, the exact
+ *  sequence of multiply-adds get_lets or join_lets runs for it,
+ *  symmetric extension at the edges included.  It is built by
+ *  running the walk of those routines on sample indices.  Away from
+ *  the edges, outputs of the same kind share one sequence of terms
+ *  shifted along the line; these uniform runs are computed a vector
+ *  at a time, the remaining outputs one at a time.  Every output is
+ *  summed in the same order as the scalar routines, with separate
+ *  multiplies and adds, so results are bit identical to them.
+ *
+ *  Columns are filtered a row at a time: every output row is a sum
+ *  of whole input rows, computed a vector of adjacent columns at a
+ *  time, so each cache line loaded is fully used.
+ *
+ *  For the standard 9/7 bank the transform may instead be computed
+ *  by the four lifting steps of its factorization, in place, with
+ *  about half the multiplies.  Lifting reassociates the sums, so it
+ *  is used only when the caller allows results that differ from
+ *  the convolution by float rounding.
+ *
+ *  Passes of large nodes may be split in jobs over their lines, run
+ *  on separate threads; a node's second pass starts once all of its
+ *  first is done, and the next node once its second pass is.
+ *
+ *  A pass may compute a window of the outputs of each line only,
+ *  for a region of interest: the outputs of the window are those of
+ *  the whole pass, and the inputs they read are found from the terms
+ *  of the plan.
+ *
+ *  The rows of the first pass of an analysis may be read from the
+ *  8 bit pixels, each line converted to floats into scratch as it
+ *  is filtered, and the rows of the last pass of a synthesis written
+ *  to them, each line filtered into scratch then converted, so the
+ *  floating point image is never written whole.
+ *
+ *  Synthesis passes may also leave out the terms of inputs known to
+ *  be zero, subbands or rows of subbands the encoder quantized to
+ *  nothing: join plans carry variants without their lowpass or
+ *  highpass half for rows, and columns drop the terms of zero input
+ *  rows output by output.  Only the sign of zero results can differ.
+ *
+ *  The vector kernels are generated for SSE2 and AVX2 and picked
+ *  when run, by cpu_features_wsq.  Only the kernels of results that
+ *  need not be exact, the folded runs and the lifting steps, fuse
+ *  multiply-adds where the processor has FMA.
+ *
+ *      ROUTINES:
+#cat: build_get_lets_plan - Plans the outputs of a get_lets line.
+#cat:
+#cat: build_join_lets_plan - Plans the outputs of a join_lets line.
+#cat:
+#cat: free_lets_plan - Deallocates the memory of a plan.
+#cat:
+#cat: build_wavelet_plan - Plans the filter passes of a whole transform.
+#cat:
+#cat: free_wavelet_plan - Deallocates the memory of a transform plan.
+#cat:
+#cat: lets_plan_inputs - Finds the inputs a window of outputs reads.
+#cat:
+#cat: lets_plan_zeros - Finds the outputs zero inputs leave zero.
+#cat:
+#cat: lets_rows - Filters contiguous lines (image rows) with a plan.
+#cat:
+#cat: lets_cols - Filters strided lines (image columns) with a plan.
+#cat:
+#cat: lets_max_jobs - Returns the most jobs a pass is split in.
+#cat:
+#cat: split_lets_rows - Filters image rows with a plan on several threads.
+#cat:
+#cat: split_lets_cols - Filters image columns with a plan on several
+#cat:                   threads.
+#cat:
+#cat: window_lets_rows - Filters a window of the outputs of image rows
+#cat:                   with a plan on several threads.
+#cat:
+#cat: window_lets_cols - Filters a window of the outputs of image
+#cat:                   columns with a plan on several threads.
+#cat:
+#cat: zero_lets_cols - Filters image columns with a plan on several
+#cat:                   threads, leaving out the terms of zero rows.
+#cat:
+#cat: pixel_lets_rows - Filters a window of the outputs of image rows of
+#cat:                   pixels, converted to floats as they are read,
+#cat:                   with a plan on several threads.
+#cat:
+#cat: lets_rows_2_pixels - Filters image rows with a plan on several
+#cat:                   threads into pixels, converted as they are
+#cat:                   written.
+#cat:
+#cat: can_lift_97 - Tests if a transform may use the 9/7 lifting steps.
+#cat:
+#cat: lift_decompose_97 - Wavelet decomposition by lifting, in place.
+#cat:
+#cat: lift_reconstruct_97 - Wavelet reconstruction by lifting, in place.
+#cat:
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "Config.h"
+#include "cpu.h"
+#include "wavelet.h"
+#include "util.h"
+#include "thread.h"
+#include "convert.h"
+
+#if defined(CPU_WSQ_KERNELS_AVX2)
+#include <immintrin.h>
+#elif defined(CPU_SSE2)
+#include <emmintrin.h>
+#endif
+
+static const float neg_zero = -0.0f;
+
+/* Shortest interior run worth handing to the vector kernels. */
+#define MIN_LETS_RUN     8
+
+/* Fewest samples of a pass worth a thread of their own. */
+#define MIN_JOB_SAMPLES  65536
+
+/* Lifting factorization of the 9/7 bank: odd samples are updated */
+/* by A and C, even ones by B and D, then the lowpass outputs are  */
+/* scaled by K and the highpass outputs by 1/K.                    */
+#define LIFT_A          -1.586134342059924f
+#define LIFT_B          -0.052980118572961f
+#define LIFT_C           0.882911075530934f
+#define LIFT_D           0.443506852043971f
+#define LIFT_K           1.149604398860242f
+
+/* Shortest line the 9/7 convolution filters without leaving it. */
+#define MIN_LIFT_LEN     5
+
+/* Taps of the analysis banks of wsqInternal.c. */
+static const double bank_hi_97[7] = {
+    0.06453888262893845, -0.04068941760955844, -0.41809227322221221,
+    0.78848561640566439, -0.41809227322221221, -0.04068941760955844,
+    0.06453888262893845 };
+static const double bank_lo_97[9] = {
+    0.03782845550699546, -0.02384946501938000, -0.11062440441842342,
+    0.37740285561265380,  0.85269867900940344,  0.37740285561265380,
+   -0.11062440441842342, -0.02384946501938000,  0.03782845550699546 };
+static const double bank_hi_88[8] = {
+    0.03226944131446922, -0.05261415011924844, -0.18870142780632693,
+    0.60328894481393847, -0.60328894481393847,  0.18870142780632693,
+    0.05261415011924844, -0.03226944131446922 };
+static const double bank_lo_88[8] = {
+    0.07565691101399093, -0.12335584105275092, -0.09789296778409587,
+    0.85269867900940344,  0.85269867900940344, -0.09789296778409587,
+   -0.12335584105275092,  0.07565691101399093 };
+
+/*****************************************************************/
+/* Routine to compare filters with an analysis bank, or with the */
+/* synthesis bank getc_transform_table derives from it.          */
+/*****************************************************************/
+static int same_bank(float *hi, const int hsz, float *lo, const int lsz,
+                     const double *ahi, const int ahsz,
+                     const double *alo, const int alsz, const int synthesis)
+{
+   int i, c;
+   double tap;
+
+   if(!synthesis) {
+      if(hsz != ahsz || lsz != alsz)
+         return(0);
+      for(i = 0; i < hsz; i++)
+         if(fabs(hi[i] - ahi[i]) > 1e-6)
+            return(0);
+      for(i = 0; i < lsz; i++)
+         if(fabs(lo[i] - alo[i]) > 1e-6)
+            return(0);
+      return(1);
+   }
+
+   /* Synthesis taps are the analysis taps of the other band, with */
+   /* the signs of int_sign going out from the center.             */
+   if(hsz != alsz || lsz != ahsz)
+      return(0);
+   for(i = 0; i < hsz; i++) {
+      c = (hsz % 2) ? abs(i - hsz/2) : (i < hsz/2 ? hsz/2 - 1 - i : i - hsz/2);
+      tap = int_sign(c) * alo[hsz/2 + c];
+      if(!(hsz % 2) && i < hsz/2)
+         tap = -tap;
+      if(fabs(hi[i] - tap) > 1e-6)
+         return(0);
+   }
+   for(i = 0; i < lsz; i++) {
+      c = (lsz % 2) ? abs(i - lsz/2) : (i < lsz/2 ? lsz/2 - 1 - i : i - lsz/2);
+      tap = int_sign((lsz % 2) ? c : c + 1) * ahi[lsz/2 + c];
+      if(fabs(lo[i] - tap) > 1e-6)
+         return(0);
+   }
+
+   return(1);
+}
+
+/*****************************************************************/
+/* Routine to recognize a standard filter bank, given as the     */
+/* analysis filters or, with synthesis set, as the synthesis     */
+/* filters a DTT table is read into.  Returns WSQ_BANK_*.        */
+/*****************************************************************/
+int wsq_filter_bank(float *hi, const int hsz, float *lo, const int lsz,
+                    const int synthesis)
+{
+   if(same_bank(hi, hsz, lo, lsz, bank_hi_97, 7, bank_lo_97, 9, synthesis))
+      return(WSQ_BANK_97);
+   if(same_bank(hi, hsz, lo, lsz, bank_hi_88, 8, bank_lo_88, 8, synthesis))
+      return(WSQ_BANK_88);
+
+   return(WSQ_BANK_OTHER);
+}
+
+/*****************************************************************/
+/* Routine to allocate an empty plan.                            */
+/*****************************************************************/
+static int alloc_lets_plan(LETS_PLAN *plan, const int len,
+                           const int maxterms, const int join)
+{
+   memset(plan, 0, sizeof(LETS_PLAN));
+   plan->len = len;
+   plan->join = join;
+   plan->maxterms = maxterms;
+   plan->valid = maxterms <= MAX_LETS_TERMS;
+   plan->nterms = (int *)calloc(len, sizeof(int));
+   plan->zero = (char *)calloc(len, sizeof(char));
+   plan->inrun = (char *)calloc(len, sizeof(char));
+   plan->terms = (LETS_TERM *)malloc(len * maxterms * sizeof(LETS_TERM));
+   plan->folds = (LETS_TERM *)malloc(MAX_LETS_RUNS * maxterms *
+                                     sizeof(LETS_TERM));
+   if(plan->nterms == (int *)NULL || plan->zero == (char *)NULL ||
+      plan->inrun == (char *)NULL || plan->terms == (LETS_TERM *)NULL ||
+      plan->folds == (LETS_TERM *)NULL) {
+      free_lets_plan(plan);
+      fprintf(stderr, "ERROR : alloc_lets_plan : malloc : plan\n");
+      return(-98);
+   }
+
+   return(0);
+}
+
+/*****************************************************************/
+/* Routine to deallocate the memory of a plan.                   */
+/*****************************************************************/
+void free_lets_plan(LETS_PLAN *plan)
+{
+   int i;
+
+   if(plan->nterms != (int *)NULL)
+      free(plan->nterms);
+   if(plan->zero != (char *)NULL)
+      free(plan->zero);
+   if(plan->inrun != (char *)NULL)
+      free(plan->inrun);
+   if(plan->terms != (LETS_TERM *)NULL)
+      free(plan->terms);
+   if(plan->folds != (LETS_TERM *)NULL)
+      free(plan->folds);
+   for(i = 0; i < 2; i++)
+      if(plan->drop[i] != (LETS_PLAN *)NULL) {
+         free_lets_plan(plan->drop[i]);
+         free(plan->drop[i]);
+         plan->drop[i] = (LETS_PLAN *)NULL;
+      }
+   plan->nterms = (int *)NULL;
+   plan->zero = (char *)NULL;
+   plan->inrun = (char *)NULL;
+   plan->terms = (LETS_TERM *)NULL;
+   plan->folds = (LETS_TERM *)NULL;
+   plan->valid = 0;
+}
+
+/*****************************************************************/
+/* Routine to plan the filter passes of a whole transform: the   */
+/* get_lets passes of the analysis filters hi and lo, or with    */
+/* synthesis set, the join_lets passes of the synthesis filters. */
+/* Nodes with the same line length and inversion share a plan.   */
+/*****************************************************************/
+int build_wavelet_plan(
+   WAVELET_PLAN *wplan,  /* returned plan */
+   W_TREE w_tree[],      /* wavelet tree */
+   const int w_treelen,
+   float *hi,
+   const int hsz,
+   float *lo,            /* filter coefficients */
+   const int lsz,
+   const int synthesis,  /* join_lets passes */
+   const int precision)  /* WSQ_PRECISION_* */
+{
+   int ret, node, pass, len, inv, i;
+   LETS_PLAN *plan;
+
+   memset(wplan, 0, sizeof(WAVELET_PLAN));
+   if(precision == WSQ_PRECISION_FAST &&
+      can_lift_97(hi, hsz, lo, lsz, w_tree, w_treelen, synthesis)) {
+      wplan->lift = 1;
+      return(0);
+   }
+
+   for(node = 0; node < w_treelen; node++) {
+      for(pass = 0; pass < 2; pass++) {
+         len = pass ? w_tree[node].leny : w_tree[node].lenx;
+         inv = pass ? w_tree[node].inv_cl : w_tree[node].inv_rw;
+         plan = (LETS_PLAN *)NULL;
+         for(i = 0; i < wplan->nplans; i++)
+            if(wplan->plans[i].len == len && wplan->plans[i].inv == inv)
+               plan = wplan->plans + i;
+         if(plan == (LETS_PLAN *)NULL) {
+            plan = wplan->plans + wplan->nplans;
+            if(synthesis)
+               ret = build_join_lets_plan(plan, len, hi, hsz, lo, lsz, inv,
+                                          precision == WSQ_PRECISION_FAST);
+            else
+               ret = build_get_lets_plan(plan, len, hi, hsz, lo, lsz, inv,
+                                         precision == WSQ_PRECISION_FAST);
+            if(ret) {
+               free_wavelet_plan(wplan);
+               return(ret);
+            }
+            wplan->nplans++;
+         }
+         if(pass)
+            wplan->cols[node] = plan;
+         else
+            wplan->rows[node] = plan;
+      }
+   }
+
+   return(0);
+}
+
+/*****************************************************************/
+/* Routine to deallocate the memory of a transform plan.         */
+/*****************************************************************/
+void free_wavelet_plan(WAVELET_PLAN *wplan)
+{
+   int i;
+
+   for(i = 0; i < wplan->nplans; i++)
+      free_lets_plan(wplan->plans + i);
+   wplan->nplans = 0;
+}
+
+/* out = in[idx] * coef */
+static void plan_set(LETS_PLAN *plan, const int out, const int idx,
+                     const float coef)
+{
+   LETS_TERM *term;
+
+   if(out < 0 || out >= plan->len || idx < 0 || idx >= plan->len) {
+      plan->valid = 0;
+      return;
+   }
+   term = plan->terms + out * plan->maxterms;
+   term->idx = idx;
+   term->coef = coef;
+   plan->nterms[out] = 1;
+   plan->zero[out] = 0;
+}
+
+/* out += in[idx] * coef */
+static void plan_add(LETS_PLAN *plan, const int out, const int idx,
+                     const float coef)
+{
+   LETS_TERM *term;
+
+   if(out < 0 || out >= plan->len || idx < 0 || idx >= plan->len ||
+      plan->nterms[out] >= plan->maxterms ||
+      (plan->nterms[out] == 0 && !plan->zero[out])) {
+      plan->valid = 0;
+      return;
+   }
+   term = plan->terms + out * plan->maxterms + plan->nterms[out];
+   term->idx = idx;
+   term->coef = coef;
+   plan->nterms[out]++;
+}
+
+/* out = 0.0 */
+static void plan_zero(LETS_PLAN *plan, const int out)
+{
+   if(out < 0 || out >= plan->len) {
+      plan->valid = 0;
+      return;
+   }
+   plan->nterms[out] = 0;
+   plan->zero[out] = 1;
+}
+
+/*****************************************************************/
+/* Marks the plan invalid unless every output has been set.      */
+/*****************************************************************/
+static int plan_complete(LETS_PLAN *plan)
+{
+   int o;
+
+   for(o = 0; plan->valid && o < plan->len; o++)
+      if(plan->nterms[o] == 0 && !plan->zero[o])
+         plan->valid = 0;
+
+   return(plan->valid);
+}
+
+/*****************************************************************/
+/* Returns non-zero if output b is output a shifted by istep.    */
+/*****************************************************************/
+static int same_lets_terms(LETS_PLAN *plan, const int a, const int b,
+                           const int istep)
+{
+   int i;
+   LETS_TERM *ta, *tb;
+
+   if(plan->nterms[a] != plan->nterms[b] || plan->zero[a] != plan->zero[b])
+      return(0);
+   ta = plan->terms + a * plan->maxterms;
+   tb = plan->terms + b * plan->maxterms;
+   for(i = 0; i < plan->nterms[a]; i++) {
+      if(tb[i].idx - ta[i].idx != istep ||
+         memcmp(&tb[i].coef, &ta[i].coef, sizeof(float)) != 0)
+         return(0);
+   }
+
+   return(1);
+}
+
+/*****************************************************************/
+/* Routine to find the longest stretch of the outputs base +     */
+/* ostep*j, j < n, sharing their terms.  Returns its j range.    */
+/*****************************************************************/
+static void find_lets_run(LETS_PLAN *plan, const int base, const int ostep,
+                          const int n, const int istep,
+                          int *ofirst, int *olast)
+{
+   int j, start, first, last;
+
+   first = 0;
+   last = 0;
+   start = 0;
+   for(j = 1; j <= n; j++) {
+      if(j == n || !same_lets_terms(plan, base + ostep*(j-1),
+                                    base + ostep*j, istep)) {
+         if(j - start > last - first) {
+            first = start;
+            last = j;
+         }
+         start = j;
+      }
+   }
+
+   *ofirst = first;
+   *olast = last;
+}
+
+/*****************************************************************/
+/* Routine to fold the terms of a run: terms whose coefficients  */
+/* have the same magnitude share one multiply, their inputs      */
+/* added or subtracted first.  This reassociates the sums.       */
+/*****************************************************************/
+static void fold_lets_run(LETS_RUN *run)
+{
+   int k, m, n;
+   char used[MAX_LETS_TERMS];
+   LETS_TERM *term;
+
+   term = run->terms;
+   memset(used, 0, run->nterms);
+   n = 0;
+   for(k = 0; k < run->nterms; k++) {
+      if(used[k])
+         continue;
+      for(m = k + 1; m < run->nterms; m++)
+         if(!used[m] && fabs(term[m].coef) == fabs(term[k].coef))
+            break;
+      if(m == run->nterms)
+         continue;
+      used[k] = 1;
+      used[m] = 1;
+      run->folds[n++] = term[k];
+      run->folds[n].idx = term[m].idx;
+      run->folds[n++].coef = (term[m].coef == term[k].coef) ? 0.0f : -0.0f;
+      run->npairs++;
+   }
+   for(k = 0; k < run->nterms; k++)
+      if(!used[k]) {
+         run->folds[n++] = term[k];
+         run->nsingle++;
+      }
+}
+
+/*****************************************************************/
+/* Routine to record a run of outputs base + ostep*j, first <= j */
+/* < last.                                                       */
+/*****************************************************************/
+static void add_lets_run(LETS_PLAN *plan, const int base, const int ostep,
+                         const int first, const int last, const int istep)
+{
+   LETS_RUN *run;
+   int j, o0;
+
+   o0 = base + ostep * first;
+   run = plan->runs + plan->nruns++;
+   run->o0 = o0;
+   run->ostep = ostep;
+   run->count = last - first;
+   run->istep = istep;
+   run->zero = plan->zero[o0];
+   run->nterms = plan->nterms[o0];
+   run->terms = plan->terms + o0 * plan->maxterms;
+   run->npairs = 0;
+   run->nsingle = 0;
+   run->folds = plan->folds + (plan->nruns - 1) * plan->maxterms;
+   for(j = first; j < last; j++)
+      plan->inrun[base + ostep*j] = 1;
+   if(plan->fold)
+      fold_lets_run(run);
+}
+
+/*****************************************************************/
+/* Routine to plan the outputs of one line of get_lets, running  */
+/* its walk over sample indices.  The arguments are those of     */
+/* get_lets for a line of len2 samples.                          */
+/*****************************************************************/
+int build_get_lets_plan(
+   LETS_PLAN *plan,      /* returned plan */
+   const int len2,       /* samples along the line */
+   float *hi,
+   const int hsz,
+   float *lo,            /* filter coefficients */
+   const int lsz,
+   const int inv,        /* spectral inversion? */
+   const int fold)       /* fold runs, reassociating their sums */
+{
+   int ret;
+   int pix, i, da_ev, fi_ev;
+   int loc, hoc, nstr, pstr;
+   int llen, hlen;
+   int lpx, lspx, lpxstr, lspxstr;
+   int hpx, hspx, hpxstr, hspxstr;
+   int olle, ohle, olre, ohre;
+   int lle, lle2, lre, lre2;
+   int hle, hle2, hre, hre2;
+   int p0, p1, lopass, hipass;
+   int first, last;
+   float hic[256];       /* hi, negated for even length filters */
+
+   if((ret = alloc_lets_plan(plan, len2, (lsz > hsz ? lsz : hsz), 0)))
+      return(ret);
+   plan->bank = wsq_filter_bank(hi, hsz, lo, lsz, 0);
+   plan->fold = fold;
+   plan->inv = inv;
+
+   da_ev = len2 % 2;
+   fi_ev = lsz % 2;
+
+   for(i = 0; i < hsz; i++)
+      hic[i] = hi[i];
+   if(fi_ev) {
+      loc = (lsz-1)/2;
+      hoc = (hsz-1)/2 - 1;
+      olle = 0;
+      ohle = 0;
+      olre = 0;
+      ohre = 0;
+   }
+   else {
+      loc = lsz/2 - 2;
+      hoc = hsz/2 - 2;
+      olle = 1;
+      ohle = 1;
+      olre = 1;
+      ohre = 1;
+
+      if(loc == -1) {
+         loc = 0;
+         olle = 0;
+      }
+      if(hoc == -1) {
+         hoc = 0;
+         ohle = 0;
+      }
+
+      for(i = 0; i < hsz; i++)
+         hic[i] *= -1.0;
+   }
+
+   pstr = 1;
+   nstr = -pstr;
+
+   if(da_ev) {
+      llen = (len2+1)/2;
+      hlen = llen - 1;
+   }
+   else {
+      llen = len2/2;
+      hlen = llen;
+   }
+
+   if(inv) {
+      hipass = 0;
+      lopass = hlen;
+   }
+   else {
+      lopass = 0;
+      hipass = llen;
+   }
+
+   p0 = 0;
+   p1 = len2 - 1;
+
+   lspx = loc;
+   lspxstr = nstr;
+   lle2 = olle;
+   lre2 = olre;
+   hspx = hoc;
+   hspxstr = nstr;
+   hle2 = ohle;
+   hre2 = ohre;
+   for(pix = 0; pix < hlen; pix++) {
+      lpxstr = lspxstr;
+      lpx = lspx;
+      lle = lle2;
+      lre = lre2;
+      plan_set(plan, lopass, lpx, lo[0]);
+      for(i = 1; i < lsz; i++) {
+         if(lpx == p0){
+            if(lle) {
+               lpxstr = 0;
+               lle = 0;
+            }
+            else
+               lpxstr = pstr;
+         }
+         if(lpx == p1){
+            if(lre) {
+               lpxstr = 0;
+               lre = 0;
+            }
+            else
+               lpxstr = nstr;
+         }
+         lpx += lpxstr;
+         plan_add(plan, lopass, lpx, lo[i]);
+      }
+      lopass++;
+
+      hpxstr = hspxstr;
+      hpx = hspx;
+      hle = hle2;
+      hre = hre2;
+      plan_set(plan, hipass, hpx, hic[0]);
+      for(i = 1; i < hsz; i++) {
+         if(hpx == p0){
+            if(hle) {
+               hpxstr = 0;
+               hle = 0;
+            }
+            else
+               hpxstr = pstr;
+         }
+         if(hpx == p1){
+            if(hre) {
+               hpxstr = 0;
+               hre = 0;
+            }
+            else
+               hpxstr = nstr;
+         }
+         hpx += hpxstr;
+         plan_add(plan, hipass, hpx, hic[i]);
+      }
+      hipass++;
+
+      for(i = 0; i < 2; i++) {
+         if(lspx == p0){
+            if(lle2) {
+               lspxstr = 0;
+               lle2 = 0;
+            }
+            else
+               lspxstr = pstr;
+         }
+         lspx += lspxstr;
+         if(hspx == p0){
+            if(hle2) {
+               hspxstr = 0;
+               hle2 = 0;
+            }
+            else
+               hspxstr = pstr;
+         }
+         hspx += hspxstr;
+      }
+   }
+   if(da_ev) {
+      lpxstr = lspxstr;
+      lpx = lspx;
+      lle = lle2;
+      lre = lre2;
+      plan_set(plan, lopass, lpx, lo[0]);
+      for(i = 1; i < lsz; i++) {
+         if(lpx == p0){
+            if(lle) {
+               lpxstr = 0;
+               lle = 0;
+            }
+            else
+               lpxstr = pstr;
+         }
+         if(lpx == p1){
+            if(lre) {
+               lpxstr = 0;
+               lre = 0;
+            }
+            else
+               lpxstr = nstr;
+         }
+         lpx += lpxstr;
+         plan_add(plan, lopass, lpx, lo[i]);
+      }
+   }
+
+   if(!plan_complete(plan))
+      return(0);
+
+   /* Lowpass and highpass outputs each advance two input samples. */
+   lopass = inv ? hlen : 0;
+   hipass = inv ? 0 : llen;
+   find_lets_run(plan, lopass, 1, llen, 2, &first, &last);
+   if(last - first >= MIN_LETS_RUN)
+      add_lets_run(plan, lopass, 1, first, last, 2);
+   find_lets_run(plan, hipass, 1, hlen, 2, &first, &last);
+   if(last - first >= MIN_LETS_RUN)
+      add_lets_run(plan, hipass, 1, first, last, 2);
+
+   return(0);
+}
+
+/*****************************************************************/
+/* Routine to record the runs of a join plan: even and odd       */
+/* outputs each advance one sample in both bands, and the vector */
+/* kernel computes them in pairs.                                */
+/*****************************************************************/
+static void add_join_lets_runs(LETS_PLAN *plan)
+{
+   int evfirst, evlast, odfirst, odlast;
+
+   find_lets_run(plan, 0, 2, (plan->len+1)/2, 1, &evfirst, &evlast);
+   find_lets_run(plan, 1, 2, plan->len/2, 1, &odfirst, &odlast);
+   if(odfirst > evfirst)
+      evfirst = odfirst;
+   if(odlast < evlast)
+      evlast = odlast;
+   if(evlast - evfirst >= MIN_LETS_RUN) {
+      add_lets_run(plan, 0, 2, evfirst, evlast, 1);
+      add_lets_run(plan, 1, 2, evfirst, evlast, 1);
+   }
+}
+
+/*****************************************************************/
+/* Routine to plan a join_lets line whose lowpass (band 0) or    */
+/* highpass (band 1) half is zero: the terms of src without      */
+/* those reading that half, in their order.  Outputs left with   */
+/* no terms are zero.                                            */
+/*****************************************************************/
+static int build_drop_lets_plan(LETS_PLAN *plan, const LETS_PLAN *src,
+                                const int band)
+{
+   int ret, o, k, n, llen, i0, i1;
+   const LETS_TERM *term;
+
+   if((ret = alloc_lets_plan(plan, src->len, src->maxterms, 1)))
+      return(ret);
+   plan->valid = src->valid;
+   plan->bank = src->bank;
+   plan->fold = src->fold;
+   plan->inv = src->inv;
+
+   /* The highpass half comes first when inverted. */
+   llen = (src->len + 1) / 2;
+   if(band == (src->inv ? 1 : 0)) {
+      i0 = 0;
+      i1 = src->inv ? src->len - llen : llen;
+   }
+   else {
+      i0 = src->inv ? src->len - llen : llen;
+      i1 = src->len;
+   }
+
+   for(o = 0; o < src->len; o++) {
+      term = src->terms + o * src->maxterms;
+      n = 0;
+      for(k = 0; k < src->nterms[o]; k++)
+         if(term[k].idx < i0 || term[k].idx >= i1)
+            plan->terms[o * plan->maxterms + n++] = term[k];
+      plan->nterms[o] = n;
+      plan->zero[o] = src->zero[o] || n == 0;
+   }
+
+   add_join_lets_runs(plan);
+
+   return(0);
+}
+
+/*****************************************************************/
+/* Routine to plan the outputs of one line of join_lets, running */
+/* its walk over sample indices.  The arguments are those of     */
+/* join_lets for a line of len2 samples.                         */
+/*****************************************************************/
+int build_join_lets_plan(
+   LETS_PLAN *plan,      /* returned plan */
+   const int len2,       /* samples along the line */
+   float *hi,
+   const int hsz,
+   float *lo,            /* filter coefficients */
+   const int lsz,
+   const int inv,        /* spectral inversion? */
+   const int fold)       /* fold runs, reassociating their sums */
+{
+   int ret;
+   int lp0, lp1, hp0, hp1;
+   int lopass, hipass;
+   int limg, himg;
+   int pix, i, da_ev;
+   int loc, hoc;
+   int hlen, llen;
+   int nstr, pstr;
+   int tap;
+   int fi_ev;
+   int olle, ohle, olre, ohre;
+   int lle, lle2, lre, lre2;
+   int hle, hle2, hre, hre2;
+   int lpx, lspx, lpxstr, lspxstr;
+   int lstap, lotap;
+   int hpx, hspx, hpxstr, hspxstr;
+   int hstap, hotap;
+   int asym, fhre = 0, ofhre;
+   float ssfac, osfac, sfac;
+   float hic[256];       /* hi, negated for even length filters */
+
+   if((ret = alloc_lets_plan(plan, len2, lsz + hsz, 1)))
+      return(ret);
+   plan->bank = wsq_filter_bank(hi, hsz, lo, lsz, 1);
+   plan->fold = fold;
+   plan->inv = inv;
+
+   da_ev = len2 % 2;
+   fi_ev = lsz % 2;
+   pstr = 1;
+   nstr = -pstr;
+   if(da_ev) {
+      llen = (len2+1)/2;
+      hlen = llen - 1;
+   }
+   else {
+      llen = len2/2;
+      hlen = llen;
+   }
+
+   for(i = 0; i < hsz; i++)
+      hic[i] = hi[i];
+   if(fi_ev) {
+      asym = 0;
+      ssfac = 1.0;
+      ofhre = 0;
+      loc = (lsz-1)/4;
+      hoc = (hsz+1)/4 - 1;
+      lotap = ((lsz-1)/2) % 2;
+      hotap = ((hsz+1)/2) % 2;
+      if(da_ev) {
+         olle = 0;
+         olre = 0;
+         ohle = 1;
+         ohre = 1;
+      }
+      else {
+         olle = 0;
+         olre = 1;
+         ohle = 1;
+         ohre = 0;
+      }
+   }
+   else {
+      asym = 1;
+      ssfac = -1.0;
+      ofhre = 2;
+      loc = lsz/4 - 1;
+      hoc = hsz/4 - 1;
+      lotap = (lsz/2) % 2;
+      hotap = (hsz/2) % 2;
+      if(da_ev) {
+         olle = 1;
+         olre = 0;
+         ohle = 1;
+         ohre = 1;
+      }
+      else {
+         olle = 1;
+         olre = 1;
+         ohle = 1;
+         ohre = 1;
+      }
+
+      if(loc == -1) {
+         loc = 0;
+         olle = 0;
+      }
+      if(hoc == -1) {
+         hoc = 0;
+         ohle = 0;
+      }
+
+      for(i = 0; i < hsz; i++)
+         hic[i] *= -1.0;
+   }
+
+   limg = 0;
+   himg = limg;
+   plan_zero(plan, himg);
+   if(len2 > 1)
+      plan_zero(plan, himg + 1);
+   if(inv) {
+      hipass = 0;
+      lopass = hipass + hlen;
+   }
+   else {
+      lopass = 0;
+      hipass = lopass + llen;
+   }
+
+   lp0 = lopass;
+   lp1 = lp0 + (llen-1);
+   lspx = lp0 + loc;
+   lspxstr = nstr;
+   lstap = lotap;
+   lle2 = olle;
+   lre2 = olre;
+
+   hp0 = hipass;
+   hp1 = hp0 + (hlen-1);
+   hspx = hp0 + hoc;
+   hspxstr = nstr;
+   hstap = hotap;
+   hle2 = ohle;
+   hre2 = ohre;
+   osfac = ssfac;
+
+   for(pix = 0; pix < hlen; pix++) {
+      for(tap = lstap; tap >=0; tap--) {
+         lle = lle2;
+         lre = lre2;
+         lpx = lspx;
+         lpxstr = lspxstr;
+
+         plan_set(plan, limg, lpx, lo[tap]);
+         for(i = tap+2; i < lsz; i += 2) {
+            if(lpx == lp0){
+               if(lle) {
+                  lpxstr = 0;
+                  lle = 0;
+               }
+               else
+                  lpxstr = pstr;
+            }
+            if(lpx == lp1) {
+               if(lre) {
+                  lpxstr = 0;
+                  lre = 0;
+               }
+               else
+                  lpxstr = nstr;
+            }
+            lpx += lpxstr;
+            plan_add(plan, limg, lpx, lo[i]);
+         }
+         limg++;
+      }
+      if(lspx == lp0){
+         if(lle2) {
+            lspxstr = 0;
+            lle2 = 0;
+         }
+         else
+            lspxstr = pstr;
+      }
+      lspx += lspxstr;
+      lstap = 1;
+
+      for(tap = hstap; tap >=0; tap--) {
+         hle = hle2;
+         hre = hre2;
+         hpx = hspx;
+         hpxstr = hspxstr;
+         fhre = ofhre;
+         sfac = osfac;
+
+         for(i = tap; i < hsz; i += 2) {
+            if(hpx == hp0) {
+               if(hle) {
+                  hpxstr = 0;
+                  hle = 0;
+               }
+               else {
+                  hpxstr = pstr;
+                  sfac = 1.0;
+               }
+            }
+            if(hpx == hp1) {
+               if(hre) {
+                  hpxstr = 0;
+                  hre = 0;
+                  if(asym && da_ev) {
+                     hre = 1;
+                     fhre--;
+                     sfac = (float)fhre;
+                     if(sfac == 0.0)
+                        hre = 0;
+                  }
+               }
+               else {
+                  hpxstr = nstr;
+                  if(asym)
+                     sfac = -1.0;
+               }
+            }
+            /* (x * hi) * sfac is exactly x * (hi * sfac) */
+            plan_add(plan, himg, hpx, hic[i] * sfac);
+            hpx += hpxstr;
+         }
+         himg++;
+      }
+      if(hspx == hp0) {
+         if(hle2) {
+            hspxstr = 0;
+            hle2 = 0;
+         }
+         else {
+            hspxstr = pstr;
+            osfac = 1.0;
+         }
+      }
+      hspx += hspxstr;
+      hstap = 1;
+   }
+
+
+   if(da_ev)
+      if(lotap)
+         lstap = 1;
+      else
+         lstap = 0;
+   else
+      if(lotap)
+         lstap = 2;
+      else
+         lstap = 1;
+
+   for(tap = 1; tap >= lstap; tap--) {
+      lle = lle2;
+      lre = lre2;
+      lpx = lspx;
+      lpxstr = lspxstr;
+
+      plan_set(plan, limg, lpx, lo[tap]);
+      for(i = tap+2; i < lsz; i += 2) {
+         if(lpx == lp0){
+            if(lle) {
+               lpxstr = 0;
+               lle = 0;
+            }
+            else
+               lpxstr = pstr;
+         }
+         if(lpx == lp1) {
+            if(lre) {
+               lpxstr = 0;
+               lre = 0;
+            }
+            else
+               lpxstr = nstr;
+         }
+         lpx += lpxstr;
+         plan_add(plan, limg, lpx, lo[i]);
+      }
+      limg++;
+   }
+
+
+   if(da_ev) {
+      if(hotap)
+         hstap = 1;
+      else
+         hstap = 0;
+
+      if(hsz == 2) {
+         hspx -= hspxstr;
+         fhre = 1;
+      }
+   }
+   else
+      if(hotap)
+         hstap = 2;
+      else
+         hstap = 1;
+
+
+   for(tap = 1; tap >= hstap; tap--) {
+      hle = hle2;
+      hre = hre2;
+      hpx = hspx;
+      hpxstr = hspxstr;
+      sfac = osfac;
+      if(hsz != 2)
+         fhre = ofhre;
+
+      for(i = tap; i < hsz; i += 2) {
+         if(hpx == hp0) {
+            if(hle) {
+               hpxstr = 0;
+               hle = 0;
+            }
+            else {
+               hpxstr = pstr;
+               sfac = 1.0;
+            }
+         }
+         if(hpx == hp1) {
+            if(hre) {
+               hpxstr = 0;
+               hre = 0;
+               if(asym && da_ev) {
+                  hre = 1;
+                  fhre--;
+                  sfac = (float)fhre;
+                  if(sfac == 0.0)
+                     hre = 0;
+               }
+            }
+            else {
+               hpxstr = nstr;
+               if(asym)
+                  sfac = -1.0;
+            }
+         }
+         plan_add(plan, himg, hpx, hic[i] * sfac);
+         hpx += hpxstr;
+      }
+      himg++;
+   }
+
+   if(!plan_complete(plan))
+      return(0);
+
+   add_join_lets_runs(plan);
+
+   /* Variants for lines with a zero half. */
+   for(i = 0; i < 2; i++) {
+      plan->drop[i] = (LETS_PLAN *)malloc(sizeof(LETS_PLAN));
+      if(plan->drop[i] == (LETS_PLAN *)NULL) {
+         free_lets_plan(plan);
+         fprintf(stderr, "ERROR : build_join_lets_plan : malloc : drop\n");
+         return(-98);
+      }
+      if((ret = build_drop_lets_plan(plan->drop[i], plan, i))) {
+         free(plan->drop[i]);
+         plan->drop[i] = (LETS_PLAN *)NULL;
+         free_lets_plan(plan);
+         return(ret);
+      }
+   }
+
+   return(0);
+}
+
+/*****************************************************************/
+/* Computes one output from its terms, in their order.           */
+/*****************************************************************/
+static INLINE float lets_output(const float *in, const LETS_TERM *term,
+                                const int nterms, const int zero)
+{
+   float acc;
+   int i;
+
+   if(zero) {
+      acc = 0.0;
+      i = 0;
+   }
+   else {
+      acc = in[term[0].idx] * term[0].coef;
+      i = 1;
+   }
+   for(; i < nterms; i++)
+      acc += in[term[i].idx] * term[i].coef;
+
+   return(acc);
+}
+
+#if defined(CPU_SSE2)
+#define VEC              __m128
+#define VLEN             4
+#define VLOAD(p)         _mm_loadu_ps(p)
+#define VSTORE(p, v)     _mm_storeu_ps(p, v)
+#define VADD(a, b)       _mm_add_ps(a, b)
+#define VMUL(a, b)       _mm_mul_ps(a, b)
+#define VXOR(a, b)       _mm_xor_ps(a, b)
+#define VMADD(a, b, c)   _mm_add_ps(c, _mm_mul_ps(a, b))
+#define VSET1(x)         _mm_set1_ps(x)
+#define VZERO()          _mm_setzero_ps()
+#define VSTORE2(p, e, o) (_mm_storeu_ps(p, _mm_unpacklo_ps(e, o)), \
+                          _mm_storeu_ps((p) + 4, _mm_unpackhi_ps(e, o)))
+#define SFX(name)        name##_sse2
+#define VTARGET
+#include "letsvec.h"
+#undef VEC
+#undef VLEN
+#undef VLOAD
+#undef VSTORE
+#undef VADD
+#undef VMUL
+#undef VXOR
+#undef VMADD
+#undef VSET1
+#undef VZERO
+#undef VSTORE2
+#undef SFX
+#undef VTARGET
+#endif
+
+#if defined(CPU_WSQ_KERNELS_AVX2)
+static INLINE TARGET_AVX2 void store2_avx2(float *p, const __m256 e,
+                                           const __m256 o)
+{
+   __m256 lo, hi;
+
+   lo = _mm256_unpacklo_ps(e, o);
+   hi = _mm256_unpackhi_ps(e, o);
+   _mm256_storeu_ps(p, _mm256_permute2f128_ps(lo, hi, 0x20));
+   _mm256_storeu_ps(p + 8, _mm256_permute2f128_ps(lo, hi, 0x31));
+}
+
+#define VEC              __m256
+#define VLEN             8
+#define VLOAD(p)         _mm256_loadu_ps(p)
+#define VSTORE(p, v)     _mm256_storeu_ps(p, v)
+#define VADD(a, b)       _mm256_add_ps(a, b)
+#define VMUL(a, b)       _mm256_mul_ps(a, b)
+#define VXOR(a, b)       _mm256_xor_ps(a, b)
+#define VMADD(a, b, c)   _mm256_add_ps(c, _mm256_mul_ps(a, b))
+#define VSET1(x)         _mm256_set1_ps(x)
+#define VZERO()          _mm256_setzero_ps()
+#define VSTORE2(p, e, o) store2_avx2(p, e, o)
+#define SFX(name)        name##_avx2
+#define VTARGET          TARGET_AVX2
+#include "letsvec.h"
+#undef VMADD
+#undef VSTORE2
+#undef SFX
+#undef VTARGET
+
+/* The folded kernels again, with fused multiply-adds. */
+#define LETS_FOLD_ONLY
+#define VMADD(a, b, c)   _mm256_fmadd_ps(a, b, c)
+#define VSTORE2(p, e, o) store2_avx2(p, e, o)
+#define SFX(name)        name##_fma
+#define VTARGET          TARGET_FMA
+#include "letsvec.h"
+#undef LETS_FOLD_ONLY
+#undef VEC
+#undef VLEN
+#undef VLOAD
+#undef VSTORE
+#undef VADD
+#undef VMUL
+#undef VXOR
+#undef VMADD
+#undef VSET1
+#undef VZERO
+#undef VSTORE2
+#undef SFX
+#undef VTARGET
+#endif
+
+/*****************************************************************/
+/* Routine to pick the vector kernel of a run for the processor  */
+/* running the library, NULL if there is none.                   */
+/*****************************************************************/
+static LETS_RUN_FN lets_run_kernel(const LETS_ARGS *a, const int bank)
+{
+#if defined(CPU_WSQ_KERNELS_AVX2)
+   int features;
+
+   features = cpu_features_wsq();
+   if(a->fold && (features & CPU_WSQ_FMA))
+      return(lets_fold_kernel_fma(a, bank));
+   if(features & CPU_WSQ_AVX2)
+      return(lets_run_kernel_avx2(a, bank));
+#endif
+#if defined(CPU_SSE2)
+   return(lets_run_kernel_sse2(a, bank));
+#else
+   return((LETS_RUN_FN)NULL);
+#endif
+}
+
+/*****************************************************************/
+/* Routine to pick the vector kernel of a pair of even and odd   */
+/* runs, NULL if there is none.                                  */
+/*****************************************************************/
+static LETS_PAIR_FN lets_pair_kernel(const LETS_ARGS *e, const LETS_ARGS *o,
+                                     const int bank)
+{
+#if defined(CPU_WSQ_KERNELS_AVX2)
+   int features;
+
+   features = cpu_features_wsq();
+   if(e->fold && (features & CPU_WSQ_FMA))
+      return(lets_fold_pair_kernel_fma(e, o, bank));
+   if(features & CPU_WSQ_AVX2)
+      return(lets_pair_kernel_avx2(e, o, bank));
+#endif
+#if defined(CPU_SSE2)
+   return(lets_pair_kernel_sse2(e, o, bank));
+#else
+   return((LETS_PAIR_FN)NULL);
+#endif
+}
+
+/*****************************************************************/
+/* Computes outputs j0 <= j < count of a run one at a time, with */
+/* the operations of the vector kernels.                         */
+/*****************************************************************/
+static void lets_run_scalar(float *out, const LETS_ARGS *a, const int j0,
+                            const int count, const int ostep)
+{
+   int j, k;
+   float acc, x;
+
+   for(j = j0; j < count; j++) {
+      if(a->fold) {
+         acc = 0.0f;
+         for(k = 0; k < a->npairs; k++) {
+            x = a->base[2*k+1][j];
+            if(a->neg[k])
+               x = -x;
+            acc += (a->base[2*k][j] + x) * a->coef[k];
+         }
+         for(k = 0; k < a->nsingle; k++)
+            acc += a->base[2*a->npairs+k][j] * a->coef[a->npairs+k];
+      }
+      else {
+         acc = a->base[0][j] * a->coef[0];
+         if(a->zero)
+            acc = 0.0f + acc;
+         for(k = 1; k < a->nterms; k++)
+            acc += a->base[k][j] * a->coef[k];
+      }
+      out[j * ostep] = acc;
+   }
+}
+
+/*****************************************************************/
+/* Routine to set up the inputs and coefficients of a run.  The  */
+/* input of term idx is at in + idx*pitch; runs advancing two    */
+/* samples read rows split in evens and odds instead.            */
+/*****************************************************************/
+static void lets_run_args(LETS_ARGS *a, const LETS_RUN *run, const float *in,
+                          const int pitch, const float *evens,
+                          const float *odds)
+{
+   int k, n, idx;
+   const LETS_TERM *term;
+
+   a->zero = run->zero;
+   a->fold = run->npairs + run->nsingle > 0;
+   a->nterms = run->nterms;
+   a->npairs = run->npairs;
+   a->nsingle = run->nsingle;
+   if(a->fold) {
+      term = run->folds;
+      n = 2 * run->npairs + run->nsingle;
+   }
+   else {
+      term = run->terms;
+      n = run->nterms;
+   }
+   for(k = 0; k < n; k++) {
+      idx = term[k].idx;
+      if(evens != (float *)NULL)
+         a->base[k] = ((idx & 1) ? odds : evens) + (idx >> 1);
+      else
+         a->base[k] = in + idx * pitch;
+   }
+   if(a->fold) {
+      for(k = 0; k < run->npairs; k++) {
+         a->coef[k] = term[2*k].coef;
+         a->mask[k] = term[2*k+1].coef;
+         a->neg[k] = memcmp(&a->mask[k], &neg_zero, sizeof(float)) == 0;
+      }
+      for(k = 0; k < run->nsingle; k++)
+         a->coef[run->npairs+k] = term[2*run->npairs+k].coef;
+   }
+   else
+      for(k = 0; k < n; k++)
+         a->coef[k] = term[k].coef;
+}
+
+/*****************************************************************/
+/* Routine to find the range ja <= j < jb of the outputs of a    */
+/* run that fall in the window o0 <= o < o1.                     */
+/*****************************************************************/
+static void lets_run_window(const LETS_RUN *run, const int o0, const int o1,
+                            int *oja, int *ojb)
+{
+   int ja, jb;
+
+   ja = o0 <= run->o0 ? 0 : (o0 - run->o0 + run->ostep - 1) / run->ostep;
+   jb = o1 <= run->o0 ? 0 : (o1 - run->o0 + run->ostep - 1) / run->ostep;
+   if(jb > run->count)
+      jb = run->count;
+   if(ja > jb)
+      ja = jb;
+
+   *oja = ja;
+   *ojb = jb;
+}
+
+/*****************************************************************/
+/* Computes outputs ja <= j < jb of a run one at a time, from    */
+/* the terms the plan keeps for each output.                     */
+/*****************************************************************/
+static void lets_run_outputs(float *out, const float *in,
+                             const LETS_PLAN *plan, const LETS_RUN *run,
+                             const int ja, const int jb)
+{
+   int j, o;
+
+   for(j = ja; j < jb; j++) {
+      o = run->o0 + j * run->ostep;
+      out[o] = lets_output(in, plan->terms + o * plan->maxterms,
+                           plan->nterms[o], plan->zero[o]);
+   }
+}
+
+/*****************************************************************/
+/* Routine to find the inputs o0 <= o < o1 of a line read for    */
+/* the outputs of a plan: i0 <= i < i1, empty if none.           */
+/*****************************************************************/
+void lets_plan_inputs(const LETS_PLAN *plan, const int o0, const int o1,
+                      int *oi0, int *oi1)
+{
+   int o, k, i0, i1;
+   const LETS_TERM *term;
+
+   i0 = plan->len;
+   i1 = 0;
+   for(o = o0; o < o1; o++) {
+      term = plan->terms + o * plan->maxterms;
+      for(k = 0; k < plan->nterms[o]; k++) {
+         if(term[k].idx < i0)
+            i0 = term[k].idx;
+         if(term[k].idx + 1 > i1)
+            i1 = term[k].idx + 1;
+      }
+   }
+   if(i0 > i1)
+      i0 = i1;
+
+   *oi0 = i0;
+   *oi1 = i1;
+}
+
+/*****************************************************************/
+/* Routine to filter nlines contiguous lines, pitch samples      */
+/* apart, from old into new following a valid plan, computing    */
+/* outputs o0 <= o < o1 of each line only.  scratch holds        */
+/* plan->len + 1 floats.                                         */
+/*****************************************************************/
+void lets_rows(
+   float *new,           /* filtered lines */
+   float *old,           /* lines to filter */
+   const int nlines,     /* number of lines */
+   const int pitch,      /* samples from one line to the next */
+   LETS_PLAN *plan,      /* plan of the filter pass */
+   const int o0,         /* window of the outputs computed */
+   const int o1,
+   float *scratch)       /* line split in evens and odds */
+{
+   int line, o, i, j, len, ja, jb, ja1, jb1;
+   float *in, *out, *evens, *odds;
+   LETS_ARGS args[MAX_LETS_RUNS];
+   LETS_RUN *run;
+   LETS_RUN_FN run_fn;
+   LETS_PAIR_FN pair_fn;
+
+   len = plan->len;
+   evens = scratch;
+   odds = scratch + (len + 1) / 2;
+
+   for(line = 0; line < nlines; line++) {
+      in = old + line * pitch;
+      out = new + line * pitch;
+
+      for(o = o0; o < o1; o++)
+         if(!plan->inrun[o])
+            out[o] = lets_output(in, plan->terms + o * plan->maxterms,
+                                 plan->nterms[o], plan->zero[o]);
+
+      if(plan->nruns == 0)
+         continue;
+
+      if(plan->join) {
+         /* The pair kernel covers the outputs of both runs in the */
+         /* window, the outputs of one only are computed alone.    */
+         run = plan->runs;
+         lets_run_window(run, o0, o1, &ja, &jb);
+         lets_run_window(run + 1, o0, o1, &ja1, &jb1);
+         if(ja1 >= jb || ja >= jb1) {
+            lets_run_outputs(out, in, plan, run, ja, jb);
+            lets_run_outputs(out, in, plan, run + 1, ja1, jb1);
+            continue;
+         }
+         lets_run_outputs(out, in, plan, run, ja, ja1 > ja ? ja1 : ja);
+         lets_run_outputs(out, in, plan, run + 1, ja1, ja > ja1 ? ja : ja1);
+         lets_run_outputs(out, in, plan, run, jb1 < jb ? jb1 : jb, jb);
+         lets_run_outputs(out, in, plan, run + 1, jb < jb1 ? jb : jb1, jb1);
+         if(ja1 > ja)
+            ja = ja1;
+         if(jb1 < jb)
+            jb = jb1;
+         lets_run_args(&args[0], run, in + ja, 1, (float *)NULL,
+                       (float *)NULL);
+         lets_run_args(&args[1], run + 1, in + ja, 1, (float *)NULL,
+                       (float *)NULL);
+         pair_fn = lets_pair_kernel(&args[0], &args[1], plan->bank);
+         j = pair_fn != (LETS_PAIR_FN)NULL ?
+             pair_fn(out + run->o0 + ja * run->ostep, &args[0], &args[1],
+                     jb - ja) : 0;
+         lets_run_scalar(out + run->o0 + ja * run->ostep, &args[0], j,
+                         jb - ja, 2);
+         lets_run_scalar(out + run[1].o0 + ja * run[1].ostep, &args[1], j,
+                         jb - ja, 2);
+         continue;
+      }
+
+      for(i = 0; i < len - 1; i += 2) {
+         evens[i>>1] = in[i];
+         odds[i>>1] = in[i+1];
+      }
+      if(len & 1)
+         evens[len>>1] = in[len-1];
+      for(i = 0; i < plan->nruns; i++) {
+         run = plan->runs + i;
+         lets_run_window(run, o0, o1, &ja, &jb);
+         if(ja >= jb)
+            continue;
+         lets_run_args(&args[i], run, in, 1, evens + ja, odds + ja);
+         run_fn = lets_run_kernel(&args[i], plan->bank);
+         j = run_fn != (LETS_RUN_FN)NULL ?
+             run_fn(out + run->o0 + ja * run->ostep, &args[i], jb - ja) : 0;
+         lets_run_scalar(out + run->o0 + ja * run->ostep, &args[i], j,
+                         jb - ja, 1);
+      }
+   }
+}
+
+/*****************************************************************/
+/* Routine to find the outputs of a plan whose terms all read    */
+/* inputs flagged in zero, which are then zero.                  */
+/*****************************************************************/
+void lets_plan_zeros(const LETS_PLAN *plan, const char *zero, char *ozero)
+{
+   int o, k;
+   const LETS_TERM *term;
+
+   for(o = 0; o < plan->len; o++) {
+      term = plan->terms + o * plan->maxterms;
+      for(k = 0; k < plan->nterms[o]; k++)
+         if(!zero[term[k].idx])
+            break;
+      ozero[o] = k == plan->nterms[o];
+   }
+}
+
+/* Returns non-zero if a term of output o reads an input in zero. */
+static int lets_reads_zero(const LETS_PLAN *plan, const int o,
+                           const char *zero)
+{
+   int k;
+   const LETS_TERM *term;
+
+   if(zero == (const char *)NULL)
+      return(0);
+   term = plan->terms + o * plan->maxterms;
+   for(k = 0; k < plan->nterms[o]; k++)
+      if(zero[term[k].idx])
+         return(1);
+
+   return(0);
+}
+
+/*****************************************************************/
+/* Routine to filter ncols adjacent lines (image columns) from   */
+/* old into new following a valid plan, computing outputs        */
+/* o0 <= o < o1 of each line only.  Sample i of every line is in */
+/* the image row i*pitch floats from the start.  If zero is not  */
+/* NULL, the rows i flagged in it are zero and the terms reading */
+/* them are left out.                                            */
+/*****************************************************************/
+void lets_cols(
+   float *new,           /* filtered lines */
+   float *old,           /* lines to filter */
+   const int ncols,      /* number of lines */
+   const int pitch,      /* samples from one row to the next */
+   LETS_PLAN *plan,      /* plan of the filter pass */
+   const int o0,         /* window of the outputs computed */
+   const int o1,
+   const char *zero)     /* zero input rows, or NULL */
+{
+   int o, i, j, k, c, n, ja, jb;
+   float *row;
+   LETS_ARGS args;
+   LETS_RUN *run;
+   LETS_TERM *term;
+   LETS_RUN_FN run_fn;
+
+   /* Edge rows, and rows reading zero rows, from the terms of */
+   /* each output.                                             */
+   for(o = o0; o < o1; o++) {
+      if(plan->inrun[o] && !lets_reads_zero(plan, o, zero))
+         continue;
+      row = new + o * pitch;
+      term = plan->terms + o * plan->maxterms;
+      args.zero = plan->zero[o];
+      args.fold = 0;
+      args.nterms = 0;
+      for(k = 0; k < plan->nterms[o]; k++) {
+         if(zero != (const char *)NULL && zero[term[k].idx])
+            continue;
+         args.base[args.nterms] = old + term[k].idx * pitch;
+         args.coef[args.nterms++] = term[k].coef;
+      }
+      if(args.nterms == 0) {
+         for(c = 0; c < ncols; c++)
+            row[c] = 0.0;
+         continue;
+      }
+      run_fn = lets_run_kernel(&args, WSQ_BANK_OTHER);
+      c = run_fn != (LETS_RUN_FN)NULL ? run_fn(row, &args, ncols) : 0;
+      lets_run_scalar(row, &args, c, ncols, 1);
+   }
+
+   /* Interior rows, each run's terms moved down istep rows at a time. */
+   for(i = 0; i < plan->nruns; i++) {
+      run = plan->runs + i;
+      lets_run_window(run, o0, o1, &ja, &jb);
+      if(ja >= jb)
+         continue;
+      lets_run_args(&args, run, old + ja * run->istep * pitch, pitch,
+                    (float *)NULL, (float *)NULL);
+      n = args.fold ? 2 * args.npairs + args.nsingle : args.nterms;
+      run_fn = lets_run_kernel(&args, plan->bank);
+      for(j = ja; j < jb; j++) {
+         o = run->o0 + j * run->ostep;
+         if(!lets_reads_zero(plan, o, zero)) {
+            row = new + o * pitch;
+            c = run_fn != (LETS_RUN_FN)NULL ? run_fn(row, &args, ncols) : 0;
+            lets_run_scalar(row, &args, c, ncols, 1);
+         }
+         for(k = 0; k < n; k++)
+            args.base[k] += run->istep * pitch;
+      }
+   }
+}
+
+/*****************************************************************/
+/* Routine to test if a transform with the given filters and     */
+/* tree may be computed by lifting: the filters must be the      */
+/* standard 9/7 bank and every subband line long enough for the  */
+/* convolution walk to stay inside it.                           */
+/*****************************************************************/
+int can_lift_97(float *hi, const int hsz, float *lo, const int lsz,
+                W_TREE w_tree[], const int w_treelen, const int synthesis)
+{
+   int node;
+
+   if(wsq_filter_bank(hi, hsz, lo, lsz, synthesis) != WSQ_BANK_97)
+      return(0);
+   for(node = 0; node < w_treelen; node++)
+      if(w_tree[node].lenx < MIN_LIFT_LEN || w_tree[node].leny < MIN_LIFT_LEN)
+         return(0);
+
+   return(1);
+}
+
+/* x[c] += f * (a[c] + b[c]) for c < n */
+typedef void (*LIFT_STEP_FN)(float *, const float *, const float *,
+                             const int, const float);
+
+#if !defined(CPU_SSE2)
+static void lift_step(float *x, const float *a, const float *b,
+                      const int n, const float f)
+{
+   int c;
+
+   for(c = 0; c < n; c++)
+      x[c] += f * (a[c] + b[c]);
+}
+#else
+static void lift_step_sse2(float *x, const float *a, const float *b,
+                           const int n, const float f)
+{
+   int c;
+   __m128 vf;
+
+   vf = _mm_set1_ps(f);
+   for(c = 0; c + 4 <= n; c += 4)
+      _mm_storeu_ps(x + c, _mm_add_ps(_mm_loadu_ps(x + c),
+                    _mm_mul_ps(vf, _mm_add_ps(_mm_loadu_ps(a + c),
+                                              _mm_loadu_ps(b + c)))));
+   for(; c < n; c++)
+      x[c] += f * (a[c] + b[c]);
+}
+#endif
+
+#if defined(CPU_WSQ_KERNELS_AVX2)
+static TARGET_FMA void lift_step_fma(float *x, const float *a,
+                                     const float *b, const int n,
+                                     const float f)
+{
+   int c;
+   __m256 vf;
+
+   vf = _mm256_set1_ps(f);
+   for(c = 0; c + 8 <= n; c += 8)
+      _mm256_storeu_ps(x + c, _mm256_fmadd_ps(vf,
+                       _mm256_add_ps(_mm256_loadu_ps(a + c),
+                                     _mm256_loadu_ps(b + c)),
+                       _mm256_loadu_ps(x + c)));
+   for(; c < n; c++)
+      x[c] += f * (a[c] + b[c]);
+}
+#endif
+
+/*****************************************************************/
+/* Routine to pick the lifting step for the processor running    */
+/* the library.                                                  */
+/*****************************************************************/
+static LIFT_STEP_FN lift_step_kernel(void)
+{
+#if defined(CPU_WSQ_KERNELS_AVX2)
+   if(cpu_features_wsq() & CPU_WSQ_FMA)
+      return(lift_step_fma);
+#endif
+#if defined(CPU_SSE2)
+   return(lift_step_sse2);
+#else
+   return(lift_step);
+#endif
+}
+
+/* odd[k] += f * (even[k] + even[k+1]), mirrored at the right end */
+static void lift_odd(float *odd, const float *even, const int no,
+                     const int ne, const int w, const float f,
+                     LIFT_STEP_FN step)
+{
+   int k;
+   const float *e0, *e1;
+
+   for(k = 0; k < no; k++) {
+      e0 = even + k * w;
+      e1 = (k + 1 < ne) ? e0 + w : e0;
+      step(odd + k * w, e0, e1, w, f);
+   }
+}
+
+/* even[k] += f * (odd[k-1] + odd[k]), mirrored at both ends */
+static void lift_even(float *even, const float *odd, const int ne,
+                      const int no, const int w, const float f,
+                      LIFT_STEP_FN step)
+{
+   int k;
+   const float *o0, *o1;
+
+   for(k = 0; k < ne; k++) {
+      o0 = odd + (k > 0 ? k - 1 : 0) * w;
+      o1 = odd + (k < no ? k : no - 1) * w;
+      step(even + k * w, o0, o1, w, f);
+   }
+}
+
+/*****************************************************************/
+/* Routine to split w lines of n samples into their lowpass and  */
+/* highpass halves, in place.  Sample i of line c is at          */
+/* data[i*istep + c*cstep]; scratch holds n*w floats.            */
+/*****************************************************************/
+static void lift_lines_97(float *data, const int n, const int istep,
+                          const int w, const int cstep, const int inv,
+                          float *scratch)
+{
+   int i, c, ne, no, lo0, hi0;
+   float *even, *odd, *p, *q;
+   LIFT_STEP_FN step;
+
+   ne = (n + 1) / 2;
+   no = n / 2;
+   even = scratch;
+   odd = scratch + ne * w;
+
+   for(i = 0; i < n; i++) {
+      p = data + i * istep;
+      q = ((i & 1) ? odd : even) + (i >> 1) * w;
+      for(c = 0; c < w; c++)
+         q[c] = p[c * cstep];
+   }
+
+   step = lift_step_kernel();
+   lift_odd(odd, even, no, ne, w, LIFT_A, step);
+   lift_even(even, odd, ne, no, w, LIFT_B, step);
+   lift_odd(odd, even, no, ne, w, LIFT_C, step);
+   lift_even(even, odd, ne, no, w, LIFT_D, step);
+
+   lo0 = inv ? no : 0;
+   hi0 = inv ? 0 : ne;
+   for(i = 0; i < ne; i++) {
+      p = data + (lo0 + i) * istep;
+      q = even + i * w;
+      for(c = 0; c < w; c++)
+         p[c * cstep] = q[c] * LIFT_K;
+   }
+   for(i = 0; i < no; i++) {
+      p = data + (hi0 + i) * istep;
+      q = odd + i * w;
+      for(c = 0; c < w; c++)
+         p[c * cstep] = q[c] * (1.0f / LIFT_K);
+   }
+}
+
+/*****************************************************************/
+/* Routine to merge the lowpass and highpass halves of w lines   */
+/* of n samples, in place.  The inverse of lift_lines_97.        */
+/*****************************************************************/
+static void unlift_lines_97(float *data, const int n, const int istep,
+                            const int w, const int cstep, const int inv,
+                            float *scratch)
+{
+   int i, c, ne, no, lo0, hi0;
+   float *even, *odd, *p, *q;
+   LIFT_STEP_FN step;
+
+   ne = (n + 1) / 2;
+   no = n / 2;
+   even = scratch;
+   odd = scratch + ne * w;
+
+   lo0 = inv ? no : 0;
+   hi0 = inv ? 0 : ne;
+   for(i = 0; i < ne; i++) {
+      p = data + (lo0 + i) * istep;
+      q = even + i * w;
+      for(c = 0; c < w; c++)
+         q[c] = p[c * cstep] * (1.0f / LIFT_K);
+   }
+   for(i = 0; i < no; i++) {
+      p = data + (hi0 + i) * istep;
+      q = odd + i * w;
+      for(c = 0; c < w; c++)
+         q[c] = p[c * cstep] * LIFT_K;
+   }
+
+   step = lift_step_kernel();
+   lift_even(even, odd, ne, no, w, -LIFT_D, step);
+   lift_odd(odd, even, no, ne, w, -LIFT_C, step);
+   lift_even(even, odd, ne, no, w, -LIFT_B, step);
+   lift_odd(odd, even, no, ne, w, -LIFT_A, step);
+
+   for(i = 0; i < n; i++) {
+      p = data + i * istep;
+      q = ((i & 1) ? odd : even) + (i >> 1) * w;
+      for(c = 0; c < w; c++)
+         p[c * cstep] = q[c];
+   }
+}
+
+/* Kinds of filter pass a job runs part of. */
+#define LETS_JOB_ROWS      0   /* lets_rows */
+#define LETS_JOB_COLS      1   /* lets_cols */
+#define LETS_JOB_LIFT      2   /* lift_lines_97, a strip at a time */
+#define LETS_JOB_UNLIFT    3   /* unlift_lines_97, a strip at a time */
+#define LETS_JOB_PIXELS    4   /* lets_rows of lines of pixels */
+#define LETS_JOB_2_PIXELS  5   /* lets_rows into lines of pixels */
+
+/* Lines first to first + nlines - 1 of a filter pass. */
+typedef struct lets_job {
+   int kind;            /* LETS_JOB_* */
+   float *new;          /* filtered lines, or the lifted data */
+   float *old;          /* lines to filter */
+   int first;           /* first line of the job */
+   int nlines;          /* lines of the job */
+   int pitch;           /* samples from one line to the next */
+   LETS_PLAN *plan;     /* plan of a rows or columns pass */
+   int o0;              /* window of the outputs of a plan's lines */
+   int o1;
+   const char *zero;    /* zero input rows of a columns pass, or NULL */
+   int len;             /* samples along a lifted line */
+   int istep;           /* samples between those of a lifted line */
+   int inv;             /* spectral inversion of a lifted pass */
+   unsigned char *pixels; /* lines of pixels filtered, or written */
+   float m_shift;       /* shift and scale of the pixels */
+   float r_scale;
+   float *scratch;      /* lines of scratch of the job */
+} LETS_JOB;
+
+/*****************************************************************/
+/* Routine to return the most jobs a pass on up to nthreads      */
+/* threads is split in; each takes its own lines of scratch.     */
+/*****************************************************************/
+int lets_max_jobs(const int nthreads)
+{
+   if(nthreads < 1)
+      return(1);
+   if(nthreads > MAX_THREADS_WSQ)
+      return(MAX_THREADS_WSQ);
+   return(nthreads);
+}
+
+static void lets_job(void *arg)
+{
+   LETS_JOB *job;
+   int l, w, last;
+   float *line;
+
+   job = (LETS_JOB *)arg;
+   switch(job->kind) {
+   case LETS_JOB_ROWS:
+      lets_rows(job->new + job->first * job->pitch,
+                job->old + job->first * job->pitch, job->nlines,
+                job->pitch, job->plan, job->o0, job->o1, job->scratch);
+      break;
+   case LETS_JOB_PIXELS:
+      /* Each line of pixels as floats after the scratch of lets_rows. */
+      line = job->scratch + job->plan->len + 1;
+      for(l = job->first; l < job->first + job->nlines; l++) {
+         pixels_2_flt_wsq(line, job->pixels + l * job->pitch,
+                          job->plan->len, job->m_shift, job->r_scale);
+         lets_rows(job->new + l * job->pitch, line, 1, job->pitch,
+                   job->plan, job->o0, job->o1, job->scratch);
+      }
+      break;
+   case LETS_JOB_2_PIXELS:
+      /* Each line filtered after the scratch of lets_rows, then */
+      /* converted to pixels.                                    */
+      line = job->scratch + job->plan->len + 1;
+      for(l = job->first; l < job->first + job->nlines; l++) {
+         lets_rows(line, job->old + l * job->pitch, 1, job->pitch,
+                   job->plan, 0, job->plan->len, job->scratch);
+         flt_2_pixels_wsq(job->pixels + l * job->pitch, line,
+                          job->plan->len, job->m_shift, job->r_scale);
+      }
+      break;
+   case LETS_JOB_COLS:
+      lets_cols(job->new + job->first, job->old + job->first,
+                job->nlines, job->pitch, job->plan, job->o0, job->o1,
+                job->zero);
+      break;
+   case LETS_JOB_LIFT:
+      last = job->first + job->nlines;
+      for(l = job->first; l < last; l += LIFT_STRIP) {
+         w = last - l < LIFT_STRIP ? last - l : LIFT_STRIP;
+         lift_lines_97(job->new + l * job->pitch, job->len, job->istep,
+                       w, job->pitch, job->inv, job->scratch);
+      }
+      break;
+   case LETS_JOB_UNLIFT:
+      last = job->first + job->nlines;
+      for(l = job->first; l < last; l += LIFT_STRIP) {
+         w = last - l < LIFT_STRIP ? last - l : LIFT_STRIP;
+         unlift_lines_97(job->new + l * job->pitch, job->len, job->istep,
+                         w, job->pitch, job->inv, job->scratch);
+      }
+      break;
+   }
+}
+
+/*****************************************************************/
+/* Routine to run the nlines lines of the pass described by job  */
+/* as jobs on up to nthreads threads, each with lsize floats of  */
+/* scratch.  Jobs start on multiples of LIFT_STRIP lines, so     */
+/* that vectors and strips fall as in a single job and the       */
+/* results do not depend on the number of threads, and have at   */
+/* least MIN_JOB_SAMPLES samples to be worth a thread.           */
+/*****************************************************************/
+static void run_lets_jobs(LETS_JOB *job, const int nlines, const int len,
+                          float *scratch, const int lsize,
+                          const int nthreads)
+{
+   LETS_JOB jobs[MAX_THREADS_WSQ];
+   int i, njobs, per;
+
+   njobs = lets_max_jobs(nthreads);
+   if((double)nlines * len < (double)njobs * MIN_JOB_SAMPLES)
+      njobs = (int)((double)nlines * len / MIN_JOB_SAMPLES);
+   if(njobs < 1)
+      njobs = 1;
+
+   per = (nlines + njobs - 1) / njobs;
+   per = (per + LIFT_STRIP - 1) / LIFT_STRIP * LIFT_STRIP;
+   njobs = (nlines + per - 1) / per;
+
+   for(i = 0; i < njobs; i++) {
+      jobs[i] = *job;
+      jobs[i].first = i * per;
+      jobs[i].nlines = nlines - i * per < per ? nlines - i * per : per;
+      jobs[i].scratch = scratch + i * lsize;
+   }
+   run_jobs_wsq(lets_job, jobs, sizeof(LETS_JOB), njobs, nthreads);
+}
+
+/*****************************************************************/
+/* Routine to filter nlines contiguous lines like lets_rows, on  */
+/* up to nthreads threads.  scratch holds plan->len + 1 floats   */
+/* for each of lets_max_jobs(nthreads) jobs.                     */
+/*****************************************************************/
+void split_lets_rows(float *new, float *old, const int nlines,
+                     const int pitch, LETS_PLAN *plan, float *scratch,
+                     const int nthreads)
+{
+   window_lets_rows(new, old, nlines, pitch, plan, 0, plan->len, scratch,
+                    nthreads);
+}
+
+/*****************************************************************/
+/* Routine to filter ncols adjacent lines like lets_cols, on up  */
+/* to nthreads threads.                                          */
+/*****************************************************************/
+void split_lets_cols(float *new, float *old, const int ncols,
+                     const int pitch, LETS_PLAN *plan, const int nthreads)
+{
+   window_lets_cols(new, old, ncols, pitch, plan, 0, plan->len, nthreads);
+}
+
+/*****************************************************************/
+/* Routines to compute the outputs o0 <= o < o1 only of lines    */
+/* filtered like split_lets_rows and split_lets_cols.            */
+/*****************************************************************/
+void window_lets_rows(float *new, float *old, const int nlines,
+                      const int pitch, LETS_PLAN *plan, const int o0,
+                      const int o1, float *scratch, const int nthreads)
+{
+   LETS_JOB job;
+
+   job.kind = LETS_JOB_ROWS;
+   job.new = new;
+   job.old = old;
+   job.pitch = pitch;
+   job.plan = plan;
+   job.o0 = o0;
+   job.o1 = o1;
+   run_lets_jobs(&job, nlines, o1 - o0, scratch, plan->len + 1, nthreads);
+}
+
+void window_lets_cols(float *new, float *old, const int ncols,
+                      const int pitch, LETS_PLAN *plan, const int o0,
+                      const int o1, const int nthreads)
+{
+   LETS_JOB job;
+
+   job.kind = LETS_JOB_COLS;
+   job.new = new;
+   job.old = old;
+   job.pitch = pitch;
+   job.plan = plan;
+   job.o0 = o0;
+   job.o1 = o1;
+   job.zero = (const char *)NULL;
+   run_lets_jobs(&job, ncols, o1 - o0, (float *)NULL, 0, nthreads);
+}
+
+/*****************************************************************/
+/* Routine to filter nlines rows of pixels like window_lets_rows */
+/* filters rows of floats, each pixel x read as the float        */
+/* (x - m_shift) / r_scale of conv_img_2_flt.  scratch holds     */
+/* 2 * plan->len + 1 floats for each of lets_max_jobs(nthreads)  */
+/* jobs.                                                         */
+/*****************************************************************/
+void pixel_lets_rows(float *new, unsigned char *pixels, const int nlines,
+                     const int pitch, LETS_PLAN *plan, const int o0,
+                     const int o1, const float m_shift, const float r_scale,
+                     float *scratch, const int nthreads)
+{
+   LETS_JOB job;
+
+   job.kind = LETS_JOB_PIXELS;
+   job.new = new;
+   job.pixels = pixels;
+   job.pitch = pitch;
+   job.plan = plan;
+   job.o0 = o0;
+   job.o1 = o1;
+   job.m_shift = m_shift;
+   job.r_scale = r_scale;
+   run_lets_jobs(&job, nlines, o1 - o0, scratch, 2 * plan->len + 1,
+                 nthreads);
+}
+
+/*****************************************************************/
+/* Routine to filter nlines rows like split_lets_rows, into rows */
+/* of pixels, each output converted as conv_img_2_uchar does.    */
+/* scratch holds 2 * plan->len + 1 floats for each of            */
+/* lets_max_jobs(nthreads) jobs.                                 */
+/*****************************************************************/
+void lets_rows_2_pixels(unsigned char *pixels, float *old, const int nlines,
+                        const int pitch, LETS_PLAN *plan,
+                        const float m_shift, const float r_scale,
+                        float *scratch, const int nthreads)
+{
+   LETS_JOB job;
+
+   job.kind = LETS_JOB_2_PIXELS;
+   job.old = old;
+   job.pixels = pixels;
+   job.pitch = pitch;
+   job.plan = plan;
+   job.o0 = 0;
+   job.o1 = plan->len;
+   job.m_shift = m_shift;
+   job.r_scale = r_scale;
+   run_lets_jobs(&job, nlines, plan->len, scratch, 2 * plan->len + 1,
+                 nthreads);
+}
+
+/*****************************************************************/
+/* Routine to filter ncols adjacent lines like split_lets_cols,  */
+/* leaving out the terms of the input rows flagged in zero.      */
+/*****************************************************************/
+void zero_lets_cols(float *new, float *old, const int ncols,
+                    const int pitch, LETS_PLAN *plan, const char *zero,
+                    const int nthreads)
+{
+   LETS_JOB job;
+
+   job.kind = LETS_JOB_COLS;
+   job.new = new;
+   job.old = old;
+   job.pitch = pitch;
+   job.plan = plan;
+   job.o0 = 0;
+   job.o1 = plan->len;
+   job.zero = zero;
+   run_lets_jobs(&job, ncols, plan->len, (float *)NULL, 0, nthreads);
+}
+
+/*****************************************************************/
+/* WSQ decompose the image with the lifting steps of the 9/7     */
+/* bank, in place, on up to nthreads threads.  Same results as  */
+/* wsq_decompose within float rounding; see can_lift_97 for when */
+/* it applies.  scratch holds LIFT_STRIP lines of the longer     */
+/* side of the image for each of lets_max_jobs(nthreads) jobs.   */
+/*****************************************************************/
+void lift_decompose_97(float *fdata, const int width, const int height,
+                       W_TREE w_tree[], const int w_treelen,
+                       float *scratch, const int nthreads)
+{
+   int node, lsize;
+   LETS_JOB job;
+
+   lsize = (width > height ? width : height) * LIFT_STRIP;
+   job.kind = LETS_JOB_LIFT;
+   for(node = 0; node < w_treelen; node++) {
+      job.new = fdata + (w_tree[node].y * width) + w_tree[node].x;
+      /* Rows, then columns once all the rows are done. */
+      job.len = w_tree[node].lenx;
+      job.istep = 1;
+      job.pitch = width;
+      job.inv = w_tree[node].inv_rw;
+      run_lets_jobs(&job, w_tree[node].leny, job.len, scratch, lsize,
+                    nthreads);
+      job.len = w_tree[node].leny;
+      job.istep = width;
+      job.pitch = 1;
+      job.inv = w_tree[node].inv_cl;
+      run_lets_jobs(&job, w_tree[node].lenx, job.len, scratch, lsize,
+                    nthreads);
+   }
+}
+
+/*****************************************************************/
+/* WSQ reconstruct the image with the lifting steps of the 9/7   */
+/* bank, in place, on up to nthreads threads.  Same results as  */
+/* wsq_reconstruct within float rounding; see can_lift_97 for    */
+/* when it applies.  scratch holds LIFT_STRIP lines of the       */
+/* longer side of the image for each of lets_max_jobs(nthreads)  */
+/* jobs.                                                         */
+/*****************************************************************/
+void lift_reconstruct_97(float *fdata, const int width, const int height,
+                         W_TREE w_tree[], const int w_treelen,
+                         float *scratch, const int nthreads)
+{
+   int node, lsize;
+   LETS_JOB job;
+
+   lsize = (width > height ? width : height) * LIFT_STRIP;
+   job.kind = LETS_JOB_UNLIFT;
+   for(node = w_treelen - 1; node >= 0; node--) {
+      job.new = fdata + (w_tree[node].y * width) + w_tree[node].x;
+      /* Columns, then rows once all the columns are done. */
+      job.len = w_tree[node].leny;
+      job.istep = width;
+      job.pitch = 1;
+      job.inv = w_tree[node].inv_cl;
+      run_lets_jobs(&job, w_tree[node].lenx, job.len, scratch, lsize,
+                    nthreads);
+      job.len = w_tree[node].lenx;
+      job.istep = 1;
+      job.pitch = width;
+      job.inv = w_tree[node].inv_rw;
+      run_lets_jobs(&job, w_tree[node].leny, job.len, scratch, lsize,
+                    nthreads);
+   }
+}
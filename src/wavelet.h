@@ -0,0 +1,138 @@
+/*
+ * wavelet.h
+ *
+ *  Plans and SIMD kernels for the wavelet filter passes of
+ *  get_lets and join_lets.
+ */
+
+#ifndef WAVELET_H_
+#define WAVELET_H_
+
+#include "wsqInternal.h"
+
+/* Filter banks recognized by wsq_filter_bank. */
+#define WSQ_BANK_OTHER   0
+#define WSQ_BANK_97      1   /* standard 9/7 bank */
+#define WSQ_BANK_88      2   /* FILTBANK_EVEN_8X8_1 bank */
+
+/* One multiply-add of an output sample. */
+typedef struct lets_term {
+   int idx;             /* input sample along the line */
+   float coef;          /* filter coefficient, edge signs folded in */
+} LETS_TERM;
+
+/* Outputs o0 + ostep*j, j < count, sharing one sequence of terms */
+/* whose inputs advance by istep from those of the first output.  */
+/* Folded runs pair the terms sharing a coefficient magnitude:    */
+/* folds holds npairs (first, second) pairs, the coef of the      */
+/* second being -0.0 where its input is subtracted, then nsingle  */
+/* unpaired terms.                                                */
+typedef struct lets_run {
+   int o0;              /* first output of the run */
+   int ostep;           /* outputs between those of the run */
+   int count;           /* number of outputs */
+   int istep;           /* input advance from one output to the next */
+   int zero;            /* outputs accumulate onto +0.0 */
+   int nterms;          /* terms of each output */
+   LETS_TERM *terms;    /* terms of the first output */
+   int npairs;          /* folded pairs, 0 if not folded */
+   int nsingle;         /* folded unpaired terms */
+   LETS_TERM *folds;    /* folded terms of the first output */
+} LETS_RUN;
+
+/* Lines lifted together, each step a vector across them; the  */
+/* lifting routines take LIFT_STRIP lines of scratch.           */
+#define LIFT_STRIP       16
+
+#define MAX_LETS_RUNS    2
+#define MAX_LETS_TERMS   256
+
+/* The exact sequence of multiply-adds get_lets or join_lets runs */
+/* for each output sample of a line, symmetric extension included. */
+typedef struct lets_plan {
+   int len;             /* samples along a line */
+   int valid;           /* 0 if the pass could not be planned */
+   int join;            /* planned from join_lets */
+   int inv;             /* spectral inversion of the pass */
+   int bank;            /* WSQ_BANK_* of the filters */
+   int fold;            /* runs folded, sums reassociated */
+   int maxterms;        /* term slots of each output */
+   int *nterms;         /* number of terms of each output */
+   char *zero;          /* output accumulates onto +0.0 */
+   char *inrun;         /* output computed by one of the runs */
+   LETS_TERM *terms;    /* maxterms slots for each output */
+   int nruns;           /* uniform interior runs */
+   LETS_RUN runs[MAX_LETS_RUNS];
+   LETS_TERM *folds;    /* maxterms folded slots for each run */
+   struct lets_plan *drop[2]; /* join plan without the lowpass or the */
+                              /*    highpass inputs, NULL if none     */
+} LETS_PLAN;
+
+/* The planned filter passes of a whole transform: one plan for */
+/* each distinct line length and inversion of the tree.         */
+typedef struct wavelet_plan {
+   int lift;            /* lifted in place, see can_lift_97 */
+   int nplans;          /* distinct passes planned */
+   LETS_PLAN plans[2*W_TREELEN];
+   LETS_PLAN *rows[W_TREELEN];   /* row pass of each node */
+   LETS_PLAN *cols[W_TREELEN];   /* column pass of each node */
+} WAVELET_PLAN;
+
+/* Inputs and coefficients of a run for one line, as the vector */
+/* kernels read them.                                           */
+typedef struct lets_args {
+   const float *base[MAX_LETS_TERMS]; /* input of each term at j = 0 */
+   float coef[MAX_LETS_TERMS];
+   float mask[MAX_LETS_TERMS];        /* -0.0 to subtract a pair's 2nd */
+   char neg[MAX_LETS_TERMS];          /* mask is -0.0 */
+   int nterms;
+   int fold;
+   int npairs;
+   int nsingle;
+   int zero;
+} LETS_ARGS;
+
+typedef int (*LETS_RUN_FN)(float *, const LETS_ARGS *, const int);
+typedef int (*LETS_PAIR_FN)(float *, const LETS_ARGS *, const LETS_ARGS *,
+                 const int);
+
+/* wavelet.c */
+int wsq_filter_bank(float *, const int, float *, const int, const int);
+int build_get_lets_plan(LETS_PLAN *, const int, float *, const int,
+                 float *, const int, const int, const int);
+int build_join_lets_plan(LETS_PLAN *, const int, float *, const int,
+                 float *, const int, const int, const int);
+void free_lets_plan(LETS_PLAN *);
+int build_wavelet_plan(WAVELET_PLAN *, W_TREE w_tree[], const int,
+                 float *, const int, float *, const int, const int, const int);
+void free_wavelet_plan(WAVELET_PLAN *);
+void lets_plan_inputs(const LETS_PLAN *, const int, const int, int *, int *);
+void lets_plan_zeros(const LETS_PLAN *, const char *, char *);
+void lets_rows(float *, float *, const int, const int, LETS_PLAN *,
+                 const int, const int, float *);
+void lets_cols(float *, float *, const int, const int, LETS_PLAN *,
+                 const int, const int, const char *);
+int lets_max_jobs(const int);
+void split_lets_rows(float *, float *, const int, const int, LETS_PLAN *,
+                 float *, const int);
+void split_lets_cols(float *, float *, const int, const int, LETS_PLAN *,
+                 const int);
+void window_lets_rows(float *, float *, const int, const int, LETS_PLAN *,
+                 const int, const int, float *, const int);
+void window_lets_cols(float *, float *, const int, const int, LETS_PLAN *,
+                 const int, const int, const int);
+void zero_lets_cols(float *, float *, const int, const int, LETS_PLAN *,
+                 const char *, const int);
+void pixel_lets_rows(float *, unsigned char *, const int, const int,
+                 LETS_PLAN *, const int, const int, const float, const float,
+                 float *, const int);
+void lets_rows_2_pixels(unsigned char *, float *, const int, const int,
+                 LETS_PLAN *, const float, const float, float *, const int);
+int can_lift_97(float *, const int, float *, const int, W_TREE w_tree[],
+                 const int, const int);
+void lift_decompose_97(float *, const int, const int, W_TREE w_tree[],
+                 const int, float *, const int);
+void lift_reconstruct_97(float *, const int, const int, W_TREE w_tree[],
+                 const int, float *, const int);
+
+#endif /* WAVELET_H_ */
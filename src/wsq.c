@@ -5,9 +5,15 @@
  *      Author: alainrc2005
  */
 
+#include <limits.h>
 #include "wsq.h"
+#include "batch.h"
 #include "decoder.h"
 #include "encoder.h"
+#include "plan.h"
+#include "scratch.h"
+#include "util.h"
+#include "thread.h"
 
 int WSQToRawImage(unsigned char * ps, const int ilen, int* w ,int* h, int* depth, int* ppi, unsigned char* odata, WSQContext *context)
 {
@@ -15,6 +21,18 @@ int WSQToRawImage(unsigned char * ps, const int ilen, int* w ,int* h, int* depth
 	return wsq_decode_mem(odata, w, h, depth, ppi, &lossyflag, ps, ilen, context);
 }
 
+int WSQToRawImageScaled(unsigned char * ps, const int ilen, int scale, int* w ,int* h, int* depth, int* ppi, unsigned char* odata, WSQContext *context)
+{
+  int lossyflag;
+	return wsq_decode_scaled_mem(odata, w, h, depth, ppi, &lossyflag, ps, ilen, scale, context);
+}
+
+int WSQToRawImageRegion(unsigned char * ps, const int ilen, int x, int y, int w, int h, int* depth, int* ppi, unsigned char* odata, WSQContext *context)
+{
+  int lossyflag;
+	return wsq_decode_region_mem(odata, x, y, w, h, depth, ppi, &lossyflag, ps, ilen, context);
+}
+
 int WSQGetDimensions(unsigned char *ps, const int ilen, int *w ,int *h, WSQContext *context)
 {
 	return wsq_get_dimensions(ps, ilen, w, h, context);
@@ -28,14 +46,100 @@ int RawImageToWSQ(unsigned char * ps, int w, int h, int* size, unsigned char* od
 WSQContext *WSQCreateContext(void)
 {
 	WSQContext *context;
-	context = malloc(sizeof(WSQContext));
+	context = calloc(1, sizeof(WSQContext));
 	if (!context) return 0;
+	context->threads = 1;
+	context->precision = WSQ_PRECISION_STRICT;
+	context->priority = WSQ_PRIORITY_NORMAL;
 	return context;
 }
 
+int WSQSetOption(WSQContext *context, int option, int value)
+{
+	if (!context) return -1;
+	switch (option)
+	{
+	case WSQ_OPTION_THREADS:
+		if (value < 1 || value > MAX_THREADS_WSQ) return -1;
+		context->threads = value;
+		return 0;
+	case WSQ_OPTION_PRECISION:
+		if (value != WSQ_PRECISION_STRICT && value != WSQ_PRECISION_FAST) return -1;
+		context->precision = value;
+		return 0;
+	case WSQ_OPTION_PRIORITY:
+		if (value != WSQ_PRIORITY_NORMAL && value != WSQ_PRIORITY_HIGH) return -1;
+		context->priority = value;
+		return 0;
+	}
+	return -1;
+}
+
 void WSQFreeContext(WSQContext *context)
 {
-	if (context) free(context);
+	if (!context) return;
+	free_wsq_decoder_resources(context);
+	free_wsq_plan(context->own_plan);
+	free_scratch_wsq(&context->scratch);
+	free_pool_wsq(context->pool);
+	free(context);
+}
+
+int WSQScratchSize(int w, int h)
+{
+	return WSQScratchSizeThreads(w, h, 1);
+}
+
+int WSQScratchSizeThreads(int w, int h, int threads)
+{
+	size_t encode, decode;
+	if (w < 1 || h < 1 || threads < 1 || threads > MAX_THREADS_WSQ) return -1;
+	/* files of up to w * h bytes, a length decodes take as an int */
+	if ((double)w * h > INT_MAX) return -1;
+	encode = encode_scratch_size(w, h, threads);
+	decode = decode_scratch_size(w, h, w * h, threads);
+	if (decode > encode) encode = decode;
+	encode += SCRATCH_ALIGN;
+	if (encode > INT_MAX) return -1;
+	return (int)encode;
+}
+
+int WSQSetScratch(WSQContext *context, void *buf, int size)
+{
+	if (!context || size < 0) return -1;
+	if (!buf) size = 0;
+	context->scratch.user = (unsigned char *)buf;
+	context->scratch.user_size = size;
+	return 0;
+}
+
+WSQPlan *WSQCreatePlan(int w, int h, int precision)
+{
+	WSQPlan *plan;
+	if (create_wsq_plan(&plan, w, h, precision)) return 0;
+	return plan;
+}
+
+void WSQFreePlan(WSQPlan *plan)
+{
+	free_wsq_plan(plan);
+}
+
+int WSQSetPlan(WSQContext *context, WSQPlan *plan)
+{
+	if (!context) return -1;
+	context->plan = plan;
+	return 0;
+}
+
+int WSQDecodeBatch(WSQBatchItem *items, int count, WSQContext *context)
+{
+	return decode_batch_wsq(items, count, context);
+}
+
+int WSQEncodeBatch(WSQBatchItem *items, int count, WSQContext *context)
+{
+	return encode_batch_wsq(items, count, context);
 }
 
 #if PLATFORM_WIN32 || PLATFORM_WIN64
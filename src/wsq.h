@@ -27,7 +27,60 @@
   odata - image pointer
 
 ************************************************************************/
-EXTERNC int API WSQToRawImage(unsigned char * ps, const int ilen, int* w ,int* h, int* depth, int* ppi, unsigned char** odata, WSQContext *context);
+EXTERNC int API WSQToRawImage(unsigned char * ps, const int ilen, int* w ,int* h, int* depth, int* ppi, unsigned char* odata, WSQContext *context);
+
+/***************************************************************************
+****************************************************************************
+ Decode at a reduced resolution
+
+ Decodes only the low frequency subbands of a WSQ image, for a
+ thumbnail or preview at 1/scale of its resolution: the huffman coded
+ blocks holding them and the levels of the wavelet reconstruction
+ down to that scale.  Each scale halves the width and height, rounding
+ up, so odata must hold (W + scale - 1) / scale by (H + scale - 1) /
+ scale pixels of a W x H image (see WSQGetDimensions); a scale of 1 is
+ WSQToRawImage.
+
+ Input
+  ps    - WSQ information data
+  ilen  - size of WSQ
+  scale - 1, 2, 4 or 8
+  context - context WSQ library for multi-process thread
+ Output
+  w     - reduced image width
+  h     - reduced image height
+  depth - bits per pixel (8)
+  ppi   - pixel per inch of the full image
+  odata - image pointer
+
+************************************************************************/
+EXTERNC int API WSQToRawImageScaled(unsigned char * ps, const int ilen, int scale, int* w ,int* h, int* depth, int* ppi, unsigned char* odata, WSQContext *context);
+
+/***************************************************************************
+****************************************************************************
+ Decode a region of interest
+
+ Decodes the w x h window at x, y of a WSQ image only, for a crop of a
+ large scan.  The whole datastream is still huffman decoded, but the
+ wavelet reconstruction covers only the samples each level of the
+ transform needs for the window, and only the window is converted to
+ pixels.  A window smaller than the image is that of WSQToRawImage in
+ WSQ_PRECISION_STRICT, bit for bit, whatever the precision of the
+ context; the whole image is decoded as by WSQToRawImage.
+
+ Input
+  ps    - WSQ information data
+  ilen  - size of WSQ
+  x, y  - top left corner of the window in the image
+  w, h  - window width and height, inside the image (see WSQGetDimensions)
+  context - context WSQ library for multi-process thread
+ Output
+  depth - bits per pixel (8)
+  ppi   - pixel per inch
+  odata - w x h image pointer
+
+************************************************************************/
+EXTERNC int API WSQToRawImageRegion(unsigned char * ps, const int ilen, int x, int y, int w, int h, int* depth, int* ppi, unsigned char* odata, WSQContext *context);
 
 EXTERNC int API WSQGetDimensions(unsigned char *ps, const int ilen, int *w ,int *h, WSQContext *context);
 
@@ -61,7 +114,7 @@ EXTERNC API  WSQContext* WSQCreateContext(void);
 
 /***************************************************************************
 ****************************************************************************
- Free context
+ Free context, joining its worker threads
 
 Input
  context - context to free
@@ -69,6 +122,192 @@ Input
 ****************************************************************************/
 EXTERNC void API WSQFreeContext(WSQContext *context);
 
+/***************************************************************************
+****************************************************************************
+ Set context option
+
+Input
+ context - context to configure
+ option  - WSQ_OPTION_* identifier
+ value   - new option value
+
+ WSQ_OPTION_THREADS - most threads a single encode or decode call may
+                      use, the calling one included (default 1).  With
+                      more than one, the three huffman coded blocks are
+                      counted and compressed, or located and decoded,
+                      on separate threads, and the row and column
+                      passes of the larger nodes of the wavelet
+                      decomposition and reconstruction are split
+                      across threads.  Results do not depend on the
+                      number of threads.
+
+ WSQ_OPTION_PRECISION - WSQ_PRECISION_STRICT (default) reproduces the
+                      NBIS output bit for bit, on every processor.
+                      WSQ_PRECISION_FAST computes the standard 9/7
+                      wavelet transform by lifting, in place, reorders
+                      the sums of other filters, and fuses multiply-adds
+                      on processors with FMA.  Encoding, it sums the
+                      subband variances in double and quantizes by
+                      the reciprocal of the bin widths, so the bit
+                      allocation and bins may differ from NBIS by a
+                      rounding as well.  Its coefficients differ
+                      from the NBIS convolution by float rounding only:
+                      by less than 1e-5 of the largest coefficient of
+                      the image (about 1e-6 measured).  That may move
+                      an occasional coefficient to the next quantization
+                      bin: decoded pixels usually stay within 1 of the
+                      strict output, a few near such a coefficient may
+                      move further, and the error against the original
+                      image does not change measurably.  Fast results
+                      may differ from one processor to another.
+
+ The vector kernels used (SSE2, AVX2, FMA) are picked when the library
+ runs, for the processor running it, in either precision.
+
+ WSQ_OPTION_PRIORITY - WSQ_PRIORITY_NORMAL (default) or WSQ_PRIORITY_HIGH.
+                      While calls on high priority contexts are in
+                      progress, batches of normal priority give up one
+                      of their threads for each thread of those calls,
+                      between two stages of their items, so interactive
+                      requests are not held up by a bulk reload.
+
+ Return code
+  0 on success, -1 for an unknown option or invalid value
+
+****************************************************************************/
+#define WSQ_OPTION_THREADS    1
+#define WSQ_OPTION_PRECISION  2
+#define WSQ_OPTION_PRIORITY   3
+
+EXTERNC int API WSQSetOption(WSQContext *context, int option, int value);
+
+/***************************************************************************
+****************************************************************************
+ Create a plan for images of one size
+
+ A plan holds the decomposition trees and the planned wavelet filter
+ passes of an image size, built once instead of at every call.  It is
+ never modified after creation, so any number of contexts, on any
+ threads, may share one.
+
+Input
+ w         - image width
+ h         - image height
+ precision - WSQ_PRECISION_* the plan is for
+
+ Return code
+  WSQPlan* pointer, 0 on failure
+
+****************************************************************************/
+EXTERNC API WSQPlan* WSQCreatePlan(int w, int h, int precision);
+
+/***************************************************************************
+****************************************************************************
+ Free plan, once no context uses it any longer
+
+Input
+ plan - plan to free
+
+****************************************************************************/
+EXTERNC void API WSQFreePlan(WSQPlan *plan);
+
+/***************************************************************************
+****************************************************************************
+ Attach a plan to a context
+
+ Encodes and decodes of images with the size of the plan, while the
+ context precision matches that of the plan, use it; others proceed
+ as without one.  The context does not take ownership of the plan.
+
+Input
+ context - context to configure
+ plan    - plan to use, 0 to detach
+
+ Return code
+  0 on success, -1 without a context
+
+****************************************************************************/
+EXTERNC int API WSQSetPlan(WSQContext *context, WSQPlan *plan);
+
+/***************************************************************************
+****************************************************************************
+ Working memory of a context
+
+ Each context keeps the memory its calls work in and grows it to the
+ most any call has needed, and keeps the worker threads of calls using
+ more than one, started at the first that needs them, until it is
+ freed, so repeated encodes and decodes of images of one size make no
+ heap allocations and start no threads after the first.  The caller may
+ instead hand a context a buffer of its own: calls it is large enough
+ for work in it; others fall back to the memory of the context.
+
+ WSQScratchSize returns the bytes of buffer covering the encode and
+ the decode of a w x h image, the decode of files up to w * h bytes,
+ by a context using one thread.  A context using more threads splits
+ the wavelet transform in jobs, each with lines of its own: size its
+ buffer with WSQScratchSizeThreads.
+
+Input
+ w       - image width
+ h       - image height
+ threads - WSQ_OPTION_THREADS of the context
+
+ Return code
+  bytes of buffer, -1 for an invalid size
+
+****************************************************************************/
+EXTERNC int API WSQScratchSize(int w, int h);
+EXTERNC int API WSQScratchSizeThreads(int w, int h, int threads);
+
+/***************************************************************************
+****************************************************************************
+ Set the working memory of a context
+
+ The buffer must stay valid, and unused by anything else, while the
+ context works in it.  The context does not take ownership of it.
+
+Input
+ context - context to configure
+ buf     - buffer, 0 to detach
+ size    - bytes of the buffer, see WSQScratchSize
+
+ Return code
+  0 on success, -1 without a context or for a negative size
+
+****************************************************************************/
+EXTERNC int API WSQSetScratch(WSQContext *context, void *buf, int size);
+
+/***************************************************************************
+****************************************************************************
+ Decode or encode an array of images in one call
+
+ The items are worked through on up to WSQ_OPTION_THREADS threads of
+ the context, images of one size together so that they share their
+ trees, plans and working memory; the precision, priority and plan
+ of the context apply to every item.  Decodes are pipelined: the
+ huffman decoding of an image overlaps the wavelet reconstruction of
+ another, and idle threads steal work from busy ones.  Each item gets
+ a status of its own, and one failing does not stop the others.
+
+ WSQDecodeBatch reads input_len bytes of WSQ data at input and writes
+ the pixels to output, setting width, height, ppi and output_len.
+ WSQEncodeBatch reads the width x height 8 bit pixels at input, with
+ ppi for the comment of the file, and writes the WSQ data to output,
+ setting output_len.  Either way output_size must be at least width
+ times height bytes.
+
+Input
+ items   - array of items
+ count   - number of items
+ context - context whose options and plan apply
+
+ Return code
+  number of items whose status is not 0, -1 for an invalid batch
+
+****************************************************************************/
+EXTERNC int API WSQDecodeBatch(WSQBatchItem *items, int count, WSQContext *context);
+EXTERNC int API WSQEncodeBatch(WSQBatchItem *items, int count, WSQContext *context);
+
 #if PLATFORM_WIN32 || PLATFORM_WIN64
  typedef enum _PixelFormatType
   {
@@ -103,6 +103,9 @@ typedef struct quant_tree {
 } Q_TREE;
 #define Q_TREELEN 64
 
+/* Most taps of a filter a transform table may define. */
+#define MAX_DTT_FILT 256
+
 typedef struct table_dtt {
    float *lofilt;
    float *hifilt;
@@ -134,6 +137,125 @@ typedef struct table_dht {
    unsigned char huffvalues[MAX_HUFFCOUNTS_WSQ+1];
 } DHT_TABLE;
 
+/* Huffman codes of up to HUFF_LOOKUP_BITS bits are decoded with a */
+/* single probe of the lookup table; longer codes fall back to the */
+/* maxcode/mincode/valptr walk.                                    */
+#define HUFF_LOOKUP_BITS    10
+#define HUFF_LOOKUP_SIZE    (1 << HUFF_LOOKUP_BITS)
+
+typedef struct huff_lookup {
+   unsigned char len;   /* code length, 0 if longer than lookup bits */
+   unsigned char val;   /* huffman value of the code */
+   unsigned char len2;  /* length of code pair, 0 if no pair fits */
+   unsigned char val2;  /* huffman value of the second code */
+} HUFF_LOOKUP;
+
+typedef struct huff_decoder {
+   int maxcode[MAX_HUFFBITS+1];
+   int mincode[MAX_HUFFBITS+1];
+   int valptr[MAX_HUFFBITS+1];
+   unsigned char huffvalues[MAX_HUFFCOUNTS_WSQ+1];
+   HUFF_LOOKUP lookup[HUFF_LOOKUP_SIZE];
+} HUFF_DECODER;
+
+/* Entropy coded data is unstuffed into a buffer padded with */
+/* BIT_READER_PAD bytes of 0xFF, so refilling the 64 bit window */
+/* never checks for the end of the data.                        */
+#define BIT_READER_PAD      16
+
+typedef struct bit_reader_wsq {
+   unsigned char *cbufptr;    /* next unstuffed byte to load */
+   unsigned long long bitbuf; /* buffered bits, left justified */
+   int bits;                  /* number of valid bits in bitbuf */
+   int bitsleft;              /* bits of entropy coded data not consumed */
+   unsigned short marker;     /* marker ending the entropy coded data */
+} BIT_READER_WSQ;
+
+/* A quantized block is coded as a stream of tokens, each holding */
+/* a huffman value and the escape payload that follows its code.  */
+#define WSQ_TOKEN(_val_, _extra_) \
+   (((unsigned int)(_extra_) << 8) | (unsigned int)(_val_))
+#define WSQ_TOKEN_VAL(_tok_)     ((_tok_) & 0xFF)
+#define WSQ_TOKEN_EXTRA(_tok_)   ((_tok_) >> 8)
+
+/* Each token is appended to the bit writer as one codeword, */
+/* shifted to make room for its escape payload.              */
+typedef struct huff_append {
+   unsigned int code;   /* codeword shifted by escape payload size */
+   int size;            /* total number of bits */
+} HUFF_APPEND;
+
+typedef struct huff_encoder {
+   HUFF_APPEND append[MAX_HUFFCOUNTS_WSQ]; /* by huffman value */
+} HUFF_ENCODER;
+
+typedef struct bit_writer_wsq {
+   unsigned char *outbuf;     /* next byte of the output buffer */
+   unsigned long long bitbuf; /* pending bits, right justified */
+   int bits;                  /* number of pending bits, under 32 */
+} BIT_WRITER_WSQ;
+
+/* A huffman table generated for a block: its codes by huffman */
+/* value and the parameters the DHT segment stores.             */
+typedef struct huff_table_wsq {
+   HUFFCODE codes[MAX_HUFFCOUNTS_WSQ+1];
+   unsigned char bits[MAX_HUFFBITS<<1];        /* codes of each size */
+   unsigned char values[MAX_HUFFCOUNTS_WSQ+1]; /* values by code size */
+} HUFF_TABLE_WSQ;
+
+/* A huffman coded block: tokenized, counted and compressed by */
+/* jobs that may run on separate threads.                      */
+typedef struct huff_block_wsq {
+   short *sip;             /* quantized block */
+   int sip_siz;            /* size of quantized block */
+   unsigned int *tokens;   /* tokens of the block, sip_siz long */
+   int num_tokens;         /* number of tokens */
+   int counts[MAX_HUFFCOUNTS_WSQ+1]; /* occurrences of each huffman value */
+   HUFFCODE *hufftable;    /* huffman codes of the block */
+   unsigned char *outbuf;  /* compressed block */
+   int bytes;              /* number of compressed bytes */
+   int ret;                /* error code of the last job */
+} HUFF_BLOCK_WSQ;
+
+/* Where the coefficients of huffman blocks are written as they are */
+/* decoded: dequantized, at their place in the subbands of the       */
+/* floating point image, which starts zeroed so zero runs are skips. */
+/* Bit s of bands[y] is set once row y of subband s has a non-zero   */
+/* coefficient.                                                       */
+typedef struct coef_writer_wsq {
+   float *fip;             /* floating point image */
+   unsigned long long *bands; /* non-zero subbands of each image row */
+   int width;              /* image width, the pitch of the subbands */
+   int height;
+   const DQT_TABLE *dqt_table;
+   const Q_TREE *q_tree;
+   int band;               /* subband being written */
+   int last;               /* one past the last subband to write */
+   float *fptr;            /* next coefficient, NULL outside the image */
+   int y;                  /* image row of fptr */
+   unsigned long long bit; /* bit of the subband in bands */
+   int left;               /* coefficients left in the row */
+   int rows;               /* rows of the subband after this one */
+   int lenx;               /* row length of the subband */
+   float q_bin;            /* quantizer bin width of the subband */
+   double z_half;          /* half its zero bin width */
+   float C;                /* quantizer bin center */
+} COEF_WRITER_WSQ;
+
+/* A block of huffman encoded data, located by scanning for the */
+/* marker that ends it, with the tables it decodes with, so it   */
+/* may be decoded in order or by a job on a separate thread.     */
+typedef struct huff_dblock_wsq {
+   unsigned char *cbufptr; /* first byte of entropy coded data */
+   unsigned char *ebufptr; /* end of entropy coded data */
+   unsigned short marker;  /* marker ending the data, 0 if none */
+   unsigned char *ubuf;    /* unstuffed data, see unstuff_block_data_mem */
+   HUFF_DECODER decoder;   /* decoding tables of the block */
+   DQT_TABLE dqt_table;    /* quantization table at its start */
+   COEF_WRITER_WSQ writer; /* subbands of the block */
+   int ret;                /* error code of the decoding job */
+} HUFF_DBLOCK_WSQ;
+
 typedef struct header_frm {
    unsigned char black;
    unsigned char white;
@@ -145,6 +267,51 @@ typedef struct header_frm {
    unsigned short software;
 } FRM_HEADER_WSQ;
 
+/* Most allocations a call makes past its scratch block. */
+#define MAX_SCRATCH_EXTRA     16
+
+/* Values of the WSQ_OPTION_PRECISION option. */
+#define WSQ_PRECISION_STRICT  0   /* bit exact NBIS output */
+#define WSQ_PRECISION_FAST    1   /* faster, within float rounding */
+
+/* Values of the WSQ_OPTION_PRIORITY option, see sched.c. */
+#define WSQ_PRIORITY_NORMAL   0   /* bulk work */
+#define WSQ_PRIORITY_HIGH     1   /* interactive, takes the priority lane */
+
+/* Working memory of a context: a block handed out in order by     */
+/* alloc_scratch_wsq and reused from call to call, see scratch.h.   */
+typedef struct wsq_scratch {
+   unsigned char *base;       /* block of the current call */
+   size_t size;               /* bytes at base */
+   size_t used;               /* bytes handed out */
+   size_t peak;               /* most bytes a call has needed */
+   unsigned char *owned;      /* block allocated by the library */
+   size_t owned_size;
+   unsigned char *user;       /* block set by WSQSetScratch */
+   size_t user_size;
+   void *extra[MAX_SCRATCH_EXTRA]; /* allocations past the block */
+   int nextra;
+   size_t extra_size;         /* bytes of the extra allocations */
+} WSQ_SCRATCH;
+
+/* Shared plan of an image size, see plan.h. */
+typedef struct _WSQPlan WSQPlan;
+
+/* One image of a batch, see WSQDecodeBatch and WSQEncodeBatch: only */
+/* ints and pointers, laid out for marshaling as a flat array.       */
+typedef struct _WSQBatchItem
+{
+	unsigned char *input;  /*WSQ data, or pixels to encode*/
+	int input_len;         /*bytes of WSQ data*/
+	int width;             /*image width, set by decoding*/
+	int height;            /*image height, set by decoding*/
+	int ppi;               /*pixels per inch, set by decoding*/
+	unsigned char *output; /*pixels, or WSQ data, written*/
+	int output_size;       /*bytes of the output buffer*/
+	int output_len;        /*bytes written to the output buffer*/
+	int status;            /*0, or the error code of the item*/
+} WSQBatchItem;
+
 /* External global variables. */
 typedef struct _WSQContext
 {
@@ -155,8 +322,13 @@ typedef struct _WSQContext
 	DQT_TABLE dqt_table;
 	DHT_TABLE dht_table[MAX_DHT_TABLES];
 	FRM_HEADER_WSQ frm_header_wsq;
-	unsigned char code;   /*next byte of data*/
-	unsigned char code2;  /*stuffed byte of data*/
+	int threads;          /*most threads used by a call*/
+	int precision;        /*WSQ_PRECISION_* of the transform*/
+	int priority;         /*WSQ_PRIORITY_* of the calls*/
+	WSQPlan *plan;        /*shared plan, not owned, or NULL*/
+	WSQPlan *own_plan;    /*plan of the last size used without one*/
+	WSQ_SCRATCH scratch;  /*working memory of the calls*/
+	struct wsq_pool *pool; /*worker threads of the calls, or NULL*/
 } WSQContext;
 
 extern float hifilt[MAX_HIFILT];
@@ -0,0 +1,145 @@
+/*
+ * decode_threads.c
+ *
+ *  Decodes the same corrupted WSQ datastreams with one thread and with
+ *  several, and checks that both give the same status and, when they
+ *  decode, the same pixels: results must not depend on the number of
+ *  threads, for malformed files either.
+ *
+ *  Build and run from the repository root:
+ *
+ *     cc -O2 -Isrc test/decode_threads.c src/[a-z_]*.c -o decode_threads -lm -lpthread
+ *     ./decode_threads
+ *
+ *  Returns 0 when every stream decodes alike, 1 otherwise.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "wsq.h"
+
+#define WIDTH   320
+#define HEIGHT  400
+#define CASES   400
+#define THREADS 3
+
+/* Generator of the corruptions, the same on every platform. */
+static unsigned int seed = 11;
+static int next_rand(const int n)
+{
+   seed = seed * 1103515245 + 12345;
+   return((int)((seed >> 8) % (unsigned int)n));
+}
+
+/* A fingerprint like image: ridges of varying direction and period. */
+static void make_image(unsigned char *pix)
+{
+   int x, y, v;
+
+   for(y = 0; y < HEIGHT; y++)
+      for(x = 0; x < WIDTH; x++) {
+         v = 128 + (int)(90.0 * ((((x * 7 + y * 3) / (5 + y / 80)) & 1) ?
+                                 1.0 : -1.0)) + ((x * y) % 23) - 11;
+         pix[y * WIDTH + x] = (unsigned char)(v < 0 ? 0 : v > 255 ? 255 : v);
+      }
+}
+
+/* Flips bits, overwrites bytes or writes markers into the entropy */
+/* coded data and tables of data, and may cut its end off.         */
+static int corrupt(unsigned char *data, const int len)
+{
+   int kind, k, n, pos;
+
+   kind = next_rand(4);
+   n = 1 + next_rand(6);
+   for(k = 0; k < n; k++) {
+      pos = 100 + next_rand(len - 101);
+      switch(kind) {
+      case 0:
+         data[pos] ^= (unsigned char)(1 << next_rand(8));
+         break;
+      case 1:
+         data[pos] = (unsigned char)next_rand(256);
+         break;
+      case 2:
+         /* SOF to COM markers, the ones between blocks */
+         data[pos] = 0xFF;
+         data[pos+1] = (unsigned char)(0xA2 + next_rand(7));
+         break;
+      default:
+         data[pos] ^= 0x10;
+         break;
+      }
+   }
+
+   return(next_rand(4) == 0 ? len - next_rand(len / 2) : len);
+}
+
+int main(void)
+{
+   unsigned char *pix, *wsq, *data, *out1, *outn;
+   int size, len, i, ret1, retn, w1, h1, wn, hn, depth, ppi;
+   int decoded = 0, failures = 0;
+   WSQContext *context1, *contextn;
+
+   pix = (unsigned char *)malloc(WIDTH * HEIGHT);
+   wsq = (unsigned char *)malloc(WIDTH * HEIGHT);
+   data = (unsigned char *)malloc(WIDTH * HEIGHT);
+   out1 = (unsigned char *)malloc(WIDTH * HEIGHT);
+   outn = (unsigned char *)malloc(WIDTH * HEIGHT);
+   context1 = WSQCreateContext();
+   contextn = WSQCreateContext();
+   if(!pix || !wsq || !data || !out1 || !outn || !context1 || !contextn ||
+      WSQSetOption(contextn, WSQ_OPTION_THREADS, THREADS)) {
+      fprintf(stderr, "decode_threads : out of memory\n");
+      return(1);
+   }
+
+   make_image(pix);
+   if(RawImageToWSQ(pix, WIDTH, HEIGHT, &size, wsq, context1)) {
+      fprintf(stderr, "decode_threads : encode failed\n");
+      return(1);
+   }
+
+   for(i = 0; i < CASES; i++) {
+      memcpy(data, wsq, size);
+      len = corrupt(data, size);
+      /* the pixels of a frame header corrupted to another size */
+      /* would not fit the output, and are left out             */
+      if(WSQGetDimensions(data, len, &w1, &h1, context1) == 0 &&
+         (w1 != WIDTH || h1 != HEIGHT))
+         continue;
+      memset(out1, 0, WIDTH * HEIGHT);
+      memset(outn, 0, WIDTH * HEIGHT);
+      ret1 = WSQToRawImage(data, len, &w1, &h1, &depth, &ppi, out1,
+                           context1);
+      retn = WSQToRawImage(data, len, &wn, &hn, &depth, &ppi, outn,
+                           contextn);
+      if(ret1 != retn) {
+         printf("case %d : status %d with 1 thread, %d with %d\n",
+                i, ret1, retn, THREADS);
+         failures++;
+      }
+      else if(ret1 == 0) {
+         decoded++;
+         if(w1 != wn || h1 != hn || memcmp(out1, outn, w1 * h1)) {
+            printf("case %d : pixels differ with 1 and %d threads\n",
+                   i, THREADS);
+            failures++;
+         }
+      }
+   }
+
+   printf("decode_threads : %d streams, %d decoded, %d failures\n",
+          CASES, decoded, failures);
+   WSQFreeContext(context1);
+   WSQFreeContext(contextn);
+   free(pix);
+   free(wsq);
+   free(data);
+   free(out1);
+   free(outn);
+
+   return(failures ? 1 : 0);
+}